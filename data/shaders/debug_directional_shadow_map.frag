@@ -4,10 +4,10 @@ in vec2 tex_coord;
 
 out vec4 colour;
 
-uniform sampler2D directional_shadow_map;
+uniform sampler2DArray directional_shadow_map; // one layer per cascade, this shows the first
 
 void main()
 {
-    float depth_value = texture(directional_shadow_map, tex_coord).r;
+    float depth_value = texture(directional_shadow_map, vec3(tex_coord, 0.0)).r;
     colour = vec4(vec3(depth_value), 1.0);
 }
\ No newline at end of file
@@ -1,12 +1,16 @@
-#version 330 core
+#version 430 core
 
-layout (location = 0) out vec4 gPosition;
-layout (location = 1) out vec4 gNormal;
-layout (location = 2) out vec4 gAlbedo;
+layout (location = 0) out vec4 gNormal;
+layout (location = 1) out vec4 gAlbedo;
+layout (location = 2) out vec4 gPosition; // only attached with the old G-buffer layout (gbuffer_position_target 1)
+
+const float MAX_SPECULAR_INTENSITY = 8.0; // specular intensity is stored in gAlbedo.a as a fraction of this
+const float MAX_SHININESS_LOG2 = 8.0;      // compact normals: log2(shininess) is stored in gNormal.b as a fraction of this
 
 in vec2 tex_coord;
 in vec3 normal;
 in vec3 frag_pos;
+flat in uint draw_index;
 
 struct Material
 {
@@ -14,19 +18,59 @@ struct Material
     float shininess;
 };
 uniform Material material;
-uniform sampler2D texture_sampler_0;
+uniform sampler2D texture_samplers[16]; // MAX_DRAW_TEXTURES, bound to texture units 0 to 15
+
+// Written by each pass, see pass_constants_t and PASS_CONSTANTS_UBO_BINDING
+layout(std140) uniform pass_constants
+{
+    mat4 light_matrices[6];
+    vec4 light_position;                // w is the far plane
+    bool b_position_target;             // G-buffer layout
+    // Compact G-buffer (gbuffer_compact_normals 1): gNormal is RGB10_A2 holding the octahedral encoded normal in rg
+    // and shininess in b. Otherwise it's RGBA16F holding the normal in rgb and shininess in a.
+    bool b_compact_normals;
+    bool b_clustered;
+    int tile_depth_culling;
+    bool b_light_histogram;
+};
+
+layout (std430, binding = 5) readonly buffer draw_data // DRAW_DATA_SSBO_BINDING
+{
+    uint draw_texture_slots[];
+};
+
+vec2 octahedral_encode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 encoded = n.xy;
+    if(n.z < 0.0)
+    {
+        vec2 sign_not_zero = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+        encoded = (1.0 - abs(n.yx)) * sign_not_zero;
+    }
+    return encoded * 0.5 + 0.5;
+}
 
 void main()
 {
-    vec4 diffuse_texture_sample = texture(texture_sampler_0, tex_coord);
+    vec4 diffuse_texture_sample = texture(texture_samplers[draw_texture_slots[draw_index]], tex_coord);
     if(diffuse_texture_sample.a < 0.5f)
     {
         discard;
     }
 
-    gPosition.rgb = frag_pos;
-    gPosition.a = material.specular_intensity;
-    gNormal.rgb = normalize(normal);
-    gNormal.a = material.shininess;
+    if(b_compact_normals)
+    {
+        gNormal.rg = octahedral_encode(normalize(normal));
+        gNormal.b = clamp(log2(max(material.shininess, 1.0)) / MAX_SHININESS_LOG2, 0.0, 1.0);
+        gNormal.a = 0.0;
+    }
+    else
+    {
+        gNormal.rgb = normalize(normal);
+        gNormal.a = material.shininess;
+    }
     gAlbedo.rgb = diffuse_texture_sample.rgb;
+    gAlbedo.a = clamp(material.specular_intensity / MAX_SPECULAR_INTENSITY, 0.0, 1.0);
+    gPosition = vec4(frag_pos, 1.0);
 }
\ No newline at end of file
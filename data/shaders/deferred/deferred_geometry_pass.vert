@@ -1,22 +1,41 @@
-#version 330 core
+#version 430 core
+#extension GL_ARB_shader_draw_parameters : require
 
 layout (location = 0) in vec3 pos;
 layout (location = 1) in vec2 in_tex_coord;
 layout (location = 2) in vec3 in_normal;
+layout (location = 3) in mat4 instance_matrix_model; // per instance, see INSTANCE_MATRIX_ATTRIB_LOCATION
 
 out vec2 tex_coord;
 out vec3 normal;
 out vec3 frag_pos;
+flat out uint draw_index; // index of this draw's data, see DRAW_DATA_SSBO_BINDING
 
-uniform mat4 matrix_model;
-uniform mat4 matrix_view;
-uniform mat4 matrix_proj_perspective;
+// Shared by every program, see frame_constants_t and FRAME_CONSTANTS_UBO_BINDING
+layout(std140) uniform frame_constants
+{
+    mat4 matrix_view;
+    mat4 matrix_proj_perspective;
+    mat4 matrix_proj_orthographic;
+    mat4 inverse_view_projection;
+    mat4 cascade_light_transforms[4];   // SHADOW_CASCADE_COUNT directional shadow cascades
+    vec4 camera_position;
+    vec4 directional_light_colour;      // w is the ambient intensity
+    vec4 directional_light_direction;   // w is the diffuse intensity
+    vec4 cascade_far_depths;            // view depth each cascade ends at
+    vec2 camera_near_far;               // x is near clip, y is far clip
+    ivec2 screen_size;
+    int point_light_count;
+};
+
+uniform uint draw_data_offset; // gl_DrawIDARB restarts at 0 for every multi-draw
 
 void main()
 {
-    vec4 world_position = matrix_model * vec4(pos, 1.0);
+    vec4 world_position = instance_matrix_model * vec4(pos, 1.0);
     gl_Position = matrix_proj_perspective * matrix_view * world_position;
     tex_coord = in_tex_coord;
-    normal = mat3(transpose(inverse(matrix_model))) * in_normal;
+    normal = mat3(transpose(inverse(instance_matrix_model))) * in_normal;
     frag_pos = world_position.xyz;
+    draw_index = draw_data_offset + uint(gl_DrawIDARB);
 }
\ No newline at end of file
@@ -1,15 +1,17 @@
 #version 330
 
-/** shader for rendering shadow map from the point of view 
-    of a directional light 
+/** shader for rendering the cascades of a directional light's shadow map,
+    see directional_shadow_map.geom
 */
 
 layout (location = 0) in vec3 pos;
+layout (location = 3) in mat4 instance_matrix_model; // per instance, see INSTANCE_MATRIX_ATTRIB_LOCATION
+layout (location = 7) in uint instance_face_mask;
 
-uniform mat4 matrix_model;
-uniform mat4 directionalLightTransform; // combination of ortho projection matrix * view matrix
+flat out uint vs_face_mask;
 
 void main()
 {
-    gl_Position = directionalLightTransform * matrix_model * vec4(pos, 1.0);
+    gl_Position = instance_matrix_model * vec4(pos, 1.0);
+    vs_face_mask = instance_face_mask;
 }
\ No newline at end of file
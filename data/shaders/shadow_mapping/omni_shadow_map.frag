@@ -2,12 +2,21 @@
 
 in vec4 FragPos;
 
-uniform vec3 lightPos;
-uniform float farPlane;
+// Written by each pass, see pass_constants_t and PASS_CONSTANTS_UBO_BINDING
+layout(std140) uniform pass_constants
+{
+    mat4 light_matrices[6];
+    vec4 light_position;                // w is the far plane
+    bool b_position_target;             // G-buffer layout
+    bool b_compact_normals;
+    bool b_clustered;
+    int tile_depth_culling;
+    bool b_light_histogram;
+};
 
 void main()
 {
-    float distance = length(FragPos.xyz - lightPos);
-    distance = distance / farPlane;
+    float distance = length(FragPos.xyz - light_position.xyz);
+    distance = distance / light_position.w;
     gl_FragDepth = distance; // overwrite the preset frag depth value
 }
\ No newline at end of file
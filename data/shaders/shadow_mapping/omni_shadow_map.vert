@@ -1,10 +1,13 @@
 #version 330
 
 layout (location = 0) in vec3 pos;
+layout (location = 3) in mat4 instance_matrix_model; // per instance, see INSTANCE_MATRIX_ATTRIB_LOCATION
+layout (location = 7) in uint instance_face_mask;
 
-uniform mat4 matrix_model;
+flat out uint vs_face_mask;
 
 void main()
 {
-    gl_Position = matrix_model * vec4(pos, 1.0);
+    gl_Position = instance_matrix_model * vec4(pos, 1.0);
+    vs_face_mask = instance_face_mask;
 }
\ No newline at end of file
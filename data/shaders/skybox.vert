@@ -4,11 +4,26 @@ layout (location = 0) in vec3 pos;
 
 out vec3 tex_coords;
 
-uniform mat4 matrix_view;
-uniform mat4 matrix_proj_perspective;
+// Shared by every program, see frame_constants_t and FRAME_CONSTANTS_UBO_BINDING
+layout(std140) uniform frame_constants
+{
+    mat4 matrix_view;
+    mat4 matrix_proj_perspective;
+    mat4 matrix_proj_orthographic;
+    mat4 inverse_view_projection;
+    mat4 cascade_light_transforms[4];   // SHADOW_CASCADE_COUNT directional shadow cascades
+    vec4 camera_position;
+    vec4 directional_light_colour;      // w is the ambient intensity
+    vec4 directional_light_direction;   // w is the diffuse intensity
+    vec4 cascade_far_depths;            // view depth each cascade ends at
+    vec2 camera_near_far;               // x is near clip, y is far clip
+    ivec2 screen_size;
+    int point_light_count;
+};
 
 void main()
 {
     tex_coords = pos;
-    gl_Position = matrix_proj_perspective * matrix_view * vec4(pos, 1.0);
+    // Only the rotation of the view, the skybox moves with the camera
+    gl_Position = matrix_proj_perspective * mat4(mat3(matrix_view)) * vec4(pos, 1.0);
 }
\ No newline at end of file
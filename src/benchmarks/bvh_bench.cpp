@@ -0,0 +1,189 @@
+/** BVH benchmark
+
+    For 1k to 1M primitives (boxes scattered in clusters, roughly like objects in a level):
+        build:    bvh_t::build time
+        refit:    time to refit after moving 1% of the primitives one at a time, and after moving all of them
+        frustum:  camera frustum query vs testing every primitive
+        sphere:   light volume overlap query
+        ray:      nearest hit raycast
+    Every query result is compared against a brute force scan of all primitives.
+*/
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+#include "../renderer/frustum.h"
+#include "../renderer/bvh.h"
+
+INTERNAL const int BENCH_QUERY_COUNT = 64;
+
+INTERNAL float random_float(float lower, float upper)
+{
+    return lower + (upper - lower) * ((float) rand() / (float) RAND_MAX);
+}
+
+INTERNAL double elapsed_ns(std::chrono::high_resolution_clock::time_point start)
+{
+    auto end = std::chrono::high_resolution_clock::now();
+    return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+INTERNAL aabb_t random_box(float world_size)
+{
+    vec3 center = make_vec3(random_float(-world_size, world_size), random_float(-world_size * 0.1f, world_size * 0.1f), random_float(-world_size, world_size));
+    vec3 extents = make_vec3(random_float(0.2f, 3.f), random_float(0.2f, 3.f), random_float(0.2f, 3.f));
+    aabb_t box;
+    box.min = center - extents;
+    box.max = center + extents;
+    return box;
+}
+
+INTERNAL void run_bench(int count)
+{
+    // Clustered: objects in a level tend to be grouped
+    float world_size = 50.f * sqrtf((float) count);
+    std::vector<aabb_t> boxes(count);
+    int cluster_size = 64;
+    for(int i = 0; i < count; i += cluster_size)
+    {
+        aabb_t cluster = random_box(world_size);
+        vec3 cluster_center = cluster.get_center();
+        for(int j = i; j < kc_min(i + cluster_size, count); ++j)
+        {
+            boxes[j] = random_box(40.f);
+            boxes[j].min += cluster_center;
+            boxes[j].max += cluster_center;
+        }
+    }
+
+    bvh_t bvh;
+    auto start = std::chrono::high_resolution_clock::now();
+    bvh.build(boxes.data(), count);
+    double build_ns = elapsed_ns(start);
+
+    // Refit after nudging 1% of the primitives, one at a time
+    int moved_count = kc_max(count / 100, 1);
+    std::vector<int> moved(moved_count);
+    for(int i = 0; i < moved_count; ++i)
+    {
+        moved[i] = rand() % count;
+        vec3 offset = make_vec3(random_float(-2.f, 2.f), random_float(-2.f, 2.f), random_float(-2.f, 2.f));
+        boxes[moved[i]].min += offset;
+        boxes[moved[i]].max += offset;
+    }
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < moved_count; ++i)
+    {
+        bvh.refit_primitive(moved[i], boxes[moved[i]]);
+    }
+    double refit_some_ns = elapsed_ns(start);
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < count; ++i)
+    {
+        bvh.set_primitive_bounds(i, boxes[i]);
+    }
+    bvh.refit();
+    double refit_all_ns = elapsed_ns(start);
+
+    // Queries
+    std::vector<cull_view_t> views(BENCH_QUERY_COUNT);
+    std::vector<vec3> origins(BENCH_QUERY_COUNT);
+    std::vector<vec3> directions(BENCH_QUERY_COUNT);
+    for(int i = 0; i < BENCH_QUERY_COUNT; ++i)
+    {
+        origins[i] = make_vec3(random_float(-world_size, world_size), random_float(0.f, 20.f), random_float(-world_size, world_size));
+        directions[i] = normalize(make_vec3(random_float(-1.f, 1.f), random_float(-0.2f, 0.2f), random_float(-1.f, 1.f)));
+        mat4 projection = projection_matrix_perspective(45.f * KC_DEG2RAD, 16.f / 9.f, 0.1f, 2000.f);
+        views[i].add_frustum(projection * view_matrix_look_at(origins[i], origins[i] + directions[i], make_vec3(0.f, 1.f, 0.f)));
+    }
+
+    std::vector<i32> results;
+    bool b_results_match = true;
+    size_t frustum_hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < BENCH_QUERY_COUNT; ++i)
+    {
+        results.clear();
+        bvh.query_cull_view(views[i], results);
+        frustum_hits += results.size();
+    }
+    double frustum_ns = elapsed_ns(start);
+
+    size_t linear_hits = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < BENCH_QUERY_COUNT; ++i)
+    {
+        for(int primitive = 0; primitive < count; ++primitive)
+        {
+            linear_hits += views[i].get_visibility_mask(boxes[primitive]) ? 1 : 0;
+        }
+    }
+    double linear_ns = elapsed_ns(start);
+    b_results_match &= frustum_hits == linear_hits;
+
+    size_t sphere_hits = 0;
+    size_t sphere_linear_hits = 0;
+    float sphere_radius = 60.f;
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < BENCH_QUERY_COUNT; ++i)
+    {
+        results.clear();
+        bvh.query_sphere(origins[i], sphere_radius, results);
+        sphere_hits += results.size();
+    }
+    double sphere_ns = elapsed_ns(start);
+    for(int i = 0; i < BENCH_QUERY_COUNT; ++i)
+    {
+        for(int primitive = 0; primitive < count; ++primitive)
+        {
+            sphere_linear_hits += sphere_intersects_aabb(origins[i], sphere_radius, boxes[primitive]) ? 1 : 0;
+        }
+    }
+    b_results_match &= sphere_hits == sphere_linear_hits;
+
+    std::vector<float> ray_distances(BENCH_QUERY_COUNT, -1.f);
+    start = std::chrono::high_resolution_clock::now();
+    for(int i = 0; i < BENCH_QUERY_COUNT; ++i)
+    {
+        float distance;
+        if(bvh.raycast(origins[i], directions[i], 1e30f, &distance) != INDEX_NONE)
+        {
+            ray_distances[i] = distance;
+        }
+    }
+    double ray_ns = elapsed_ns(start);
+    for(int i = 0; i < BENCH_QUERY_COUNT; ++i)
+    {
+        vec3 direction_inverse = make_vec3(1.f / directions[i].x, 1.f / directions[i].y, 1.f / directions[i].z);
+        float closest = -1.f;
+        for(int primitive = 0; primitive < count; ++primitive)
+        {
+            float distance;
+            if(ray_intersects_aabb(origins[i], direction_inverse, 1e30f, boxes[primitive], &distance) && (closest < 0.f || distance < closest))
+            {
+                closest = distance;
+            }
+        }
+        b_results_match &= closest == ray_distances[i];
+    }
+
+    printf("%8d prims | build %8.2f ms | refit 1%% %7.3f ms, all %7.3f ms | frustum %8.1f us (linear %8.1f us, %5.1fx, %6zu visible)"
+           " | sphere %6.2f us | ray %6.2f us | %s\n",
+           count, build_ns / 1e6, refit_some_ns / 1e6, refit_all_ns / 1e6,
+           frustum_ns / BENCH_QUERY_COUNT / 1e3, linear_ns / BENCH_QUERY_COUNT / 1e3, linear_ns / frustum_ns,
+           frustum_hits / BENCH_QUERY_COUNT, sphere_ns / BENCH_QUERY_COUNT / 1e3, ray_ns / BENCH_QUERY_COUNT / 1e3,
+           b_results_match ? "results match brute force" : "RESULTS DIFFER FROM BRUTE FORCE");
+}
+
+int main()
+{
+    srand(1337);
+    run_bench(1000);
+    run_bench(10000);
+    run_bench(100000);
+    run_bench(1000000);
+    return 0;
+}
@@ -0,0 +1,134 @@
+/** kc_math microbenchmark
+
+    Reports ns/op for the kc_math operations that sit on the scene rendering hot path:
+        mat4 * mat4, mat4 * vec4, quaternion * quaternion, rotation_matrix(quaternion)
+
+    Built twice by CMake: kc_math_bench uses whatever SIMD path the compiler targets,
+    kc_math_bench_scalar defines KC_MATH_NO_SIMD. Both print a checksum of every result
+    they computed; the SIMD and scalar paths are bit-identical, so the checksums should match.
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+
+INTERNAL const int BENCH_INPUT_COUNT = 1024;
+INTERNAL const int BENCH_ITERATIONS = 4000;
+
+INTERNAL u32 bench_checksum = 0;
+
+INTERNAL void checksum_floats(const float* values, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        u32 bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+        bench_checksum = (bench_checksum ^ bits) * 16777619u;
+    }
+}
+
+INTERNAL float random_float(float lower, float upper)
+{
+    return lower + (upper - lower) * ((float) rand() / (float) RAND_MAX);
+}
+
+INTERNAL quaternion random_quaternion()
+{
+    vec3 axis = make_vec3(random_float(-1.f, 1.f), random_float(-1.f, 1.f), random_float(-1.f, 1.f) + 0.01f);
+    return make_quaternion_rad(random_float(-KC_PI, KC_PI), axis);
+}
+
+INTERNAL mat4 random_mat4()
+{
+    return translation_matrix(make_vec3(random_float(-100.f, 100.f), random_float(-100.f, 100.f), random_float(-100.f, 100.f)))
+         * rotation_matrix(random_quaternion())
+         * scale_matrix(random_float(0.1f, 10.f), random_float(0.1f, 10.f), random_float(0.1f, 10.f));
+}
+
+INTERNAL void report(const char* name, std::chrono::high_resolution_clock::time_point start)
+{
+    auto end = std::chrono::high_resolution_clock::now();
+    double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    double ops = (double) BENCH_INPUT_COUNT * (double) BENCH_ITERATIONS;
+    printf("%-28s %8.3f ns/op\n", name, ns / ops);
+}
+
+int main()
+{
+    srand(1337);
+
+    std::vector<mat4> matrices_a(BENCH_INPUT_COUNT);
+    std::vector<mat4> matrices_b(BENCH_INPUT_COUNT);
+    std::vector<mat4> matrices_out(BENCH_INPUT_COUNT);
+    std::vector<vec4> vectors(BENCH_INPUT_COUNT);
+    std::vector<vec4> vectors_out(BENCH_INPUT_COUNT);
+    std::vector<quaternion> quaternions_a(BENCH_INPUT_COUNT);
+    std::vector<quaternion> quaternions_b(BENCH_INPUT_COUNT);
+    std::vector<quaternion> quaternions_out(BENCH_INPUT_COUNT);
+    for(int i = 0; i < BENCH_INPUT_COUNT; ++i)
+    {
+        matrices_a[i] = random_mat4();
+        matrices_b[i] = random_mat4();
+        vectors[i] = make_vec4(random_float(-100.f, 100.f), random_float(-100.f, 100.f), random_float(-100.f, 100.f), 1.f);
+        quaternions_a[i] = random_quaternion();
+        quaternions_b[i] = random_quaternion();
+    }
+
+#if KC_MATH_AVX
+    printf("kc_math backend: AVX\n");
+#elif KC_MATH_SSE
+    printf("kc_math backend: SSE\n");
+#else
+    printf("kc_math backend: scalar\n");
+#endif
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for(int iteration = 0; iteration < BENCH_ITERATIONS; ++iteration)
+    {
+        for(int i = 0; i < BENCH_INPUT_COUNT; ++i)
+        {
+            matrices_out[i] = matrices_a[i] * matrices_b[(i + iteration) & (BENCH_INPUT_COUNT - 1)];
+        }
+    }
+    report("mat4 * mat4", start);
+    checksum_floats(matrices_out[0].ptr(), BENCH_INPUT_COUNT * 16);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int iteration = 0; iteration < BENCH_ITERATIONS; ++iteration)
+    {
+        for(int i = 0; i < BENCH_INPUT_COUNT; ++i)
+        {
+            vectors_out[i] = matrices_a[(i + iteration) & (BENCH_INPUT_COUNT - 1)] * vectors[i];
+        }
+    }
+    report("mat4 * vec4", start);
+    checksum_floats(&vectors_out[0].x, BENCH_INPUT_COUNT * 4);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int iteration = 0; iteration < BENCH_ITERATIONS; ++iteration)
+    {
+        for(int i = 0; i < BENCH_INPUT_COUNT; ++i)
+        {
+            quaternions_out[i] = quaternions_a[i] * quaternions_b[(i + iteration) & (BENCH_INPUT_COUNT - 1)];
+        }
+    }
+    report("quaternion * quaternion", start);
+    checksum_floats(&quaternions_out[0].w, BENCH_INPUT_COUNT * 4);
+
+    start = std::chrono::high_resolution_clock::now();
+    for(int iteration = 0; iteration < BENCH_ITERATIONS; ++iteration)
+    {
+        for(int i = 0; i < BENCH_INPUT_COUNT; ++i)
+        {
+            matrices_out[i] = rotation_matrix(quaternions_out[(i + iteration) & (BENCH_INPUT_COUNT - 1)]);
+        }
+    }
+    report("rotation_matrix(quaternion)", start);
+    checksum_floats(matrices_out[0].ptr(), BENCH_INPUT_COUNT * 16);
+
+    printf("checksum: %08x\n", bench_checksum);
+    return 0;
+}
@@ -0,0 +1,216 @@
+/** Scene hierarchy traversal benchmark
+
+    Compares the pointer tree game_object used to be (heap allocated nodes, children in a
+    std::vector<game_object*>, recursive virtual traversal) against the flat scene_graph
+    for 10k, 100k and 1M nodes:
+        pointer tree:       recursive traversal calculating every world matrix
+        flat, all dirty:    scene_graph::update_world_matrices after every node moved
+        flat, 1% dirty:     scene_graph::update_world_matrices after 1% of the nodes moved
+        pointer / flat visit: visiting every node with a render model (what render_scene does per pass)
+    Also re-parents some random nodes in both hierarchies and reports the largest difference
+    between their world matrices, which should be 0.
+*/
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+#include "../game/scene_graph.h"
+
+INTERNAL const int BENCH_REPEATS = 5;
+INTERNAL const int BENCH_MAX_DEPTH = 12;
+
+INTERNAL float random_float(float lower, float upper)
+{
+    return lower + (upper - lower) * ((float) rand() / (float) RAND_MAX);
+}
+
+INTERNAL int random_int(int upper)
+{
+    return (int) (((u32) rand() << 15 ^ (u32) rand()) % (u32) upper);
+}
+
+struct pointer_node
+{
+    vec3 pos;
+    quaternion orient;
+    vec3 scale;
+    mat4 world;
+    mesh_group_t* render_model = nullptr;
+    pointer_node* parent = nullptr;
+    std::vector<pointer_node*> children;
+
+    virtual ~pointer_node() = default;
+
+    virtual void update_world(const mat4& parent_world)
+    {
+        world = parent_world * trs_matrix(pos, orient, scale);
+        for(pointer_node* child : children)
+        {
+            child->update_world(world);
+        }
+    }
+
+    virtual void visit(float& sum)
+    {
+        if(render_model)
+        {
+            sum += world[3][0];
+        }
+        for(pointer_node* child : children)
+        {
+            child->visit(sum);
+        }
+    }
+};
+
+/** Returns the best time in nanoseconds out of BENCH_REPEATS runs of func, calling setup before each run */
+template<typename S, typename F>
+INTERNAL double best_time_ns(S setup, F func)
+{
+    double best = 1e30;
+    for(int repeat = 0; repeat < BENCH_REPEATS; ++repeat)
+    {
+        setup();
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+        double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        best = kc_min(best, ns);
+    }
+    return best;
+}
+
+INTERNAL void pointer_set_parent(pointer_node* node, pointer_node* new_parent)
+{
+    if(node->parent)
+    {
+        std::vector<pointer_node*>& siblings = node->parent->children;
+        siblings.erase(std::remove(siblings.begin(), siblings.end(), node), siblings.end());
+    }
+    node->parent = new_parent;
+    if(new_parent)
+    {
+        new_parent->children.push_back(node);
+    }
+}
+
+INTERNAL void run_bench(int count)
+{
+    // Heap allocate the pointer tree in a random order, like objects created over a game's lifetime
+    std::vector<pointer_node*> pointer_nodes(count);
+    std::vector<int> allocation_order(count);
+    for(int i = 0; i < count; ++i) { allocation_order[i] = i; }
+    for(int i = count - 1; i > 0; --i) { std::swap(allocation_order[i], allocation_order[random_int(i + 1)]); }
+    for(int i = 0; i < count; ++i) { pointer_nodes[allocation_order[i]] = new pointer_node(); }
+
+    scene_graph scene;
+    std::vector<scene_node_id> ids(count);
+    mesh_group_t* dummy_model = (mesh_group_t*) &scene;
+
+    // Random tree built depth-first: every new node is a child of a node on the current path from the root
+    std::vector<int> path;
+    for(int i = 0; i < count; ++i)
+    {
+        vec3 pos = make_vec3(random_float(-10.f, 10.f), random_float(-10.f, 10.f), random_float(-10.f, 10.f));
+        quaternion orient = make_quaternion_rad(random_float(-KC_PI, KC_PI),
+                                                make_vec3(random_float(-1.f, 1.f), random_float(-1.f, 1.f), random_float(0.01f, 1.f)));
+        vec3 scale = make_vec3(random_float(0.9f, 1.1f), random_float(0.9f, 1.1f), random_float(0.9f, 1.1f));
+        bool b_has_model = random_int(4) != 0;
+
+        pointer_node* node = pointer_nodes[i];
+        node->pos = pos;
+        node->orient = orient;
+        node->scale = scale;
+        node->render_model = b_has_model ? dummy_model : nullptr;
+
+        ids[i] = scene.create_node();
+        scene.set_pos(ids[i], pos);
+        scene.set_orient(ids[i], orient);
+        scene.set_scale(ids[i], scale);
+        scene.set_render_model(ids[i], node->render_model);
+
+        if(i > 0)
+        {
+            path.resize(1 + random_int((int) kc_min(path.size(), (size_t) BENCH_MAX_DEPTH)));
+            pointer_set_parent(node, pointer_nodes[path.back()]);
+            scene.set_parent(ids[i], ids[path.back()]);
+        }
+        path.push_back(i);
+    }
+
+    mat4 identity = identity_mat4();
+    double pointer_update_ns = best_time_ns([](){}, [&]() {
+        pointer_nodes[0]->update_world(identity);
+    });
+    double flat_all_ns = best_time_ns([&]() {
+        for(int i = 0; i < count; ++i) { scene.set_pos(ids[i], pointer_nodes[i]->pos); }
+    }, [&]() {
+        scene.update_world_matrices();
+    });
+    int dirty_step = 100;
+    double flat_some_ns = best_time_ns([&]() {
+        for(int i = random_int(dirty_step); i < count; i += dirty_step) { scene.set_pos(ids[i], pointer_nodes[i]->pos); }
+    }, [&]() {
+        scene.update_world_matrices();
+    });
+    int flat_some_updated = scene.get_last_update_count();
+
+    float pointer_sum = 0.f;
+    double pointer_visit_ns = best_time_ns([&]() { pointer_sum = 0.f; }, [&]() {
+        pointer_nodes[0]->visit(pointer_sum);
+    });
+    float flat_sum = 0.f;
+    double flat_visit_ns = best_time_ns([&]() { flat_sum = 0.f; }, [&]() {
+        int end = scene.get_subtree_size(0);
+        for(int i = 0; i < end; ++i)
+        {
+            if(scene.get_render_model_at(i))
+            {
+                flat_sum += scene.get_world_matrix(i)[3][0];
+            }
+        }
+    });
+
+    // Re-parent random nodes in both hierarchies and compare the results
+    for(int move = 0; move < 100; ++move)
+    {
+        int node = 1 + random_int(count - 1);
+        int new_parent = random_int(count);
+        if(scene.set_parent(ids[node], ids[new_parent]))
+        {
+            pointer_set_parent(pointer_nodes[node], pointer_nodes[new_parent]);
+        }
+    }
+    pointer_nodes[0]->update_world(identity);
+    scene.update_world_matrices();
+    float max_difference = 0.f;
+    for(int i = 0; i < count; ++i)
+    {
+        const mat4& flat_world = scene.get_world_matrix(scene.get_index(ids[i]));
+        for(int element = 0; element < 16; ++element)
+        {
+            float difference = pointer_nodes[i]->world.ptr()[element] - flat_world.ptr()[element];
+            max_difference = kc_max(max_difference, kc_abs(difference));
+        }
+    }
+
+    printf("%8d nodes | pointer tree %6.2f ns/node | flat all dirty %6.2f ns/node (%4.2fx) | flat 1%% dirty %6.2f ns/node (%d updated)"
+           " | visit pointer %5.2f ns/node, flat %5.2f ns/node (%4.2fx) | max diff %g%s\n",
+           count, pointer_update_ns / count, flat_all_ns / count, pointer_update_ns / flat_all_ns,
+           flat_some_ns / count, flat_some_updated, pointer_visit_ns / count, flat_visit_ns / count,
+           pointer_visit_ns / flat_visit_ns, max_difference, pointer_sum == flat_sum ? "" : " (visit sums differ)");
+
+    for(pointer_node* node : pointer_nodes) { delete node; }
+}
+
+int main()
+{
+    srand(1337);
+    run_bench(10000);
+    run_bench(100000);
+    run_bench(1000000);
+    return 0;
+}
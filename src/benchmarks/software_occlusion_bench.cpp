@@ -0,0 +1,227 @@
+/** Software occlusion buffer benchmark
+
+    First checks a fixed test scene (a wall in front of the camera) against known answers: boxes behind
+    the wall are hidden, boxes in front of it, beside it, peeking over it or crossing the near plane are
+    visible. The depth buffer must come out identical whatever the thread count.
+
+    Then, for cities of 100 to 10k box buildings on a tessellated ground plane:
+        setup:      add_occluder time (transform, near clip, triangle setup and binning)
+        rasterize:  rasterize time with 1, 2, 4 and 8 threads, and throughput in triangles per millisecond
+        test:       is_visible time per occludee box, and how many of them were hidden
+    Build software_occlusion_bench_scalar to compare against the non-SIMD rasterizer.
+*/
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+#include "../renderer/frustum.h"
+#include "../renderer/software_occlusion.h"
+
+INTERNAL const int BENCH_REPEATS = 5;
+INTERNAL const int BENCH_OCCLUDEE_COUNT = 100000;
+INTERNAL const int BENCH_GROUND_RESOLUTION = 64;
+
+INTERNAL float random_float(float lower, float upper)
+{
+    return lower + (upper - lower) * ((float) rand() / (float) RAND_MAX);
+}
+
+/** Returns the best time in nanoseconds out of BENCH_REPEATS runs of func */
+template<typename F>
+INTERNAL double best_time_ns(F func)
+{
+    double best = 1e30;
+    for(int repeat = 0; repeat < BENCH_REPEATS; ++repeat)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+        double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        best = kc_min(best, ns);
+    }
+    return best;
+}
+
+/** Occluder mesh: unit cube from (0, 0, 0) to (1, 1, 1) */
+INTERNAL const vec3 cube_positions[8] = {
+    { 0.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 1.f, 1.f, 0.f },
+    { 0.f, 0.f, 1.f }, { 1.f, 0.f, 1.f }, { 0.f, 1.f, 1.f }, { 1.f, 1.f, 1.f }
+};
+INTERNAL const u32 cube_indices[36] = {
+    0, 2, 1,  1, 2, 3,  // -z
+    4, 5, 6,  5, 7, 6,  // +z
+    0, 4, 2,  2, 4, 6,  // -x
+    1, 3, 5,  3, 7, 5,  // +x
+    0, 1, 4,  1, 5, 4,  // -y
+    2, 6, 3,  3, 6, 7   // +y
+};
+
+struct box_occluder_t
+{
+    mat4 model_matrix;
+};
+
+INTERNAL mat4 box_matrix(vec3 min, vec3 max)
+{
+    return translation_matrix(min) * scale_matrix(max - min);
+}
+
+INTERNAL aabb_t make_box(vec3 min, vec3 max)
+{
+    aabb_t box;
+    box.min = min;
+    box.max = max;
+    return box;
+}
+
+INTERNAL mat4 make_test_view_projection(float aspect)
+{
+    mat4 projection = projection_matrix_perspective(60.f * KC_DEG2RAD, aspect, 0.1f, 1000.f);
+    return projection * view_matrix_look_at(make_vec3(0.f, 2.f, 0.f), make_vec3(0.f, 2.f, -1.f), make_vec3(0.f, 1.f, 0.f));
+}
+
+/** Returns false if any check of the fixed test scene fails */
+INTERNAL bool run_test_scene()
+{
+    software_occlusion_buffer_t buffer;
+    buffer.begin(make_test_view_projection((float) buffer.get_width() / (float) buffer.get_height()));
+    // 20 wide, 10 high wall, 20 in front of the camera
+    buffer.add_occluder(cube_positions, 8, cube_indices, 36, box_matrix(make_vec3(-10.f, 0.f, -21.f), make_vec3(10.f, 10.f, -20.f)));
+    buffer.rasterize();
+
+    struct visibility_check_t
+    {
+        const char* name;
+        aabb_t box;
+        bool b_expected_visible;
+    };
+    const visibility_check_t checks[] = {
+        { "behind the wall",         make_box(make_vec3(-1.f, 1.f, -31.f), make_vec3(1.f, 3.f, -29.f)),     false },
+        { "far behind the wall",     make_box(make_vec3(-0.1f, 4.f, -300.f), make_vec3(0.1f, 4.2f, -299.f)), false },
+        { "in front of the wall",    make_box(make_vec3(-1.f, 1.f, -16.f), make_vec3(1.f, 3.f, -14.f)),     true },
+        { "beside the wall",         make_box(make_vec3(20.f, 1.f, -31.f), make_vec3(22.f, 3.f, -29.f)),    true },
+        { "above the wall",          make_box(make_vec3(-1.f, 20.f, -41.f), make_vec3(1.f, 22.f, -39.f)),   true },
+        { "peeking over the wall",   make_box(make_vec3(-1.f, 17.f, -41.f), make_vec3(1.f, 19.f, -39.f)),   true },
+        { "crossing the near plane", make_box(make_vec3(-1.f, 1.f, -1.f), make_vec3(1.f, 3.f, 1.f)),        true },
+        { "off screen",              make_box(make_vec3(200.f, 1.f, -31.f), make_vec3(202.f, 3.f, -29.f)),  false },
+    };
+
+    bool b_passed = true;
+    for(const visibility_check_t& check : checks)
+    {
+        bool b_visible = buffer.is_visible(check.box);
+        if(b_visible != check.b_expected_visible)
+        {
+            printf("FAILED: box %s is %s\n", check.name, b_visible ? "visible" : "hidden");
+            b_passed = false;
+        }
+    }
+
+    // Tiles are independent, so the result can't depend on how many threads rasterized them
+    std::vector<float> single_threaded(buffer.get_depth(), buffer.get_depth() + buffer.get_width() * buffer.get_height());
+    buffer.set_min_threaded_triangles(0);
+    for(i32 thread_count = 2; thread_count <= 8; thread_count *= 2)
+    {
+        buffer.set_thread_count(thread_count);
+        buffer.rasterize();
+        if(memcmp(single_threaded.data(), buffer.get_depth(), single_threaded.size() * sizeof(float)) != 0)
+        {
+            printf("FAILED: depth rasterized with %d threads differs from 1 thread\n", thread_count);
+            b_passed = false;
+        }
+    }
+
+    printf("test scene: %s\n", b_passed ? "all checks passed" : "CHECKS FAILED");
+    return b_passed;
+}
+
+INTERNAL void run_bench(int building_count)
+{
+    // Buildings scattered in front of the camera, on a ground plane split into many quads
+    std::vector<box_occluder_t> buildings(building_count);
+    float city_size = 10.f * sqrtf((float) building_count);
+    for(box_occluder_t& building : buildings)
+    {
+        vec3 min = make_vec3(random_float(-city_size, city_size), 0.f, random_float(-2.f * city_size, -5.f));
+        vec3 size = make_vec3(random_float(2.f, 8.f), random_float(3.f, 30.f), random_float(2.f, 8.f));
+        building.model_matrix = box_matrix(min, min + size);
+    }
+
+    std::vector<vec3> ground_positions;
+    std::vector<u32> ground_indices;
+    for(int z = 0; z <= BENCH_GROUND_RESOLUTION; ++z)
+    {
+        for(int x = 0; x <= BENCH_GROUND_RESOLUTION; ++x)
+        {
+            ground_positions.push_back(make_vec3(((float) x / BENCH_GROUND_RESOLUTION - 0.5f) * 2.f * city_size, 0.f,
+                                                 -(float) z / BENCH_GROUND_RESOLUTION * 2.f * city_size));
+        }
+    }
+    for(u32 z = 0; z < BENCH_GROUND_RESOLUTION; ++z)
+    {
+        for(u32 x = 0; x < BENCH_GROUND_RESOLUTION; ++x)
+        {
+            u32 corner = z * (BENCH_GROUND_RESOLUTION + 1) + x;
+            u32 quad[6] = { corner, corner + 1, corner + BENCH_GROUND_RESOLUTION + 1,
+                            corner + 1, corner + BENCH_GROUND_RESOLUTION + 2, corner + BENCH_GROUND_RESOLUTION + 1 };
+            ground_indices.insert(ground_indices.end(), quad, quad + 6);
+        }
+    }
+
+    std::vector<aabb_t> occludees(BENCH_OCCLUDEE_COUNT);
+    for(aabb_t& occludee : occludees)
+    {
+        vec3 min = make_vec3(random_float(-city_size, city_size), random_float(0.f, 10.f), random_float(-2.f * city_size, -1.f));
+        occludee = make_box(min, min + make_vec3(random_float(0.2f, 2.f), random_float(0.2f, 2.f), random_float(0.2f, 2.f)));
+    }
+
+    software_occlusion_buffer_t buffer;
+    mat4 view_projection = make_test_view_projection((float) buffer.get_width() / (float) buffer.get_height());
+    double setup_ns = best_time_ns([&]() {
+        buffer.begin(view_projection);
+        buffer.add_occluder(ground_positions.data(), (u32) ground_positions.size(), ground_indices.data(), (u32) ground_indices.size(),
+                            identity_mat4());
+        for(const box_occluder_t& building : buildings)
+        {
+            buffer.add_occluder(cube_positions, 8, cube_indices, 36, building.model_matrix);
+        }
+    });
+    u32 submitted_triangles = (u32) ground_indices.size() / 3 + 12 * building_count;
+    u32 triangle_count = buffer.get_triangle_count();
+
+    printf("%6d buildings | %6u tris (%6u after clipping) | setup %7.3f ms |", building_count, submitted_triangles, triangle_count, setup_ns / 1e6);
+    for(i32 thread_count = 1; thread_count <= 8; thread_count *= 2)
+    {
+        buffer.set_thread_count(thread_count);
+        double rasterize_ns = best_time_ns([&]() {
+            buffer.rasterize();
+        });
+        printf(" %d thr %6.3f ms %7.0f tris/ms |", thread_count, rasterize_ns / 1e6, triangle_count / (rasterize_ns / 1e6));
+    }
+
+    int hidden_count = 0;
+    double test_ns = best_time_ns([&]() {
+        hidden_count = 0;
+        for(const aabb_t& occludee : occludees)
+        {
+            hidden_count += buffer.is_visible(occludee) ? 0 : 1;
+        }
+    });
+    printf(" test %6.1f ns/box, %5.1f%% hidden\n", test_ns / BENCH_OCCLUDEE_COUNT, 100.f * hidden_count / BENCH_OCCLUDEE_COUNT);
+}
+
+int main()
+{
+    if(!run_test_scene())
+    {
+        return 1;
+    }
+    srand(1337);
+    run_bench(100);
+    run_bench(1000);
+    run_bench(10000);
+    return 0;
+}
@@ -0,0 +1,123 @@
+/** Transform composition benchmark
+
+    Compares the ways of building world matrices from position / orientation / scale:
+        per-object:  translation_matrix(pos) * rotation_matrix(orient) * scale_matrix(scale)
+                     (what game_object::render used to do for every object in every pass)
+        trs_matrix:  direct TRS construction, one object at a time
+        trs_matrices: batched structure-of-arrays kernel
+    for 1k to 1M objects. Also reports the largest difference between the per-object
+    results and the batched results (they only differ by the rounding of the 0 * x terms
+    the matrix multiplications add).
+*/
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+
+INTERNAL const int BENCH_REPEATS = 5;
+
+INTERNAL float random_float(float lower, float upper)
+{
+    return lower + (upper - lower) * ((float) rand() / (float) RAND_MAX);
+}
+
+/** Returns the best time in nanoseconds out of BENCH_REPEATS runs of func */
+template<typename F>
+INTERNAL double best_time_ns(F func)
+{
+    double best = 1e30;
+    for(int repeat = 0; repeat < BENCH_REPEATS; ++repeat)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+        double ns = (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        best = kc_min(best, ns);
+    }
+    return best;
+}
+
+INTERNAL void run_bench(int count)
+{
+    std::vector<vec3> positions(count);
+    std::vector<quaternion> orientations(count);
+    std::vector<vec3> scales(count);
+    std::vector<float> soa(count * 10);
+    for(int i = 0; i < count; ++i)
+    {
+        positions[i] = make_vec3(random_float(-500.f, 500.f), random_float(-500.f, 500.f), random_float(-500.f, 500.f));
+        orientations[i] = make_quaternion_rad(random_float(-KC_PI, KC_PI),
+                                              make_vec3(random_float(-1.f, 1.f), random_float(-1.f, 1.f), random_float(0.01f, 1.f)));
+        scales[i] = make_vec3(random_float(0.01f, 4.f), random_float(0.01f, 4.f), random_float(0.01f, 4.f));
+        soa[count * 0 + i] = positions[i].x;
+        soa[count * 1 + i] = positions[i].y;
+        soa[count * 2 + i] = positions[i].z;
+        soa[count * 3 + i] = orientations[i].w;
+        soa[count * 4 + i] = orientations[i].x;
+        soa[count * 5 + i] = orientations[i].y;
+        soa[count * 6 + i] = orientations[i].z;
+        soa[count * 7 + i] = scales[i].x;
+        soa[count * 8 + i] = scales[i].y;
+        soa[count * 9 + i] = scales[i].z;
+    }
+    transform_streams streams;
+    streams.pos_x = &soa[count * 0];
+    streams.pos_y = &soa[count * 1];
+    streams.pos_z = &soa[count * 2];
+    streams.orient_w = &soa[count * 3];
+    streams.orient_x = &soa[count * 4];
+    streams.orient_y = &soa[count * 5];
+    streams.orient_z = &soa[count * 6];
+    streams.scale_x = &soa[count * 7];
+    streams.scale_y = &soa[count * 8];
+    streams.scale_z = &soa[count * 9];
+
+    std::vector<mat4> per_object_out(count);
+    std::vector<mat4> direct_out(count);
+    std::vector<mat4> batched_out(count);
+
+    double per_object_ns = best_time_ns([&]() {
+        for(int i = 0; i < count; ++i)
+        {
+            mat4 model_matrix = identity_mat4();
+            model_matrix *= translation_matrix(positions[i]);
+            model_matrix *= rotation_matrix(orientations[i]);
+            model_matrix *= scale_matrix(scales[i]);
+            per_object_out[i] = model_matrix;
+        }
+    });
+    double direct_ns = best_time_ns([&]() {
+        for(int i = 0; i < count; ++i)
+        {
+            direct_out[i] = trs_matrix(positions[i], orientations[i], scales[i]);
+        }
+    });
+    double batched_ns = best_time_ns([&]() {
+        trs_matrices(batched_out.data(), streams, count);
+    });
+
+    float max_difference = 0.f;
+    for(int i = 0; i < count; ++i)
+    {
+        for(int element = 0; element < 16; ++element)
+        {
+            float difference = per_object_out[i].ptr()[element] - batched_out[i].ptr()[element];
+            max_difference = kc_max(max_difference, kc_abs(difference));
+        }
+    }
+
+    printf("%8d objects | per-object %7.2f ns/obj | trs_matrix %7.2f ns/obj | trs_matrices %7.2f ns/obj | %5.2fx | max diff %g\n",
+           count, per_object_ns / count, direct_ns / count, batched_ns / count, per_object_ns / batched_ns, max_difference);
+}
+
+int main()
+{
+    srand(1337);
+    run_bench(1000);
+    run_bench(10000);
+    run_bench(100000);
+    run_bench(1000000);
+    return 0;
+}
@@ -33,11 +33,33 @@ STANDARDS:
     Quaternions: Quaternions are used to represent rotations. They are compact, 
     don't suffer from gimbal lock and can easily be interpolated. kc_math uses
     Quaternions to represent all rotations.
+
+SIMD:
+    mat4 * mat4, mat4 * vec4, quaternion * quaternion and rotation_matrix(quaternion)
+    have SSE implementations (and an AVX implementation of mat4 * mat4) which are
+    selected at compile time based on the instruction sets the compiler targets
+    (e.g. x64 always has SSE2, /arch:AVX or -mavx enables AVX).
+        #define KC_MATH_NO_SIMD
+    before including this file to force the scalar implementation.
+    The SIMD paths perform the exact same floating point operations in the exact
+    same order as the scalar paths (no FMA), so results are bit-identical as long as
+    the compiler is not allowed to contract the scalar code into FMAs
+    (i.e. /fp:precise on MSVC, -ffp-contract=off on GCC/Clang when FMA is enabled).
 */
 #ifndef _INCLUDE_KC_MATH_H_
 #define _INCLUDE_KC_MATH_H_
 
 #include <cstdlib>
+#include <cmath>
+
+#if !defined(KC_MATH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define KC_MATH_SSE 1
+#include <emmintrin.h>
+#if defined(__AVX__)
+#define KC_MATH_AVX 1
+#include <immintrin.h>
+#endif
+#endif
 
 #define WORLD_FORWARD_VECTOR make_vec3(1.f,0.f,0.f)
 #define WORLD_BACKWARD_VECTOR (-WORLD_FORWARD_VECTOR)
@@ -199,6 +221,26 @@ struct quaternion
     float z = 0.f; 
 };
 
+/** - Transform streams -
+    Structure-of-arrays view of count translations, orientations and scales
+    (e.g. pos_x[i], pos_y[i], pos_z[i] is the translation of the i-th transform).
+    Used by the batched transform functions so they can process several
+    transforms per SIMD register.
+*/
+struct transform_streams
+{
+    const float* pos_x = nullptr;
+    const float* pos_y = nullptr;
+    const float* pos_z = nullptr;
+    const float* orient_w = nullptr;
+    const float* orient_x = nullptr;
+    const float* orient_y = nullptr;
+    const float* orient_z = nullptr;
+    const float* scale_x = nullptr;
+    const float* scale_y = nullptr;
+    const float* scale_z = nullptr;
+};
+
 /**
 
     Constructors and identity consturctors
@@ -275,10 +317,10 @@ inline vec4 mul(const mat4& A, vec4 v);
 
 inline vec3 operator*(mat3 A, vec3 v);
 inline mat3 operator*(mat3 a, mat3 b);
-inline mat3 &operator*=(mat3& a, mat3& b);
-inline vec4 operator*(mat4 A, vec4 v);
-inline mat4 operator*(mat4 a, mat4 b);
-inline mat4 &operator*=(mat4& a, mat4& b);
+inline mat3 &operator*=(mat3& a, const mat3& b);
+inline vec4 operator*(const mat4& A, vec4 v);
+inline mat4 operator*(const mat4& a, const mat4& b);
+inline mat4 &operator*=(mat4& a, const mat4& b);
 
 /** Generates translation matrix for given delta x delta y delta z
     https://en.wikipedia.org/wiki/Translation_(geometry)#Matrix_resentation */
@@ -294,6 +336,15 @@ inline mat4 rotation_matrix(quaternion q);
 inline mat4 scale_matrix(float x_scale, float y_scale, float z_scale);
 inline mat4 scale_matrix(vec3 scale);
 
+/** Generates translation_matrix(translation) * rotation_matrix(rotation) * scale_matrix(scale)
+    directly, without the intermediate matrix multiplications. */
+inline mat4 trs_matrix(vec3 translation, quaternion rotation, vec3 scale);
+
+/** Writes trs_matrix for each of the count transforms in the given streams into out_matrices.
+    Processes four transforms per iteration when SIMD is enabled. Results are identical to
+    calling trs_matrix on each transform. */
+inline void trs_matrices(mat4* out_matrices, const transform_streams& transforms, int count);
+
 /** Creates a matrix for a symetric perspective-view frustum based on the default handedness and default near and far clip planes definition.
     fovy: Specifies the field of view angle in the y direction. Expressed in radians.
     aspect: Specifies the aspect ratio that determines the field of view in the x direction. The aspect ratio is the ratio of x (width) to y (height).
@@ -324,6 +375,10 @@ inline mat4 projection_matrix_orthographic(float left, float right, float bottom
 */
 inline mat4 view_matrix_look_at(vec3 const& eye, vec3 const& target, vec3 const& in_up);
 
+/** Inverse of a general 4x4 matrix, by cofactors. Returns the zero matrix if m isn't invertible.
+    e.g. inverse(projection * view) takes normalized device coordinates back to world space. */
+inline mat4 inverse(const mat4& m);
+
 /**
 
     Quaternion Operations
@@ -698,10 +753,61 @@ inline mat3 mul(const mat3& a, const mat3& b)
     return res;
 }
 
+#if KC_MATH_SSE
+/** Broadcasts lane i of v to all four lanes */
+#define KC_SPLAT_PS(v, i) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(i, i, i, i))
+/** Returns lanes [v[a], v[b], v[c], v[d]] */
+#define KC_SWIZZLE_PS(v, a, b, c, d) _mm_shuffle_ps((v), (v), _MM_SHUFFLE(d, c, b, a))
+
+/** Linear combination of the columns of a weighted by the components of v.
+    Evaluated as ((a0*v.x + a1*v.y) + a2*v.z) + a3*v.w, which is the same order the
+    scalar dot products are evaluated in. */
+inline __m128 kc_sse_mul_mat4_vec4(__m128 a0, __m128 a1, __m128 a2, __m128 a3, __m128 v)
+{
+    __m128 r = _mm_add_ps(_mm_mul_ps(a0, KC_SPLAT_PS(v, 0)), _mm_mul_ps(a1, KC_SPLAT_PS(v, 1)));
+    r = _mm_add_ps(r, _mm_mul_ps(a2, KC_SPLAT_PS(v, 2)));
+    r = _mm_add_ps(r, _mm_mul_ps(a3, KC_SPLAT_PS(v, 3)));
+    return r;
+}
+#endif
+
 inline mat4 mul(const mat4& a, const mat4& b)
 {
     mat4 res;
-    
+
+#if KC_MATH_AVX
+    // Two columns of the result per 256-bit register: each half holds a copy of a[k]
+    // and the lane k of the corresponding column of b broadcast across it.
+    const float* pa = a.ptr();
+    const float* pb = b.ptr();
+    __m256 a0 = _mm256_broadcast_ps((const __m128*) (pa + 0));
+    __m256 a1 = _mm256_broadcast_ps((const __m128*) (pa + 4));
+    __m256 a2 = _mm256_broadcast_ps((const __m128*) (pa + 8));
+    __m256 a3 = _mm256_broadcast_ps((const __m128*) (pa + 12));
+    __m256 b01 = _mm256_loadu_ps(pb);
+    __m256 b23 = _mm256_loadu_ps(pb + 8);
+
+    __m256 r01 = _mm256_add_ps(_mm256_mul_ps(a0, _mm256_permute_ps(b01, 0x00)), _mm256_mul_ps(a1, _mm256_permute_ps(b01, 0x55)));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(a2, _mm256_permute_ps(b01, 0xAA)));
+    r01 = _mm256_add_ps(r01, _mm256_mul_ps(a3, _mm256_permute_ps(b01, 0xFF)));
+    __m256 r23 = _mm256_add_ps(_mm256_mul_ps(a0, _mm256_permute_ps(b23, 0x00)), _mm256_mul_ps(a1, _mm256_permute_ps(b23, 0x55)));
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(a2, _mm256_permute_ps(b23, 0xAA)));
+    r23 = _mm256_add_ps(r23, _mm256_mul_ps(a3, _mm256_permute_ps(b23, 0xFF)));
+
+    _mm256_storeu_ps(res.ptr(), r01);
+    _mm256_storeu_ps(res.ptr() + 8, r23);
+#elif KC_MATH_SSE
+    const float* pa = a.ptr();
+    const float* pb = b.ptr();
+    __m128 a0 = _mm_loadu_ps(pa + 0);
+    __m128 a1 = _mm_loadu_ps(pa + 4);
+    __m128 a2 = _mm_loadu_ps(pa + 8);
+    __m128 a3 = _mm_loadu_ps(pa + 12);
+    _mm_storeu_ps(res.ptr() + 0, kc_sse_mul_mat4_vec4(a0, a1, a2, a3, _mm_loadu_ps(pb + 0)));
+    _mm_storeu_ps(res.ptr() + 4, kc_sse_mul_mat4_vec4(a0, a1, a2, a3, _mm_loadu_ps(pb + 4)));
+    _mm_storeu_ps(res.ptr() + 8, kc_sse_mul_mat4_vec4(a0, a1, a2, a3, _mm_loadu_ps(pb + 8)));
+    _mm_storeu_ps(res.ptr() + 12, kc_sse_mul_mat4_vec4(a0, a1, a2, a3, _mm_loadu_ps(pb + 12)));
+#else
     res.e[0][0] = dot(make_vec4(a[0][0], a[1][0], a[2][0], a[3][0]), b[0]);
     res.e[0][1] = dot(make_vec4(a[0][1], a[1][1], a[2][1], a[3][1]), b[0]);
     res.e[0][2] = dot(make_vec4(a[0][2], a[1][2], a[2][2], a[3][2]), b[0]);
@@ -721,6 +827,7 @@ inline mat4 mul(const mat4& a, const mat4& b)
     res.e[3][1] = dot(make_vec4(a[0][1], a[1][1], a[2][1], a[3][1]), b[3]);
     res.e[3][2] = dot(make_vec4(a[0][2], a[1][2], a[2][2], a[3][2]), b[3]);
     res.e[3][3] = dot(make_vec4(a[0][3], a[1][3], a[2][3], a[3][3]), b[3]);
+#endif
     
     return res;
 }
@@ -732,16 +839,24 @@ inline vec3 mul(const mat3& A, vec3 v)
 
 inline vec4 mul(const mat4& A, vec4 v) 
 {
+#if KC_MATH_SSE
+    const float* pa = A.ptr();
+    vec4 ret;
+    _mm_storeu_ps(&ret.x, kc_sse_mul_mat4_vec4(_mm_loadu_ps(pa), _mm_loadu_ps(pa + 4), _mm_loadu_ps(pa + 8),
+                                               _mm_loadu_ps(pa + 12), _mm_loadu_ps(&v.x)));
+    return ret;
+#else
     return A[0] * v.x + A[1] * v.y + A[2] * v.z + A[3] * v.w;
+#endif
 }
 
 inline vec3 operator*(mat3 A, vec3 v) { return(mul(A, v)); }
 inline mat3 operator*(mat3 a, mat3 b) { return(mul(a, b)); }
-inline mat3 &operator*=(mat3& a, mat3& b) { a = mul(a, b); return a; }
+inline mat3 &operator*=(mat3& a, const mat3& b) { a = mul(a, b); return a; }
 
-inline vec4 operator*(mat4 A, vec4 v) { return(mul(A, v)); }
-inline mat4 operator*(mat4 a, mat4 b) { return(mul(a, b)); }
-inline mat4 &operator*=(mat4& a, mat4& b) { a = mul(a, b); return a; }
+inline vec4 operator*(const mat4& A, vec4 v) { return(mul(A, v)); }
+inline mat4 operator*(const mat4& a, const mat4& b) { return(mul(a, b)); }
+inline mat4 &operator*=(mat4& a, const mat4& b) { a = mul(a, b); return a; }
 
 inline mat4 translation_matrix(float x, float y, float z)
 {
@@ -759,7 +874,46 @@ inline mat4 translation_matrix(vec3 translation)
 
 inline mat4 rotation_matrix(quaternion q)
 {
+#if KC_MATH_SSE
+    // Same operations as quaternion_to_mat3(inverse_unit(q)), but three lanes of a column at a time.
+    // Lanes of qv are [w, x, y, z] of the inverse.
+    float one_over_s = 1.0f / dot(q, q);
+    __m128 qv = _mm_mul_ps(_mm_setr_ps(q.w, -q.x, -q.y, -q.z), _mm_set1_ps(one_over_s));
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 lane0 = _mm_castsi128_ps(_mm_setr_epi32(-1, 0, 0, 0));
+    const __m128 lane1 = _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, 0));
+    const __m128 lane2 = _mm_castsi128_ps(_mm_setr_epi32(0, 0, -1, 0));
+    const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    const __m128 sign1 = _mm_castsi128_ps(_mm_setr_epi32(0, (int) 0x80000000, 0, 0));
+    const __m128 sign2 = _mm_castsi128_ps(_mm_setr_epi32(0, 0, (int) 0x80000000, 0));
+    const __m128 sign0 = _mm_castsi128_ps(_mm_setr_epi32((int) 0x80000000, 0, 0, 0));
+
+    // column 0: [1 - 2(y2 + z2), 2(xy - zw), 2(xz + yw)]
+    __m128 u = _mm_mul_ps(KC_SWIZZLE_PS(qv, 2, 1, 1, 0), KC_SWIZZLE_PS(qv, 2, 2, 3, 0));
+    __m128 v = _mm_mul_ps(KC_SWIZZLE_PS(qv, 3, 3, 2, 0), KC_SWIZZLE_PS(qv, 3, 0, 0, 0));
+    __m128 t = _mm_mul_ps(two, _mm_add_ps(u, _mm_xor_ps(v, sign1)));
+    __m128 c0 = _mm_and_ps(_mm_or_ps(_mm_and_ps(lane0, _mm_sub_ps(one, t)), _mm_andnot_ps(lane0, t)), xyz);
+    // column 1: [2(xy + zw), 1 - 2(x2 + z2), 2(yz - xw)]
+    u = _mm_mul_ps(KC_SWIZZLE_PS(qv, 1, 1, 2, 0), KC_SWIZZLE_PS(qv, 2, 1, 3, 0));
+    v = _mm_mul_ps(KC_SWIZZLE_PS(qv, 3, 3, 1, 0), KC_SWIZZLE_PS(qv, 0, 3, 0, 0));
+    t = _mm_mul_ps(two, _mm_add_ps(u, _mm_xor_ps(v, sign2)));
+    __m128 c1 = _mm_and_ps(_mm_or_ps(_mm_and_ps(lane1, _mm_sub_ps(one, t)), _mm_andnot_ps(lane1, t)), xyz);
+    // column 2: [2(xz - yw), 2(yz + xw), 1 - 2(x2 + y2)]
+    u = _mm_mul_ps(KC_SWIZZLE_PS(qv, 1, 2, 1, 0), KC_SWIZZLE_PS(qv, 3, 3, 1, 0));
+    v = _mm_mul_ps(KC_SWIZZLE_PS(qv, 2, 1, 2, 0), KC_SWIZZLE_PS(qv, 0, 0, 2, 0));
+    t = _mm_mul_ps(two, _mm_add_ps(u, _mm_xor_ps(v, sign0)));
+    __m128 c2 = _mm_and_ps(_mm_or_ps(_mm_and_ps(lane2, _mm_sub_ps(one, t)), _mm_andnot_ps(lane2, t)), xyz);
+
+    mat4 ret;
+    _mm_storeu_ps(ret.ptr() + 0, c0);
+    _mm_storeu_ps(ret.ptr() + 4, c1);
+    _mm_storeu_ps(ret.ptr() + 8, c2);
+    _mm_storeu_ps(ret.ptr() + 12, _mm_setr_ps(0.f, 0.f, 0.f, 1.f));
+    return ret;
+#else
     return make_mat4(q);
+#endif
 }
 
 inline mat4 scale_matrix(float x_scale, float y_scale, float z_scale)
@@ -777,6 +931,98 @@ inline mat4 scale_matrix(vec3 scale)
     return scale_matrix(scale.x, scale.y, scale.z);
 }
 
+inline mat4 trs_matrix(vec3 translation, quaternion rotation, vec3 scale)
+{
+    mat4 ret = rotation_matrix(rotation);
+    ret[0].x *= scale.x;
+    ret[0].y *= scale.x;
+    ret[0].z *= scale.x;
+    ret[1].x *= scale.y;
+    ret[1].y *= scale.y;
+    ret[1].z *= scale.y;
+    ret[2].x *= scale.z;
+    ret[2].y *= scale.z;
+    ret[2].z *= scale.z;
+    ret[3] = make_vec4(translation.x, translation.y, translation.z, 1.f);
+    return ret;
+}
+
+inline void trs_matrices(mat4* out_matrices, const transform_streams& transforms, int count)
+{
+    int i = 0;
+#if KC_MATH_SSE
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    for(; i + 4 <= count; i += 4)
+    {
+        // Lane n of every register belongs to transform i + n. Same operations as rotation_matrix.
+        __m128 qw = _mm_loadu_ps(transforms.orient_w + i);
+        __m128 qx = _mm_loadu_ps(transforms.orient_x + i);
+        __m128 qy = _mm_loadu_ps(transforms.orient_y + i);
+        __m128 qz = _mm_loadu_ps(transforms.orient_z + i);
+        __m128 dot_q = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_mul_ps(qz, qz)), _mm_mul_ps(qw, qw));
+        __m128 one_over_s = _mm_div_ps(one, dot_q);
+        __m128 w = _mm_mul_ps(qw, one_over_s);
+        __m128 x = _mm_mul_ps(_mm_xor_ps(qx, sign), one_over_s);
+        __m128 y = _mm_mul_ps(_mm_xor_ps(qy, sign), one_over_s);
+        __m128 z = _mm_mul_ps(_mm_xor_ps(qz, sign), one_over_s);
+
+        __m128 x2 = _mm_mul_ps(x, x);
+        __m128 y2 = _mm_mul_ps(y, y);
+        __m128 z2 = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y);
+        __m128 zw = _mm_mul_ps(z, w);
+        __m128 xz = _mm_mul_ps(x, z);
+        __m128 yw = _mm_mul_ps(y, w);
+        __m128 yz = _mm_mul_ps(y, z);
+        __m128 xw = _mm_mul_ps(x, w);
+
+        __m128 sx = _mm_loadu_ps(transforms.scale_x + i);
+        __m128 sy = _mm_loadu_ps(transforms.scale_y + i);
+        __m128 sz = _mm_loadu_ps(transforms.scale_z + i);
+        __m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(y2, z2))), sx);
+        __m128 c0y = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, zw)), sx);
+        __m128 c0z = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, yw)), sx);
+        __m128 c1x = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, zw)), sy);
+        __m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(x2, z2))), sy);
+        __m128 c1z = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, xw)), sy);
+        __m128 c2x = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, yw)), sz);
+        __m128 c2y = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, xw)), sz);
+        __m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(x2, y2))), sz);
+        __m128 c0w = _mm_setzero_ps();
+        __m128 c1w = _mm_setzero_ps();
+        __m128 c2w = _mm_setzero_ps();
+        __m128 c3x = _mm_loadu_ps(transforms.pos_x + i);
+        __m128 c3y = _mm_loadu_ps(transforms.pos_y + i);
+        __m128 c3z = _mm_loadu_ps(transforms.pos_z + i);
+        __m128 c3w = one;
+
+        // Transpose from one register per matrix element to one register per matrix column
+        _MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+        _MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+        _MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+        _MM_TRANSPOSE4_PS(c3x, c3y, c3z, c3w);
+        float* out = out_matrices[i].ptr();
+        _mm_storeu_ps(out + 0, c0x);  _mm_storeu_ps(out + 4, c1x);  _mm_storeu_ps(out + 8, c2x);  _mm_storeu_ps(out + 12, c3x);
+        _mm_storeu_ps(out + 16, c0y); _mm_storeu_ps(out + 20, c1y); _mm_storeu_ps(out + 24, c2y); _mm_storeu_ps(out + 28, c3y);
+        _mm_storeu_ps(out + 32, c0z); _mm_storeu_ps(out + 36, c1z); _mm_storeu_ps(out + 40, c2z); _mm_storeu_ps(out + 44, c3z);
+        _mm_storeu_ps(out + 48, c0w); _mm_storeu_ps(out + 52, c1w); _mm_storeu_ps(out + 56, c2w); _mm_storeu_ps(out + 60, c3w);
+    }
+#endif
+    for(; i < count; ++i)
+    {
+        vec3 translation = make_vec3(transforms.pos_x[i], transforms.pos_y[i], transforms.pos_z[i]);
+        quaternion rotation;
+        rotation.w = transforms.orient_w[i];
+        rotation.x = transforms.orient_x[i];
+        rotation.y = transforms.orient_y[i];
+        rotation.z = transforms.orient_z[i];
+        vec3 scale = make_vec3(transforms.scale_x[i], transforms.scale_y[i], transforms.scale_z[i]);
+        out_matrices[i] = trs_matrix(translation, rotation, scale);
+    }
+}
+
 inline mat4 projection_matrix_perspective(float fovy, float aspect, float nearclip, float farclip)
 {
     float const tanHalfFovy = tan(fovy / 2.f);
@@ -840,6 +1086,42 @@ inline mat4 view_matrix_look_at(vec3 const& eye, vec3 const& target, vec3 const&
     return ret;
 }
 
+inline mat4 inverse(const mat4& m)
+{
+    // Works on the 16 floats without caring about their order, since the inverse of the transpose is the transpose of the inverse
+    const float* a = m.ptr();
+    mat4 ret;
+    float* r = ret.ptr();
+    r[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+    r[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+    r[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+    r[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+    r[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+    r[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+    r[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+    r[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+    r[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+    r[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+    r[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+    r[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+    r[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+    r[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+    r[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+    r[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+    float determinant = a[0] * r[0] + a[1] * r[4] + a[2] * r[8] + a[3] * r[12];
+    if(determinant == 0.f)
+    {
+        return mat4();
+    }
+    float inverse_determinant = 1.f / determinant;
+    for(int i = 0; i < 16; ++i)
+    {
+        r[i] *= inverse_determinant;
+    }
+    return ret;
+}
+
 // TODO transpose
 
 /**
@@ -872,6 +1154,23 @@ inline float dot(quaternion a, quaternion b)
 
 inline quaternion mul(quaternion a, quaternion b)
 {
+#if KC_MATH_SSE
+    // Lanes are [w, x, y, z]. x y z lanes: b.w * va + a.w * vb + cross(va, vb)
+    __m128 qa = _mm_loadu_ps(&a.w);
+    __m128 qb = _mm_loadu_ps(&b.w);
+    __m128 first = _mm_mul_ps(KC_SPLAT_PS(qb, 0), qa);
+    __m128 second = _mm_mul_ps(KC_SPLAT_PS(qa, 0), qb);
+    __m128 third = _mm_sub_ps(_mm_mul_ps(KC_SWIZZLE_PS(qa, 0, 2, 3, 1), KC_SWIZZLE_PS(qb, 0, 3, 1, 2)),
+                              _mm_mul_ps(KC_SWIZZLE_PS(qb, 0, 2, 3, 1), KC_SWIZZLE_PS(qa, 0, 3, 1, 2)));
+    __m128 r = _mm_add_ps(_mm_add_ps(first, second), third);
+    // w lane: a.w * b.w - ((ax*bx + ay*by) + az*bz)
+    __m128 p = _mm_mul_ps(qa, qb);
+    __m128 d = _mm_add_ss(_mm_add_ss(KC_SPLAT_PS(p, 1), KC_SPLAT_PS(p, 2)), KC_SPLAT_PS(p, 3));
+    r = _mm_move_ss(r, _mm_sub_ss(p, d));
+    quaternion R;
+    _mm_storeu_ps(&R.w, r);
+    return R;
+#else
     quaternion R;
     R.w = a.w * b.w - dot(make_vec3(a.x,a.y,a.z), make_vec3(b.x,b.y,b.z));
     vec3 va = make_vec3(a.x, a.y, a.z);
@@ -883,6 +1182,7 @@ inline quaternion mul(quaternion a, quaternion b)
     R.y = first.y + second.y + third.y;
     R.z = first.z + second.z + third.z;
     return R;
+#endif
 }
 
 inline quaternion mul(quaternion a, float scale)
@@ -10,6 +10,8 @@
 #include "../renderer/texture.h"
 #include "../renderer/mesh.h"
 #include "../renderer/shader.h"
+#include "../renderer/stream_buffer.h"
+#include "../renderer/gl_state.h"
 #include "../renderer/deferred_renderer.h"
 #include "../core/timer.h"
 #include "../game/game_state.h"
@@ -89,9 +91,24 @@ INTERNAL bool        console_b_messages_dirty = false;
 // Text visuals
 INTERNAL vtxt_font*   console_font_handle;
 INTERNAL texture_t     console_font_atlas;
-// Input text & Messages VAOs
-INTERNAL mesh_t        console_inputtext_vao; // console_inputtext_vao gets added to console_messages_vaos if user "returns" command
-INTERNAL mesh_t        console_messages_vaos[CONSOLE_ROWS_MAX] = {}; // one vao is one line
+/** Text vertices built by vertext, kept until the text changes and streamed every frame it's drawn */
+struct console_text_t
+{
+    std::vector<float>  vertices;
+    std::vector<u32>    indices;
+
+    void set(const vtxt_vertex_buffer& vb)
+    {
+        vertices.assign(vb.vertex_buffer, vb.vertex_buffer + vb.vertices_array_count);
+        indices.assign(vb.index_buffer, vb.index_buffer + vb.indices_array_count);
+    }
+};
+// Input text & Messages text, drawn one at a time through the streamed text mesh
+INTERNAL console_text_t console_inputtext; // console_inputtext gets added to console_messages_text if user "returns" command
+INTERNAL console_text_t console_messages_text[CONSOLE_ROWS_MAX]; // one per line
+INTERNAL mesh_t        console_text_vao;
+INTERNAL stream_buffer_t console_text_stream;
+INTERNAL const u32     CONSOLE_TEXT_STREAM_SIZE = 256 * 1024;
 
 // TODO buffer to hold previous commands (max 20 commands)
 
@@ -104,17 +121,9 @@ void console_initialize(vtxt_font* in_console_font_handle, texture_t in_console_
     vtxt_clear_buffer();
     vtxt_move_cursor(CONSOLE_INPUT_DRAW_X, CONSOLE_INPUT_DRAW_Y);
     vtxt_append_glyph('>', console_font_handle, CONSOLE_TEXT_SIZE);
-    vtxt_vertex_buffer vb = vtxt_grab_buffer();
-    mesh_t::gl_create_mesh(console_inputtext_vao, vb.vertex_buffer, vb.index_buffer,
-                           vb.vertices_array_count, vb.indices_array_count,
-                           2, 2, 0, GL_DYNAMIC_DRAW);
-    // INIT MESSAGES mesh_t OBJECTS
-    for(int i = 0; i < CONSOLE_ROWS_MAX; ++i)
-    {
-        mesh_t::gl_create_mesh(console_messages_vaos[i], nullptr, nullptr,
-                               0, 0,
-                               2, 2, 0, GL_DYNAMIC_DRAW);
-    }
+    console_inputtext.set(vtxt_grab_buffer());
+    mesh_t::gl_create_streamed_mesh(console_text_vao, 2, 2, 0);
+    console_text_stream.gl_create(CONSOLE_TEXT_STREAM_SIZE);
 
     // todo update console vertex buffer on window size change
     // INIT CONSOLE GUI
@@ -127,7 +136,7 @@ void console_initialize(vtxt_font* in_console_font_handle, texture_t in_console_
     console_background_vertex_buffer[9] = CONSOLE_HEIGHT;
     console_background_vertex_buffer[21] = CONSOLE_HEIGHT;
     glGenVertexArrays(1, &console_background_vao_id);
-    glBindVertexArray(console_background_vao_id);
+    gl_state_bind_vertex_array(console_background_vao_id);
         glGenBuffers(1, &console_background_vbo_id);
         glBindBuffer(GL_ARRAY_BUFFER, console_background_vbo_id);
             glBufferData(GL_ARRAY_BUFFER, sizeof(console_background_vertex_buffer), console_background_vertex_buffer, GL_STATIC_DRAW);
@@ -140,14 +149,14 @@ void console_initialize(vtxt_font* in_console_font_handle, texture_t in_console_
     console_line_vertex_buffer[2] = (float) buffer_dimensions.x;
     console_line_vertex_buffer[3] = CONSOLE_HEIGHT - (float) CONSOLE_TEXT_SIZE - CONSOLE_TEXT_PADDING_BOTTOM;
     glGenVertexArrays(1, &console_line_vao_id);
-    glBindVertexArray(console_line_vao_id);
+    gl_state_bind_vertex_array(console_line_vao_id);
         glGenBuffers(1, &console_line_vbo_id);
         glBindBuffer(GL_ARRAY_BUFFER, console_line_vbo_id);
             glBufferData(GL_ARRAY_BUFFER, sizeof(console_line_vertex_buffer), console_line_vertex_buffer, GL_STATIC_DRAW);
             glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
             glEnableVertexAttribArray(0);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    gl_state_bind_vertex_array(0);
 
     console_b_initialized = true;
     console_print("Console initialized.\n");
@@ -280,9 +289,7 @@ void console_update_messages()
                         vtxt_new_line(CONSOLE_INPUT_DRAW_X, console_font_handle);
                     }
                 }
-                vtxt_vertex_buffer vb = vtxt_grab_buffer();
-                console_messages_vaos[row].gl_rebind_buffer_objects(vb.vertex_buffer, vb.index_buffer,
-                                                                    vb.vertices_array_count, vb.indices_array_count);
+                console_messages_text[row].set(vtxt_grab_buffer());
             }
         }
 
@@ -308,9 +315,7 @@ void console_update()
                 vtxt_move_cursor(CONSOLE_INPUT_DRAW_X, CONSOLE_INPUT_DRAW_Y);
                 std::string input_text = ">" + std::string(console_input_buffer);
                 vtxt_append_line(input_text.c_str(), console_font_handle, CONSOLE_TEXT_SIZE);
-                vtxt_vertex_buffer vb = vtxt_grab_buffer();
-                console_inputtext_vao.gl_rebind_buffer_objects(vb.vertex_buffer, vb.index_buffer,
-                                                               vb.vertices_array_count, vb.indices_array_count);
+                console_inputtext.set(vtxt_grab_buffer());
                 console_b_input_buffer_dirty = false;
             }
 
@@ -339,6 +344,17 @@ void console_update()
     }
 }
 
+INTERNAL void console_render_text(const console_text_t& text)
+{
+    if(text.indices.empty())
+    {
+        return;
+    }
+    console_text_vao.gl_stream_buffer_objects(console_text_stream, text.vertices.data(), text.indices.data(),
+                                              (u32) text.vertices.size(), (u32) text.indices.size());
+    console_text_vao.gl_render_mesh();
+}
+
 void console_render(shader_t* ui_shader, shader_t* text_shader)
 {
     if(!console_b_initialized || console_state == CONSOLE_HIDDEN)
@@ -346,8 +362,6 @@ void console_render(shader_t* ui_shader, shader_t* text_shader)
         return;
     }
 
-    mat4& matrix_projection_ortho = game_statics::the_renderer->matrix_projection_ortho;
-
     float console_translation_y = console_y - (float) CONSOLE_HEIGHT;
     mat4 con_transform = identity_mat4();
     con_transform *= translation_matrix(0.f, console_translation_y, 0.f);
@@ -356,28 +370,22 @@ void console_render(shader_t* ui_shader, shader_t* text_shader)
     shader_t::gl_use_shader(*ui_shader);
         ui_shader->gl_bind_1i("b_use_colour", true);
         ui_shader->gl_bind_matrix4fv("matrix_model", 1, con_transform.ptr());
-        ui_shader->gl_bind_matrix4fv("matrix_proj_orthographic", 1, matrix_projection_ortho.ptr());
-        glBindVertexArray(console_background_vao_id);
+        gl_state_bind_vertex_array(console_background_vao_id);
             ui_shader->gl_bind_4f("ui_element_colour", 0.1f, 0.1f, 0.1f, 0.7f);
             glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(console_line_vao_id);
+        gl_state_bind_vertex_array(console_line_vao_id);
             ui_shader->gl_bind_4f("ui_element_colour", 0.8f, 0.8f, 0.8f, 1.f);
             glDrawArrays(GL_LINES, 0, 2);
-        glBindVertexArray(0);
 
     shader_t::gl_use_shader(*text_shader);
         // RENDER CONSOLE TEXT
-        text_shader->gl_bind_matrix4fv("matrix_proj_orthographic", 1, matrix_projection_ortho.ptr());
         console_font_atlas.gl_use_texture();
         text_shader->gl_bind_1i("font_atlas_sampler", 1);
 
         // Input text visual
         text_shader->gl_bind_3f("text_colour", 1.f, 1.f, 1.f);
         text_shader->gl_bind_matrix4fv("matrix_model", 1, con_transform.ptr());
-        if(console_inputtext_vao.indices_count > 0)
-        {
-            console_inputtext_vao.gl_render_mesh();
-        }
+        console_render_text(console_inputtext);
         // move transform matrix up a lil
         con_transform[3][1] -= 30.f;
 
@@ -385,15 +393,13 @@ void console_render(shader_t* ui_shader, shader_t* text_shader)
         text_shader->gl_bind_3f("text_colour", 0.8f, 0.8f, 0.8f);
         for(int i = 0; i < CONSOLE_ROWS_MAX; ++i)
         {
-            mesh_t m = console_messages_vaos[i];
-            if(m.indices_count > 0)
+            if(!console_messages_text[i].indices.empty())
             {
                 text_shader->gl_bind_matrix4fv("matrix_model", 1, con_transform.ptr());
                 con_transform[3][1] -= (float) CONSOLE_TEXT_SIZE + 3.f;
-                m.gl_render_mesh();
+                console_render_text(console_messages_text[i]);
             }
         }
-    glUseProgram(0);
 }
 
 void console_scroll_up()
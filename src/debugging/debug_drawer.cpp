@@ -3,6 +3,7 @@
 #include "console.h"
 #include "../renderer/mesh.h"
 #include "../renderer/light.h"
+#include "../renderer/light_manager.h"
 #include "../renderer/shader.h"
 #include "../renderer/camera.h"
 
@@ -13,8 +14,7 @@ int debug_drawer_get_level()
 }
 
 INTERNAL bool debugger_b_debug_pointlights = true;
-INTERNAL point_light_t* debugger_point_lights = nullptr;
-INTERNAL u32 debugger_point_lights_count = 0;
+INTERNAL const light_manager_t* debugger_point_lights = nullptr;
 
 INTERNAL mesh_t debug_sphere_mesh;
 INTERNAL mesh_t debug_cone_mesh;
@@ -127,7 +127,7 @@ void debug_render_line()
     // TODO
 }
 
-void debug_render_pointlight(shader_t& shader, point_light_t& plight)
+void debug_render_pointlight(shader_t& shader, const point_light_t& plight)
 {
     float att_radius = plight.get_radius() / 2.5f;
     shader.gl_bind_4f("frag_colour", 1.f, 1.f, 1.f, 1.f);
@@ -136,7 +136,7 @@ void debug_render_pointlight(shader_t& shader, point_light_t& plight)
     debug_render_sphere(shader, plight.position.x, plight.position.y, plight.position.z, 0.05f);
 }
 
-void debug_render_spotlight(shader_t& shader, point_light_t& slight)
+void debug_render_spotlight(shader_t& shader, const point_light_t& slight)
 {
     float att_radius = slight.get_radius();
     shader.gl_bind_4f("frag_colour", 1.f, 1.f, 1.f, 1.f);
@@ -157,7 +157,7 @@ void debug_initialize()
     get_console().bind_cmd("toggle_debug_pointlights", debug_toggle_debug_pointlights);
 }
 
-void debug_render(shader_t& debug_shader, camera_t camera)
+void debug_render(shader_t& debug_shader)
 {
     if(!debugger_level)
     {
@@ -165,34 +165,28 @@ void debug_render(shader_t& debug_shader, camera_t camera)
     }
 
     shader_t::gl_use_shader(debug_shader);
-        debug_shader.gl_bind_matrix4fv("matrix_view", 1, camera.matrix_view.ptr());
-        debug_shader.gl_bind_matrix4fv("matrix_proj_perspective", 1, camera.matrix_perspective.ptr());
-
         if(1 <= debugger_level)
         {
-            if(debugger_b_debug_pointlights)
+            if(debugger_b_debug_pointlights && debugger_point_lights)
             {
-                for(size_t i = 0; i < debugger_point_lights_count; ++i)
+                for(const point_light_t& point_light : *debugger_point_lights)
                 {
-                    if(debugger_point_lights[i].is_b_spotlight())
+                    if(point_light.is_b_spotlight())
                     {
-                        debug_render_spotlight(debug_shader, debugger_point_lights[i]);
+                        debug_render_spotlight(debug_shader, point_light);
                     }
                     else
                     {
-                        debug_render_pointlight(debug_shader, debugger_point_lights[i]);
+                        debug_render_pointlight(debug_shader, point_light);
                     }
                 }
             }
         }
-
-    glUseProgram(0);
 }
 
-void debug_set_pointlights(point_light_t* point_lights_array, u32 count)
+void debug_set_pointlights(const light_manager_t* point_lights)
 {
-    debugger_point_lights = point_lights_array;
-    debugger_point_lights_count = count;
+    debugger_point_lights = point_lights;
 }
 
 void debug_toggle_debug_pointlights()
@@ -7,6 +7,7 @@ struct mesh_t;
 struct camera_t;
 struct shader_t;
 struct point_light_t;
+struct light_manager_t;
 
 
 int debug_drawer_get_level();
@@ -23,9 +24,9 @@ void debug_render_cone(shader_t& shader,
                        float height, float base_radius,
                        quaternion orientation);
 void debug_render_line();
-void debug_render_pointlight(shader_t& shader, point_light_t& plight);
+void debug_render_pointlight(shader_t& shader, const point_light_t& plight);
 void debug_initialize();
-void debug_render(shader_t& debug_shader, camera_t camera);
-void debug_set_pointlights(point_light_t* point_lights_array, u32 count);
+void debug_render(shader_t& debug_shader);
+void debug_set_pointlights(const light_manager_t* point_lights);
 void debug_toggle_debug_pointlights();
 void debug_set_debug_level(int level);
\ No newline at end of file
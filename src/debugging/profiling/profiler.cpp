@@ -1,3 +1,6 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
 #include <string>
 #include "profiler.h"
 #include "../../game_defines.h"
@@ -6,6 +9,7 @@
 #include "../../renderer/texture.h"
 #include "../../renderer/mesh.h"
 #include "../../renderer/shader.h"
+#include "../../renderer/stream_buffer.h"
 #include "../../core/timer.h"
 #include "../../core/kc_math.h"
 #include "../../renderer/deferred_renderer.h"
@@ -22,6 +26,34 @@ INTERNAL texture_t     perf_font_atlas;
 
 // Meshes
 INTERNAL mesh_t        perf_frametime_vao;
+INTERNAL stream_buffer_t perf_text_stream;
+INTERNAL const u32     PERF_TEXT_STREAM_SIZE = 64 * 1024;
+
+INTERNAL profiler_frame_stats_t perf_frame_stats;
+INTERNAL profiler_frame_stats_t perf_last_frame_stats; // the overlay is drawn mid-frame, timings come from the last one
+
+// Every thread allocates through the same counter, e.g. the software occlusion rasterizer's workers
+INTERNAL std::atomic<u64> perf_allocation_count(0);
+INTERNAL u64 perf_allocation_count_at_frame_begin = 0;
+
+#if INTERNAL_BUILD
+/** Replaces the global operator new to count allocations. The array and sized forms call these ones. */
+void* operator new(size_t size)
+{
+    perf_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    void* memory = malloc(size > 0 ? size : 1);
+    if(!memory)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+    free(memory);
+}
+#endif
 
 void profiler_set_level(int level)
 {
@@ -33,13 +65,42 @@ int profiler_get_level()
     return perf_profiler_level;
 }
 
+void profiler_begin_frame()
+{
+    perf_frame_stats.frame_allocations = profiler_allocations_this_frame();
+    perf_last_frame_stats = perf_frame_stats;
+    perf_frame_stats = profiler_frame_stats_t();
+    perf_allocation_count_at_frame_begin = perf_allocation_count.load(std::memory_order_relaxed);
+}
+
+u32 profiler_allocations_this_frame()
+{
+    return (u32) (perf_allocation_count.load(std::memory_order_relaxed) - perf_allocation_count_at_frame_begin);
+}
+
+profiler_frame_stats_t& profiler_get_frame_stats()
+{
+    return perf_frame_stats;
+}
+
+float profiler_ms_since(i64 start_ticks)
+{
+    return 1000.f * (float) (timer::get_ticks() - start_ticks) / (float) timer::counter_frequency();
+}
+
+/** Milliseconds with two decimals */
+INTERNAL std::string perf_ms_string(float ms)
+{
+    std::string ms_string = std::to_string(ms);
+    return ms_string.substr(0, ms_string.find(".")+3);
+}
+
 void profiler_initialize(vtxt_font* in_perf_font_handle, texture_t in_perf_font_atlas)
 {
     perf_font_handle = in_perf_font_handle;
     perf_font_atlas = in_perf_font_atlas;
-    mesh_t::gl_create_mesh(perf_frametime_vao, nullptr, nullptr,
-                           0, 0, 2,
-                           2, 0, GL_DYNAMIC_DRAW);
+    mesh_t::gl_create_streamed_mesh(perf_frametime_vao, 2, 2, 0);
+    perf_text_stream.gl_create(PERF_TEXT_STREAM_SIZE);
 
     get_console().bind_cmd("profiler", profiler_set_level);
 }
@@ -53,24 +114,94 @@ void profiler_render(shader_t* ui_shader, shader_t* text_shader)
 
     if(1 <= perf_profiler_level)
     {
-        std::string frametime_temp = std::to_string(1000.f*timer::delta_time);
         std::string perf_frametime_string = "LAST FRAME TIME: " 
-            + frametime_temp.substr(0, frametime_temp.find(".")+3)
+            + perf_ms_string(1000.f*timer::delta_time)
             + "ms   FPS: "
             + std::to_string((i16)(1.f / timer::delta_time))
             + "hz";
         vtxt_clear_buffer();
         vtxt_move_cursor(PERF_DRAW_X, PERF_DRAW_Y);
         vtxt_append_line(perf_frametime_string.c_str(), perf_font_handle, PERF_TEXT_SIZE);
+        if(2 <= perf_profiler_level)
+        {
+            std::string perf_draws_string = "DRAWS SUBMITTED: "
+                + std::to_string(perf_frame_stats.draws_submitted)
+                + " IN "
+                + std::to_string(perf_frame_stats.draw_calls)
+                + " CALLS   INSTANCES: "
+                + std::to_string(perf_frame_stats.instances_submitted)
+                + "   CULLED: "
+                + std::to_string(perf_frame_stats.draws_culled)
+                + "   GPU CULL TESTED: "
+                + std::to_string(perf_frame_stats.instances_gpu_tested)
+                + "   OCCLUDED: "
+                + std::to_string(perf_frame_stats.draws_occluded)
+                + "   OCCLUDER TRIS: "
+                + std::to_string(perf_frame_stats.occluder_triangles)
+                + "   LIGHT TILES SPILLED: "
+                + std::to_string(perf_frame_stats.light_tiles_spilled)
+                + "   CLUSTERS SPILLED: "
+                + std::to_string(perf_frame_stats.light_clusters_spilled)
+                + "   LIGHT UPLOAD: "
+                + std::to_string(perf_frame_stats.light_bytes_uploaded)
+                + " B IN "
+                + std::to_string(perf_frame_stats.light_upload_calls)
+                + " CALLS";
+            vtxt_new_line(PERF_DRAW_X, perf_font_handle);
+            vtxt_append_line(perf_draws_string.c_str(), perf_font_handle, PERF_TEXT_SIZE);
+            std::string perf_state_string = "STATE CHANGES PROGRAM: "
+                + std::to_string(perf_frame_stats.program_binds)
+                + "   TEXTURE: "
+                + std::to_string(perf_frame_stats.texture_binds)
+                + "   VAO: "
+                + std::to_string(perf_frame_stats.vao_binds)
+                + "   UNIFORM: "
+                + std::to_string(perf_frame_stats.uniform_updates)
+                + "   SKIPPED: "
+                + std::to_string(perf_frame_stats.redundant_binds_skipped)
+                + "   UNIFORM CALLS: "
+                + std::to_string(perf_last_frame_stats.uniform_calls)
+                + "   UBO UPDATES: "
+                + std::to_string(perf_last_frame_stats.uniform_buffer_updates)
+                + "   GL STATE CALLS: "
+                + std::to_string(perf_last_frame_stats.gl_state_calls_issued)
+                + " SKIPPED: "
+                + std::to_string(perf_last_frame_stats.gl_state_calls_skipped);
+            vtxt_new_line(PERF_DRAW_X, perf_font_handle);
+            vtxt_append_line(perf_state_string.c_str(), perf_font_handle, PERF_TEXT_SIZE);
+            std::string perf_breakdown_string = "CPU MS SHADOW MAPS: "
+                + perf_ms_string(perf_last_frame_stats.shadow_maps_ms)
+                + " (DRAWN: "
+                + std::to_string(perf_last_frame_stats.shadow_maps_drawn)
+                + " REUSED: "
+                + std::to_string(perf_last_frame_stats.shadow_maps_reused)
+                + ")"
+                + "   GEOMETRY: "
+                + perf_ms_string(perf_last_frame_stats.geometry_pass_ms)
+                + "   LIGHT UPLOAD: "
+                + perf_ms_string(perf_last_frame_stats.light_upload_ms)
+                + "   LIGHTING: "
+                + perf_ms_string(perf_last_frame_stats.lighting_pass_ms)
+                + "   UI: "
+                + perf_ms_string(perf_last_frame_stats.ui_ms)
+                + "   STREAM WAIT: "
+                + perf_ms_string(perf_last_frame_stats.stream_fence_wait_ms)
+                + "   STREAMED: "
+                + std::to_string(perf_last_frame_stats.stream_bytes_written)
+                + " B   ALLOCATIONS RENDER: "
+                + std::to_string(perf_last_frame_stats.render_allocations)
+                + "   FRAME: "
+                + std::to_string(perf_last_frame_stats.frame_allocations);
+            vtxt_new_line(PERF_DRAW_X, perf_font_handle);
+            vtxt_append_line(perf_breakdown_string.c_str(), perf_font_handle, PERF_TEXT_SIZE);
+        }
         vtxt_vertex_buffer vb = vtxt_grab_buffer();
-        perf_frametime_vao.gl_rebind_buffer_objects(vb.vertex_buffer, vb.index_buffer,
+        perf_frametime_vao.gl_stream_buffer_objects(perf_text_stream, vb.vertex_buffer, vb.index_buffer,
                                                     vb.vertices_array_count, vb.indices_array_count);
 
         mat4 perf_frametime_transform = identity_mat4();
-        mat4& matrix_projection_ortho = game_statics::the_renderer->matrix_projection_ortho;
 
         shader_t::gl_use_shader(*text_shader);
-            text_shader->gl_bind_matrix4fv("matrix_proj_orthographic", 1, matrix_projection_ortho.ptr());
             perf_font_atlas.gl_use_texture();
             text_shader->gl_bind_1i("font_atlas_sampler", 1);
             text_shader->gl_bind_3f("text_colour", 1.f, 1.f, 1.f);
@@ -79,6 +210,5 @@ void profiler_render(shader_t* ui_shader, shader_t* text_shader)
             {
                 perf_frametime_vao.gl_render_mesh();
             }
-        glUseProgram(0);
     }
 }
\ No newline at end of file
@@ -1,9 +1,64 @@
 #pragma once
 
+#include "../../game_defines.h"
+
 struct vtxt_font;
 struct texture_t;
 struct shader_t;
 
+/** Renderer counters for the current frame. Reset by profiler_begin_frame, shown at profiler level 2 and up. */
+struct profiler_frame_stats_t
+{
+    u32 draws_submitted = 0;
+    u32 instances_submitted = 0;
+    u32 draw_calls = 0; // API calls that submitted draws, e.g. one glMultiDrawElementsIndirect for many draws
+    u32 instances_gpu_tested = 0; // instances sent through GPU culling, which decides on its own how many get drawn
+    u32 draws_occluded = 0; // meshes in the frustum that occlusion culling skipped (last frame's count with Hi-Z culling)
+    u32 occluder_triangles = 0; // triangles rasterized into the software occlusion buffer
+    u32 light_tiles_spilled = 0; // light culling tiles with more lights than fit in shared memory (last frame's count)
+    u32 light_clusters_spilled = 0; // same for the clusters of clustered shading
+    u32 light_bytes_uploaded = 0; // point light data sent to the GPU, see light_manager_t
+    u32 light_upload_calls = 0;
+    u32 draws_culled = 0;
+    // Shadow maps whose casters were drawn from scratch (uncached, or a stale static cache), and the ones left as they were
+    u32 shadow_maps_drawn = 0;
+    u32 shadow_maps_reused = 0;
+    // GL state changes made by render queues, and the binds they skipped because the state was already set
+    u32 program_binds = 0;
+    u32 texture_binds = 0;
+    u32 vao_binds = 0;
+    u32 uniform_updates = 0;
+    u32 redundant_binds_skipped = 0;
+    u32 uniform_calls = 0; // glUniform* calls made through shader_t::gl_bind_*
+    // Calls made through gl_state (program, VAO, texture, framebuffer, enable and polygon mode), and the ones it
+    // skipped because they wouldn't have changed anything
+    u32 gl_state_calls_issued = 0;
+    u32 gl_state_calls_skipped = 0;
+    u32 uniform_buffer_updates = 0; // frame and pass constants written, see frame_constants_t
+    u32 stream_bytes_written = 0; // per-frame data written to stream buffers, see stream_buffer_t
+    // Heap allocations (operator new, INTERNAL_BUILD only): by the render passes before the UI, and by the whole
+    // frame from one profiler_begin_frame to the next
+    u32 render_allocations = 0;
+    u32 frame_allocations = 0;
+    // CPU time spent in each part of deferred_renderer::render, in milliseconds. The overlay shows the last frame's.
+    float shadow_maps_ms = 0.f;
+    float geometry_pass_ms = 0.f;
+    float light_upload_ms = 0.f;
+    float lighting_pass_ms = 0.f;
+    float ui_ms = 0.f;
+    float stream_fence_wait_ms = 0.f; // waiting for the GPU to finish with a stream buffer region
+};
+
+void profiler_begin_frame();
+
+/** Heap allocations made since profiler_begin_frame. Always 0 outside of INTERNAL_BUILD. */
+u32 profiler_allocations_this_frame();
+
+profiler_frame_stats_t& profiler_get_frame_stats();
+
+/** Milliseconds elapsed since start_ticks, a value returned by timer::get_ticks */
+float profiler_ms_since(i64 start_ticks);
+
 void profiler_set_level(int level);
 int profiler_get_level();
 
@@ -1,74 +1,76 @@
 #include "game_object.h"
-#include "../renderer/shader.h"
-#include "../renderer/material.h"
+
+game_object::game_object()
+{
+    node = get_scene_graph().create_node(this);
+}
+
+game_object::~game_object()
+{
+    get_scene_graph().destroy_node(node);
+}
 
 void game_object::update()
 {
 
 }
 
-void game_object::render(const shader_t* render_shader, const mat4* parent_model_matrix)
+vec3 game_object::get_pos() const
 {
-    bind_material_data(render_shader);
-    mat4 model_matrix = *parent_model_matrix;
-    model_matrix *= translation_matrix(pos);
-    model_matrix *= rotation_matrix(orient);
-    model_matrix *= scale_matrix(scale);
-    bind_model_matrix_data(render_shader, &model_matrix);
-    render();
+    return get_scene_graph().get_pos(node);
+}
 
-    for(auto& child : children)
-    {
-        if(child)
-        {
-            child->render(render_shader, &model_matrix);
-        }
-    }
+void game_object::set_pos(const vec3& new_pos)
+{
+    get_scene_graph().set_pos(node, new_pos);
 }
 
-INTERNAL material_t temp_material_shiny = {4.f, 128.f };
-INTERNAL material_t temp_material_dull = {0.5f, 1.f };
+quaternion game_object::get_orient() const
+{
+    return get_scene_graph().get_orient(node);
+}
 
-void game_object::bind_material_data(const shader_t* render_shader)
+void game_object::set_orient(const quaternion& new_orient)
 {
-    if(render_shader->get_cached_uniform_location("material.specular_intensity") >= 0)
-    {
-        render_shader->gl_bind_1f("material.specular_intensity", temp_material_dull.specular_intensity);
-        render_shader->gl_bind_1f("material.shininess", temp_material_dull.shininess);
-    }
+    get_scene_graph().set_orient(node, new_orient);
 }
 
-void game_object::bind_model_matrix_data(const shader_t* render_shader, const mat4* model_matrix)
+vec3 game_object::get_scale() const
 {
-    render_shader->gl_bind_matrix4fv("matrix_model", 1, (*model_matrix).ptr());
+    return get_scene_graph().get_scale(node);
 }
 
-void game_object::render() const
+void game_object::set_scale(const vec3& new_scale)
 {
-    mesh_group_t* model = get_render_model();
-    if(model)
-    {
-        model->render();
-    }
+    get_scene_graph().set_scale(node, new_scale);
+}
+
+const mat4& game_object::get_world_matrix() const
+{
+    scene_graph& scene = get_scene_graph();
+    return scene.get_world_matrix(scene.get_index(node));
 }
 
 game_object* game_object::get_parent() const
 {
-    return parent;
+    scene_graph& scene = get_scene_graph();
+    scene_node_id parent = scene.get_parent(node);
+    return parent == INDEX_NONE ? nullptr : scene.get_owner(parent);
 }
 
 void game_object::set_parent(game_object* new_parent)
 {
-    if(parent != new_parent)
-    {
-        if(parent) { parent->remove_child(this); }
-        parent = new_parent;
-        if(parent) { parent->add_child(this); }
-    }
+    get_scene_graph().set_parent(node, new_parent ? new_parent->node : INDEX_NONE);
 }
 
-std::vector<game_object*>& game_object::get_children()
+std::vector<game_object*> game_object::get_children() const
 {
+    scene_graph& scene = get_scene_graph();
+    std::vector<game_object*> children;
+    for(scene_node_id child : scene.get_children(node))
+    {
+        children.push_back(scene.get_owner(child));
+    }
     return children;
 }
 
@@ -76,7 +78,6 @@ void game_object::add_child(game_object* new_child)
 {
     if(!has_child(new_child))
     {
-        children.push_back(new_child);
         new_child->set_parent(this);
     }
 }
@@ -85,32 +86,36 @@ void game_object::remove_child(game_object* new_child)
 {
     if(has_child(new_child))
     {
-        auto end_iter = std::remove(children.begin(), children.end(), new_child);
-        if(new_child->get_parent() == this)
-        {
-            new_child->set_parent(nullptr);
-        }
+        new_child->set_parent(nullptr);
     }
 }
 
-bool game_object::has_child(game_object *child)
+bool game_object::has_child(game_object *child) const
 {
-    for (auto& actual_child : children)
-    {
-        if(actual_child == child)
-        {
-            return true;
-        }
-    }
-    return false;
+    return get_scene_graph().get_parent(child->node) == node;
 }
 
 void game_object::set_render_model(mesh_group_t* new_model)
 {
-    render_model = new_model;
+    get_scene_graph().set_render_model(node, new_model);
 }
 
 mesh_group_t* game_object::get_render_model() const
 {
-    return render_model;
+    return get_scene_graph().get_render_model(node);
+}
+
+bool game_object::is_b_static() const
+{
+    return get_scene_graph().is_static(node);
+}
+
+void game_object::set_b_static(bool b_static)
+{
+    get_scene_graph().set_static(node, b_static);
+}
+
+scene_node_id game_object::get_node() const
+{
+    return node;
 }
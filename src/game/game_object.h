@@ -3,55 +3,57 @@
 
 #include "../core/kc_math.h"
 #include "../renderer/mesh_group.h"
+#include "scene_graph.h"
 
-struct shader_t;
-
+/** A game_object is a handle to a node in the scene graph (see scene_graph.h). Its transform,
+    hierarchy, and render model live in the scene graph's flat arrays, so the renderer never
+    needs to walk game_objects - game_state iterates the scene graph linearly instead. */
 class game_object
 {
 public:
-    vec3        pos = {0.f};
-    quaternion  orient = identity_quaternion();
-    vec3        scale = {1.f,1.f,1.f};
     // int32 flags
     // Tags tags[4];
 
 public:
-    game_object() = default;
+    game_object();
+    virtual ~game_object();
+    game_object(const game_object&) = delete;
+    game_object& operator=(const game_object&) = delete;
 
     virtual void update();
 
-    virtual void render(const shader_t* render_shader, const mat4* parent_model_matrix);
-
+    vec3 get_pos() const;
+    void set_pos(const vec3& new_pos);
+    quaternion get_orient() const;
+    void set_orient(const quaternion& new_orient);
+    vec3 get_scale() const;
+    void set_scale(const vec3& new_scale);
+    /** World matrix as of the last scene_graph::update_world_matrices */
+    const mat4& get_world_matrix() const;
 
     /** Get reference to parent object */
     game_object* get_parent() const;
     /** Sets new parent-child relationship */
     void set_parent(game_object* new_parent);
-    /** Get reference to children vector */
-    std::vector<game_object*>& get_children();
+    /** Get children (built from the scene graph, so don't call every frame) */
+    std::vector<game_object*> get_children() const;
     /** Sets new parent-child relationship */
     void add_child(game_object* new_child);
     /** Sets new_child's parent to null ONLY if new_child's parent is this */
     void remove_child(game_object* new_child);
-    bool has_child(game_object* child);
+    bool has_child(game_object* child) const;
 
     void set_render_model(mesh_group_t* new_model);
     mesh_group_t* get_render_model() const;
 
+    /** Static objects don't move, so the shadow maps they cast into are drawn once and reused (see scene_graph::set_static) */
+    bool is_b_static() const;
+    void set_b_static(bool b_static);
 
-private:
-    game_object* parent = nullptr;
-
-    /** When a game object renders, every child of that game object gets rendered too. */
-    std::vector<game_object*> children;
-
-    mesh_group_t* render_model = nullptr;
+    scene_node_id get_node() const;
 
 private:
-    static void bind_material_data(const shader_t* render_shader);
-    static void bind_model_matrix_data(const shader_t* render_shader, const mat4* model_matrix);
-    void render() const;
-
+    scene_node_id node = INDEX_NONE;
 };
 
 #endif //XNGINE_GAME_OBJECT_H
@@ -1,6 +1,15 @@
+#include <algorithm>
+#include <SDL.h>
 #include "game_state.h"
 #include "../debugging/debug_drawer.h"
 #include "../debugging/console.h"
+#include "../renderer/shader.h"
+#include "../renderer/material.h"
+#include "../renderer/frustum.h"
+#include "../debugging/profiling/profiler.h"
+#include "../core/input.h"
+#include "../renderer/deferred_renderer.h"
+#include "../game_statics.h"
 
 game_state::game_state()
 {
@@ -13,6 +22,29 @@ game_state::game_state()
 
     get_console().bind_cvar("camspeed", &m_camera.movespeed);
     get_console().bind_cvar("sensitivity", &m_camera.turnspeed);
+
+    get_console().bind_cmd("pick", [this](std::istream& is, std::ostream& os){
+        // Pick under the cursor, or under the crosshair (screen center) while the mouse is grabbed
+        vec2i buffer_size = game_statics::the_renderer->get_buffer_size();
+        i32 x = buffer_size.x / 2;
+        i32 y = buffer_size.y / 2;
+        if(!SDL_GetRelativeMouseMode() && game_statics::the_input->g_curr_mouse_pos_x >= 0)
+        {
+            x = game_statics::the_input->g_curr_mouse_pos_x;
+            y = game_statics::the_input->g_curr_mouse_pos_y;
+        }
+        float distance;
+        game_object* picked = pick_object(x, y, buffer_size.x, buffer_size.y, &distance);
+        if(picked)
+        {
+            vec3 pos = picked->get_pos();
+            console_printf("picked node %d at distance %f, pos x: %f, y: %f, z: %f\n", picked->get_node(), distance, pos.x, pos.y, pos.z);
+        }
+        else
+        {
+            console_printf("nothing picked\n");
+        }
+    });
 }
 
 game_state::~game_state()
@@ -20,8 +52,12 @@ game_state::~game_state()
     get_console().unbind_cmd("camstats");
     get_console().unbind_cvar("camspeed");
     get_console().unbind_cvar("sensitivity");
+    get_console().unbind_cmd("pick");
 }
 
+/** Random point lights added to the Sponza scene, e.g. 4096 to compare light culling with tile_light_histogram */
+INTERNAL const int SPONZA_TEST_LIGHT_COUNT = 0;
+
 void game_state::temp_initialize_Sponza_Pointlight()
 {
     directionallight.orientation = euler_to_quat(make_vec3(0.f, 30.f, -47.f) * KC_DEG2RAD);
@@ -35,15 +71,17 @@ void game_state::temp_initialize_Sponza_Pointlight()
 
     auto parent_obj_MEM_LEAK = new game_object();
     parent_obj_MEM_LEAK->set_render_model(temp_model_MEM_LEAK_lol);
-    parent_obj_MEM_LEAK->pos = make_vec3(0.f, -6.f, 0.f);
-    parent_obj_MEM_LEAK->scale = make_vec3(0.04f, 0.04f, 0.04f);
+    parent_obj_MEM_LEAK->set_pos(make_vec3(0.f, -6.f, 0.f));
+    parent_obj_MEM_LEAK->set_scale(make_vec3(0.04f, 0.04f, 0.04f));
 
     auto child_obj_MEM_LEAK = new game_object();
     child_obj_MEM_LEAK->set_render_model(temp_model_MEM_LEAK_lol);
-    child_obj_MEM_LEAK->pos = make_vec3(3300.f, -60.f, 0.f);
+    child_obj_MEM_LEAK->set_pos(make_vec3(3300.f, -60.f, 0.f));
 
     parent_obj_MEM_LEAK->add_child(child_obj_MEM_LEAK);
     add_object_to_scene(parent_obj_MEM_LEAK);
+    parent_obj_MEM_LEAK->set_b_static(true);
+    child_obj_MEM_LEAK->set_b_static(true);
 
     update_group_1.push_back(parent_obj_MEM_LEAK);
     update_group_1.push_back(child_obj_MEM_LEAK);
@@ -58,23 +96,71 @@ void game_state::temp_initialize_Sponza_Pointlight()
     lm0pl.diffuse_intensity = 0.9f;
     lm0pl.position = { 0, 19.f, 0 };
     lm0pl.set_b_cast_shadow(true);
-    pointlights.push_back(lm0pl);
-//    for(int i = 0; i < 4096; ++i)
-//    {
-//        float r = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-//        float g = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-//        float b = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
-//        float x = (float) (rand() % 500) - 250;
-//        float z = (float) (rand() % 250) - 125;
-//        float y = (float) 0 + (rand() % 100);
-//        lm0pl.diffuse_intensity = 0.8f;
-//        lm0pl.colour = { r, g, b };
-//        lm0pl.position = { x, y, z };
-//        lm0pl.set_b_cast_shadow(false);
-//        loaded_map.pointlights.push_back(lm0pl);
-//    }
-
-    debug_set_pointlights(pointlights.data(), pointlights.size());
+    pointlights.add(lm0pl);
+    for(int i = 0; i < SPONZA_TEST_LIGHT_COUNT; ++i)
+    {
+        float r = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+        float g = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+        float b = static_cast <float> (rand()) / static_cast <float> (RAND_MAX);
+        float x = (float) (rand() % 500) - 250;
+        float z = (float) (rand() % 250) - 125;
+        float y = (float) 0 + (rand() % 100);
+        lm0pl.diffuse_intensity = 0.8f;
+        lm0pl.colour = { r, g, b };
+        lm0pl.position = { x, y, z };
+        lm0pl.set_b_cast_shadow(false);
+        pointlights.add(lm0pl);
+    }
+
+    debug_set_pointlights(&pointlights);
+}
+
+/** Cubes along each side of the field, and the distance between their centers */
+INTERNAL const int CUBE_FIELD_SIDE = 61;
+INTERNAL const float CUBE_FIELD_SPACING = 8.f;
+
+void game_state::temp_initialize_cube_field()
+{
+    directionallight.orientation = euler_to_quat(make_vec3(0.f, 30.f, -35.f) * KC_DEG2RAD);
+    directionallight.ambient_intensity = 0.2f;
+    directionallight.diffuse_intensity = 0.8f;
+    directionallight.colour = { 1.f, 1.f, 1.f };
+
+    auto cube_model_MEM_LEAK = new mesh_group_t();
+    *cube_model_MEM_LEAK = mesh_group_t::make_cube();
+
+    float field_extent = CUBE_FIELD_SIDE * CUBE_FIELD_SPACING;
+    auto ground_MEM_LEAK = new game_object();
+    ground_MEM_LEAK->set_render_model(cube_model_MEM_LEAK);
+    ground_MEM_LEAK->set_pos(make_vec3(0.f, -0.5f, 0.f));
+    ground_MEM_LEAK->set_scale(make_vec3(field_extent, 1.f, field_extent));
+    add_object_to_scene(ground_MEM_LEAK);
+    ground_MEM_LEAK->set_b_static(true);
+
+    // Far enough to need every cascade, and casters at every distance to see the cascades' resolution drop off
+    for(int x = 0; x < CUBE_FIELD_SIDE; ++x)
+    {
+        for(int z = 0; z < CUBE_FIELD_SIDE; ++z)
+        {
+            float height = 1.f + (float) ((x * 7 + z * 13) % 8);
+            auto cube_MEM_LEAK = new game_object();
+            cube_MEM_LEAK->set_render_model(cube_model_MEM_LEAK);
+            cube_MEM_LEAK->set_pos(make_vec3(((float) x - 0.5f * (CUBE_FIELD_SIDE - 1)) * CUBE_FIELD_SPACING,
+                                             0.5f * height,
+                                             ((float) z - 0.5f * (CUBE_FIELD_SIDE - 1)) * CUBE_FIELD_SPACING));
+            cube_MEM_LEAK->set_scale(make_vec3(2.f, height, 2.f));
+            add_object_to_scene(cube_MEM_LEAK);
+            cube_MEM_LEAK->set_b_static(true);
+        }
+    }
+
+    cam_start_pos = make_vec3(0.f, 12.f, 0.f);
+    cam_start_rot = make_vec3(0.f, 0.f, -10.f);
+    m_camera.position = cam_start_pos;
+    m_camera.rotation = cam_start_rot;
+    m_camera.update_camera();
+
+    debug_set_pointlights(&pointlights);
 }
 
 void game_state::update_scene()
@@ -93,13 +179,284 @@ void game_state::update_scene()
     }
     ...
     */
+
+    update_world_transforms();
+}
+
+INTERNAL material_t temp_material_shiny = {4.f, 128.f };
+INTERNAL material_t temp_material_dull = {0.5f, 1.f };
+
+void game_state::render_scene(shader_t *render_shader, vec3 view_position, const cull_view_t* cull_view,
+                              const gpu_cull_params_t* gpu_cull, software_occlusion_buffer_t* occlusion,
+                              u32 objects)
+{
+    scene_graph& scene = get_scene_graph();
+    // Update may be paused (e.g. console is open) while transforms or the hierarchy change
+    update_world_transforms();
+
+    render_shader->gl_bind_1f(render_shader->material_specular_intensity_uniform, temp_material_dull.specular_intensity);
+    render_shader->gl_bind_1f(render_shader->material_shininess_uniform, temp_material_dull.shininess);
+
+    profiler_frame_stats_t& stats = profiler_get_frame_stats();
+
+    // Without culling (or when the GPU culls) the scene is the contiguous range of nodes under
+    // scene_root_object, otherwise ask the BVH
+    visible_node_indices.clear();
+    if(cull_view && !gpu_cull)
+    {
+        visible_primitives.clear();
+        scene_bvh.query_cull_view(*cull_view, visible_primitives);
+        for(i32 primitive : visible_primitives)
+        {
+            visible_node_indices.push_back(scene.get_index(bvh_primitive_nodes[primitive]));
+        }
+    }
+    else
+    {
+        i32 root_index = scene.get_index(scene_root_object.get_node());
+        i32 end_index = root_index + scene.get_subtree_size(root_index);
+        for(i32 i = root_index; i < end_index; ++i)
+        {
+            visible_node_indices.push_back(i);
+        }
+    }
+    if(objects != SCENE_OBJECTS_ALL)
+    {
+        bool b_static = objects == SCENE_OBJECTS_STATIC;
+        visible_node_indices.erase(std::remove_if(visible_node_indices.begin(), visible_node_indices.end(),
+                                                  [&](i32 i){ return scene.is_static_at(i) != b_static; }),
+                                   visible_node_indices.end());
+    }
+
+    if(gpu_cull)
+    {
+        occlusion = nullptr;
+    }
+    if(occlusion)
+    {
+        // Rasterize the occluders of the objects in view, then test the other meshes against them below
+        for(i32 i : visible_node_indices)
+        {
+            mesh_group_t* model = scene.get_render_model_at(i);
+            if(!model)
+            {
+                continue;
+            }
+            for(const occluder_geometry_t& occluder : model->mesh_occluders)
+            {
+                if(!occluder.indices.empty())
+                {
+                    occlusion->add_occluder(occluder.positions.data(), (u32) occluder.positions.size(),
+                                            occluder.indices.data(), (u32) occluder.indices.size(), scene.get_world_matrix(i));
+                }
+            }
+        }
+        occlusion->rasterize();
+        stats.occluder_triangles += occlusion->get_triangle_count();
+    }
+
+    scene_render_queue.clear();
+    u32 program_id = render_shader->get_program_id();
+    u32 visible_mesh_count = 0;
+    for(i32 i : visible_node_indices)
+    {
+        mesh_group_t* model = scene.get_render_model_at(i);
+        if(!model)
+        {
+            continue;
+        }
+
+        const mat4& world_matrix = scene.get_world_matrix(i);
+        vec3 world_position = make_vec3(world_matrix[3].x, world_matrix[3].y, world_matrix[3].z);
+        u32 first_visibility_index = bvh_primitive_first_mesh[bvh_node_primitives[scene.get_id(i)]];
+        u32 mesh_count = (u32) model->meshes.size();
+        visible_mesh_count += mesh_count;
+        for(u32 mesh_index = 0; mesh_index < mesh_count; ++mesh_index)
+        {
+            draw_item_t item;
+            float view_depth;
+            if(gpu_cull)
+            {
+                // Leave the bounds to the GPU, sort by the object's origin
+                item.local_bounds = &model->mesh_bounds[mesh_index];
+                item.visibility_index = first_visibility_index + mesh_index;
+                view_depth = magnitude(world_position - view_position);
+            }
+            else
+            {
+                aabb_t mesh_bounds = transform_aabb(model->mesh_bounds[mesh_index], world_matrix);
+                if(cull_view)
+                {
+                    item.face_mask = cull_view->get_visibility_mask(mesh_bounds);
+                    if(!item.face_mask)
+                    {
+                        ++stats.draws_culled;
+                        continue;
+                    }
+                }
+                // Occluders aren't tested, they'd hide themselves
+                bool b_occluder = mesh_index < model->mesh_occluders.size() && !model->mesh_occluders[mesh_index].indices.empty();
+                if(occlusion && !b_occluder && !occlusion->is_visible(mesh_bounds))
+                {
+                    ++stats.draws_occluded;
+                    continue;
+                }
+                view_depth = magnitude(mesh_bounds.get_center() - view_position);
+            }
+            u16 texture_index = model->mesh_to_texture[mesh_index];
+            if(texture_index < model->textures.size() && model->textures[texture_index].texture_id != 0)
+            {
+                item.texture = &model->textures[texture_index];
+            }
+            item.shader = render_shader;
+            item.mesh = &model->meshes[mesh_index];
+            item.model_matrix = &world_matrix;
+            item.sort_key = make_draw_sort_key(program_id, item.texture ? item.texture->texture_id : 0, item.mesh->first_index, view_depth);
+            scene_render_queue.push(item);
+        }
+    }
+    if(cull_view && !gpu_cull && objects == SCENE_OBJECTS_ALL)
+    {
+        // Meshes of the objects the BVH culled
+        stats.draws_culled += bvh_mesh_count - visible_mesh_count;
+    }
+
+    scene_render_queue.sort_and_submit(gpu_cull);
+}
+
+void game_state::render_scene_again(const gpu_cull_params_t* gpu_cull)
+{
+    scene_render_queue.submit(gpu_cull);
+}
+
+bool game_state::has_dynamic_objects_in_view(const cull_view_t& cull_view)
+{
+    scene_graph& scene = get_scene_graph();
+    update_world_transforms();
+    visible_primitives.clear();
+    scene_bvh.query_cull_view(cull_view, visible_primitives);
+    for(i32 primitive : visible_primitives)
+    {
+        if(!scene.is_static(bvh_primitive_nodes[primitive]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void game_state::update_world_transforms()
+{
+    scene_graph& scene = get_scene_graph();
+    scene.update_world_matrices();
+
+    if(!b_bvh_built || bvh_structure_version != scene.get_structure_version())
+    {
+        rebuild_scene_bvh();
+        ++static_objects_version;
+        return;
+    }
+
+    // Refit the bounds of the objects that moved, one at a time if there are few of them
+    const std::vector<scene_node_id>& updated_nodes = scene.get_last_updated_nodes();
+    bool b_refit_one_by_one = (i32) updated_nodes.size() * 4 < scene_bvh.get_primitive_count();
+    bool b_refit_all = false;
+    bool b_static_moved = false;
+    for(scene_node_id node : updated_nodes)
+    {
+        i32 primitive = bvh_node_primitives[node];
+        if(primitive == INDEX_NONE)
+        {
+            continue;
+        }
+        b_static_moved |= scene.is_static(node);
+        aabb_t bounds = get_world_bounds(scene.get_index(node));
+        if(b_refit_one_by_one)
+        {
+            scene_bvh.refit_primitive(primitive, bounds);
+        }
+        else
+        {
+            scene_bvh.set_primitive_bounds(primitive, bounds);
+            b_refit_all = true;
+        }
+    }
+    if(b_refit_all)
+    {
+        scene_bvh.refit();
+    }
+    if(b_static_moved)
+    {
+        ++static_objects_version;
+    }
+}
+
+void game_state::rebuild_scene_bvh()
+{
+    scene_graph& scene = get_scene_graph();
+    bvh_primitive_nodes.clear();
+    bvh_primitive_first_mesh.clear();
+    bvh_node_primitives.assign(scene.get_max_node_id(), INDEX_NONE);
+    bvh_mesh_count = 0;
+
+    std::vector<aabb_t> bounds;
+    i32 root_index = scene.get_index(scene_root_object.get_node());
+    i32 end_index = root_index + scene.get_subtree_size(root_index);
+    for(i32 i = root_index; i < end_index; ++i)
+    {
+        mesh_group_t* model = scene.get_render_model_at(i);
+        if(model)
+        {
+            bvh_node_primitives[scene.get_id(i)] = (i32) bvh_primitive_nodes.size();
+            bvh_primitive_nodes.push_back(scene.get_id(i));
+            bvh_primitive_first_mesh.push_back(bvh_mesh_count);
+            bounds.push_back(get_world_bounds(i));
+            bvh_mesh_count += (u32) model->meshes.size();
+        }
+    }
+    scene_bvh.build(bounds.data(), (i32) bounds.size());
+
+    bvh_structure_version = scene.get_structure_version();
+    b_bvh_built = true;
+}
+
+aabb_t game_state::get_world_bounds(i32 node_index) const
+{
+    scene_graph& scene = get_scene_graph();
+    return transform_aabb(scene.get_render_model_at(node_index)->bounds, scene.get_world_matrix(node_index));
+}
+
+void game_state::query_objects_in_sphere(vec3 center, float radius, std::vector<game_object*>& out_objects) const
+{
+    std::vector<i32> primitives;
+    scene_bvh.query_sphere(center, radius, primitives);
+    for(i32 primitive : primitives)
+    {
+        out_objects.push_back(get_scene_graph().get_owner(bvh_primitive_nodes[primitive]));
+    }
+}
+
+game_object* game_state::raycast_objects(vec3 origin, vec3 direction, float* out_distance) const
+{
+    i32 primitive = scene_bvh.raycast(origin, direction, m_camera.farclip, out_distance);
+    if(primitive == INDEX_NONE)
+    {
+        return nullptr;
+    }
+    return get_scene_graph().get_owner(bvh_primitive_nodes[primitive]);
 }
 
-void game_state::render_scene(shader_t *render_shader)
+game_object* game_state::pick_object(i32 screen_x, i32 screen_y, i32 screen_width, i32 screen_height, float* out_distance) const
 {
-    // TODO Kevin specific order of rendering might be important sometimes
-    mat4 scene_model_matrix = identity_mat4();
-    scene_root_object.render(render_shader, &scene_model_matrix);
+    // Ray through the pixel: the projection matrix holds 1 / tan(fovy/2) and 1 / (aspect * tan(fovy/2))
+    float ndc_x = 2.f * ((float) screen_x + 0.5f) / (float) screen_width - 1.f;
+    float ndc_y = 1.f - 2.f * ((float) screen_y + 0.5f) / (float) screen_height;
+    float right_amount = ndc_x / m_camera.matrix_perspective[0][0];
+    float up_amount = ndc_y / m_camera.matrix_perspective[1][1];
+    vec3 direction = normalize(m_camera.calculated_direction
+                               + m_camera.calculated_right * right_amount
+                               + m_camera.calculated_up * up_amount);
+    return raycast_objects(m_camera.position, direction, out_distance);
 }
 
 void game_state::switch_map(const char* map_file_path)
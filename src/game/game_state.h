@@ -3,10 +3,16 @@
 #include <vector>
 #include "../core/kc_math.h"
 #include "../renderer/light.h"
+#include "../renderer/light_manager.h"
 #include "../renderer/mesh_group.h"
 #include "../renderer/camera.h"
+#include "../renderer/bvh.h"
+#include "../renderer/render_queue.h"
+#include "../renderer/software_occlusion.h"
 #include "game_object.h"
 
+struct shader_t;
+
 struct game_state
 {
 public:
@@ -14,7 +20,7 @@ public:
     bool b_is_update_running = true;
 
     directional_light_t         directionallight;
-    std::vector<point_light_t>  pointlights;
+    light_manager_t             pointlights;
     camera_t m_camera;
     vec3 cam_start_pos = {0.f};
     vec3 cam_start_rot = {0.f};
@@ -31,9 +37,49 @@ public:
 
     void temp_initialize_Sponza_Pointlight();
 
+    /** Test map for the directional light's shadow cascades: a large field of static cubes of different heights */
+    void temp_initialize_cube_field();
+
     void update_scene();
 
-    void render_scene(shader_t* render_shader);
+    /** Renders the scene through a render queue sorted by state, then front to back from view_position.
+        Objects sharing a mesh_group_t are drawn instanced.
+        If cull_view is given, meshes outside all of its frusta aren't submitted, and each instance's
+        face mask is the bitmask of the frusta its mesh is inside.
+        If gpu_cull is given, every mesh is queued and the culling (against gpu_cull's cull view) happens
+        in a compute pass instead; cull_view is ignored.
+        If occlusion is given (and gpu_cull isn't), the occluder meshes of the objects in view are rasterized into
+        it, and the other meshes it hides aren't submitted. Begin it with the view projection before calling.
+        objects (one of SCENE_OBJECTS_*) leaves out the dynamic or the static objects. */
+    void render_scene(shader_t* render_shader, vec3 view_position, const cull_view_t* cull_view = nullptr,
+                      const gpu_cull_params_t* gpu_cull = nullptr, software_occlusion_buffer_t* occlusion = nullptr,
+                      u32 objects = SCENE_OBJECTS_ALL);
+
+    /** Draws the scene again as queued by the last render_scene, e.g. for the second occlusion culling phase */
+    void render_scene_again(const gpu_cull_params_t* gpu_cull);
+
+    /** Whether any object that isn't static and has a render model overlaps one of cull_view's frusta */
+    bool has_dynamic_objects_in_view(const cull_view_t& cull_view);
+
+    /** Changes whenever a static object with a render model moves, or the scene's structure changes,
+        i.e. whenever what the static objects look like from a light may have changed */
+    u32 get_static_objects_version() const { return static_objects_version; }
+
+    /** Number of meshes in the scene, i.e. the range of draw_item_t::visibility_index */
+    u32 get_scene_mesh_count() const { return bvh_mesh_count; }
+
+    /** Recalculates the world matrix of every game_object in the scene whose transform,
+        or whose ancestor's transform, changed, and refits their bounds in the scene BVH.
+        Called once per frame by update_scene so that every render pass can use the cached
+        world matrices. */
+    void update_world_transforms();
+
+    /** Appends every game_object in the scene whose bounds overlap the sphere (e.g. a point light's volume) */
+    void query_objects_in_sphere(vec3 center, float radius, std::vector<game_object*>& out_objects) const;
+    /** Returns the game_object in the scene whose bounds the ray hits first, nullptr if none */
+    game_object* raycast_objects(vec3 origin, vec3 direction, float* out_distance) const;
+    /** Returns the game_object in the scene under the given screen position (in pixels), nullptr if none */
+    game_object* pick_object(i32 screen_x, i32 screen_y, i32 screen_width, i32 screen_height, float* out_distance) const;
 
     void switch_map(const char* map_file_path);
 
@@ -47,6 +93,26 @@ private:
         When referring to Scene, I am talking about Scene relating to
         rendering. */
     game_object scene_root_object;
+
+    /** BVH over the world space bounds of every object with a render model in the scene.
+        Rebuilt when the scene's structure changes, refit when objects move. */
+    bvh_t                       scene_bvh;
+    /** Node of each primitive in scene_bvh, and primitive of each node (by node id, INDEX_NONE if not in scene_bvh) */
+    std::vector<scene_node_id>  bvh_primitive_nodes;
+    std::vector<i32>            bvh_node_primitives;
+    u32 bvh_structure_version = 0;
+    bool b_bvh_built = false;
+    u32 static_objects_version = 0;
+    /** Number of meshes of all the objects in scene_bvh, and the index of each primitive's first mesh among them */
+    u32 bvh_mesh_count = 0;
+    std::vector<u32>            bvh_primitive_first_mesh;
+    /** Scratch for query results */
+    std::vector<i32>            visible_primitives;
+    std::vector<i32>            visible_node_indices;
+    render_queue_t              scene_render_queue;
+
+    void rebuild_scene_bvh();
+    aabb_t get_world_bounds(i32 node_index) const;
 };
 
 
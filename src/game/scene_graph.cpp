@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cstring>
+#include "scene_graph.h"
+
+/** Rotates [begin, begin + count) of values so it starts right before destination */
+template<typename T>
+INTERNAL void move_range(std::vector<T>& values, i32 begin, i32 count, i32 destination)
+{
+    if(destination > begin)
+    {
+        std::rotate(values.begin() + begin, values.begin() + begin + count, values.begin() + destination);
+    }
+    else
+    {
+        std::rotate(values.begin() + destination, values.begin() + begin, values.begin() + begin + count);
+    }
+}
+
+scene_graph& get_scene_graph()
+{
+    local_persist scene_graph scene;
+    return scene;
+}
+
+scene_node_id scene_graph::create_node(game_object* owner)
+{
+    scene_node_id id;
+    if(free_ids.empty())
+    {
+        id = (scene_node_id) id_to_index.size();
+        id_to_index.push_back(INDEX_NONE);
+    }
+    else
+    {
+        id = free_ids.back();
+        free_ids.pop_back();
+    }
+
+    // New nodes are roots, which can live anywhere in the order, so they go at the end
+    i32 index = node_count();
+    id_to_index[id] = index;
+    index_to_id.push_back(id);
+    parent_indices.push_back(INDEX_NONE);
+    subtree_sizes.push_back(1);
+    pos_x.push_back(0.f);
+    pos_y.push_back(0.f);
+    pos_z.push_back(0.f);
+    orient_w.push_back(1.f);
+    orient_x.push_back(0.f);
+    orient_y.push_back(0.f);
+    orient_z.push_back(0.f);
+    scale_x.push_back(1.f);
+    scale_y.push_back(1.f);
+    scale_z.push_back(1.f);
+    transform_dirty.push_back(0);
+    world_matrices.push_back(identity_mat4());
+    render_models.push_back(nullptr);
+    static_flags.push_back(0);
+    owners.push_back(owner);
+    mark_dirty(index);
+    ++structure_version;
+    return id;
+}
+
+void scene_graph::destroy_node(scene_node_id node)
+{
+    i32 index = id_to_index[node];
+    while(subtree_sizes[index] > 1)
+    {
+        // Detaching the first child moves it to the end of the arrays, index doesn't change
+        set_parent(index_to_id[index + 1], INDEX_NONE);
+    }
+    set_parent(node, INDEX_NONE);
+
+    // Now a root without children: move it to the back and pop it off
+    index = id_to_index[node];
+    if(index != node_count() - 1)
+    {
+        move_nodes(index, 1, node_count());
+    }
+    if(transform_dirty.back())
+    {
+        --dirty_count;
+    }
+    index_to_id.pop_back();
+    parent_indices.pop_back();
+    subtree_sizes.pop_back();
+    pos_x.pop_back();
+    pos_y.pop_back();
+    pos_z.pop_back();
+    orient_w.pop_back();
+    orient_x.pop_back();
+    orient_y.pop_back();
+    orient_z.pop_back();
+    scale_x.pop_back();
+    scale_y.pop_back();
+    scale_z.pop_back();
+    transform_dirty.pop_back();
+    world_matrices.pop_back();
+    render_models.pop_back();
+    static_flags.pop_back();
+    owners.pop_back();
+
+    id_to_index[node] = INDEX_NONE;
+    free_ids.push_back(node);
+    ++structure_version;
+}
+
+bool scene_graph::set_parent(scene_node_id node, scene_node_id new_parent)
+{
+    i32 index = id_to_index[node];
+    i32 size = subtree_sizes[index];
+    i32 new_parent_index = new_parent == INDEX_NONE ? INDEX_NONE : id_to_index[new_parent];
+    if(new_parent_index != INDEX_NONE && new_parent_index >= index && new_parent_index < index + size)
+    {
+        return false; // would create a cycle
+    }
+
+    // The subtree goes right after the new parent's current subtree (i.e. becomes its last child)
+    i32 destination = new_parent_index == INDEX_NONE ? node_count() : new_parent_index + subtree_sizes[new_parent_index];
+
+    for(i32 ancestor = parent_indices[index]; ancestor != INDEX_NONE; ancestor = parent_indices[ancestor])
+    {
+        subtree_sizes[ancestor] -= size;
+    }
+
+    if(destination < index || destination > index + size)
+    {
+        move_nodes(index, size, destination);
+        index = id_to_index[node];
+        new_parent_index = new_parent == INDEX_NONE ? INDEX_NONE : id_to_index[new_parent];
+    }
+
+    parent_indices[index] = new_parent_index;
+    for(i32 ancestor = new_parent_index; ancestor != INDEX_NONE; ancestor = parent_indices[ancestor])
+    {
+        subtree_sizes[ancestor] += size;
+    }
+    mark_dirty(index);
+    ++structure_version;
+    return true;
+}
+
+scene_node_id scene_graph::get_parent(scene_node_id node) const
+{
+    i32 parent_index = parent_indices[id_to_index[node]];
+    return parent_index == INDEX_NONE ? INDEX_NONE : index_to_id[parent_index];
+}
+
+std::vector<scene_node_id> scene_graph::get_children(scene_node_id node) const
+{
+    std::vector<scene_node_id> children;
+    i32 index = id_to_index[node];
+    i32 end = index + subtree_sizes[index];
+    for(i32 child = index + 1; child < end; child += subtree_sizes[child])
+    {
+        children.push_back(index_to_id[child]);
+    }
+    return children;
+}
+
+vec3 scene_graph::get_pos(scene_node_id node) const
+{
+    i32 index = id_to_index[node];
+    return make_vec3(pos_x[index], pos_y[index], pos_z[index]);
+}
+
+void scene_graph::set_pos(scene_node_id node, const vec3& pos)
+{
+    i32 index = id_to_index[node];
+    pos_x[index] = pos.x;
+    pos_y[index] = pos.y;
+    pos_z[index] = pos.z;
+    mark_dirty(index);
+}
+
+quaternion scene_graph::get_orient(scene_node_id node) const
+{
+    i32 index = id_to_index[node];
+    quaternion orient;
+    orient.w = orient_w[index];
+    orient.x = orient_x[index];
+    orient.y = orient_y[index];
+    orient.z = orient_z[index];
+    return orient;
+}
+
+void scene_graph::set_orient(scene_node_id node, const quaternion& orient)
+{
+    i32 index = id_to_index[node];
+    orient_w[index] = orient.w;
+    orient_x[index] = orient.x;
+    orient_y[index] = orient.y;
+    orient_z[index] = orient.z;
+    mark_dirty(index);
+}
+
+vec3 scene_graph::get_scale(scene_node_id node) const
+{
+    i32 index = id_to_index[node];
+    return make_vec3(scale_x[index], scale_y[index], scale_z[index]);
+}
+
+void scene_graph::set_scale(scene_node_id node, const vec3& scale)
+{
+    i32 index = id_to_index[node];
+    scale_x[index] = scale.x;
+    scale_y[index] = scale.y;
+    scale_z[index] = scale.z;
+    mark_dirty(index);
+}
+
+void scene_graph::update_world_matrices()
+{
+    i32 count = node_count();
+    last_updated_nodes.clear();
+    if(dirty_count == 0)
+    {
+        return;
+    }
+
+    // transform_dirty[i] ends up meaning "world matrix i changed this update". Parents come
+    // before children, so a parent's flag and world matrix are final by the time we reach its children.
+    if(dirty_count * 4 >= count)
+    {
+        // Most of the scene moved: building every local matrix with the batched kernel is cheaper than branching
+        transform_streams streams;
+        streams.pos_x = pos_x.data();
+        streams.pos_y = pos_y.data();
+        streams.pos_z = pos_z.data();
+        streams.orient_w = orient_w.data();
+        streams.orient_x = orient_x.data();
+        streams.orient_y = orient_y.data();
+        streams.orient_z = orient_z.data();
+        streams.scale_x = scale_x.data();
+        streams.scale_y = scale_y.data();
+        streams.scale_z = scale_z.data();
+        local_matrices.resize(count);
+        trs_matrices(local_matrices.data(), streams, count);
+
+        for(i32 i = 0; i < count; ++i)
+        {
+            i32 parent_index = parent_indices[i];
+            if(parent_index == INDEX_NONE)
+            {
+                world_matrices[i] = local_matrices[i];
+            }
+            else
+            {
+                world_matrices[i] = world_matrices[parent_index] * local_matrices[i];
+            }
+        }
+        last_updated_nodes.insert(last_updated_nodes.end(), index_to_id.begin(), index_to_id.end());
+    }
+    else
+    {
+        for(i32 i = 0; i < count; ++i)
+        {
+            i32 parent_index = parent_indices[i];
+            bool b_parent_changed = parent_index != INDEX_NONE && transform_dirty[parent_index];
+            if(transform_dirty[i] || b_parent_changed)
+            {
+                quaternion orient;
+                orient.w = orient_w[i];
+                orient.x = orient_x[i];
+                orient.y = orient_y[i];
+                orient.z = orient_z[i];
+                mat4 local_matrix = trs_matrix(make_vec3(pos_x[i], pos_y[i], pos_z[i]), orient,
+                                               make_vec3(scale_x[i], scale_y[i], scale_z[i]));
+                if(parent_index == INDEX_NONE)
+                {
+                    world_matrices[i] = local_matrix;
+                }
+                else
+                {
+                    world_matrices[i] = world_matrices[parent_index] * local_matrix;
+                }
+                transform_dirty[i] = 1;
+                last_updated_nodes.push_back(index_to_id[i]);
+            }
+        }
+    }
+
+    memset(transform_dirty.data(), 0, transform_dirty.size());
+    dirty_count = 0;
+}
+
+void scene_graph::mark_dirty(i32 index)
+{
+    if(!transform_dirty[index])
+    {
+        transform_dirty[index] = 1;
+        ++dirty_count;
+    }
+}
+
+void scene_graph::move_nodes(i32 begin, i32 count, i32 destination)
+{
+    i32 end = begin + count;
+    move_range(index_to_id, begin, count, destination);
+    move_range(parent_indices, begin, count, destination);
+    move_range(subtree_sizes, begin, count, destination);
+    move_range(pos_x, begin, count, destination);
+    move_range(pos_y, begin, count, destination);
+    move_range(pos_z, begin, count, destination);
+    move_range(orient_w, begin, count, destination);
+    move_range(orient_x, begin, count, destination);
+    move_range(orient_y, begin, count, destination);
+    move_range(orient_z, begin, count, destination);
+    move_range(scale_x, begin, count, destination);
+    move_range(scale_y, begin, count, destination);
+    move_range(scale_z, begin, count, destination);
+    move_range(transform_dirty, begin, count, destination);
+    move_range(world_matrices, begin, count, destination);
+    move_range(render_models, begin, count, destination);
+    move_range(static_flags, begin, count, destination);
+    move_range(owners, begin, count, destination);
+
+    // Every index between begin and destination shifted, remap them
+    i32 lower = kc_min(begin, destination);
+    i32 upper = kc_max(end, destination);
+    auto remap = [=](i32 index) -> i32 {
+        if(index < lower || index >= upper)
+        {
+            return index;
+        }
+        if(destination > begin)
+        {
+            return index < end ? index + (destination - end) : index - count;
+        }
+        return index >= begin ? index - (begin - destination) : index + count;
+    };
+    for(i32& parent_index : parent_indices)
+    {
+        if(parent_index != INDEX_NONE)
+        {
+            parent_index = remap(parent_index);
+        }
+    }
+    for(i32 index = lower; index < upper; ++index)
+    {
+        id_to_index[index_to_id[index]] = index;
+    }
+}
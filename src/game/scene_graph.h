@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+
+struct mesh_group_t;
+class game_object;
+
+/** Stable handle to a node in a scene_graph. Node indices change when the hierarchy
+    changes, node ids don't. */
+typedef i32 scene_node_id;
+
+/** Which nodes a pass draws, by scene_graph::is_static (e.g. game_state::render_scene) */
+#define SCENE_OBJECTS_ALL 0
+#define SCENE_OBJECTS_STATIC 1
+#define SCENE_OBJECTS_DYNAMIC 2
+
+/** Flattened, data-oriented scene hierarchy
+
+    Every node's data lives in parallel arrays indexed by node index. The arrays are kept in
+    depth-first order: a node always comes before its descendants, and a node's entire subtree
+    is the contiguous range [index, index + subtree size). That means
+        - world matrices can be calculated with one linear sweep (parents are always done first)
+        - a subtree (e.g. everything under the scene root) can be iterated linearly
+        - re-parenting is moving one contiguous block of the arrays
+    Local transforms are stored as structure-of-arrays so they can be fed to trs_matrices.
+*/
+struct scene_graph
+{
+    scene_node_id create_node(game_object* owner = nullptr);
+    /** Destroys the node. Its children become root nodes. */
+    void destroy_node(scene_node_id node);
+
+    /** Makes node the last child of new_parent (or a root node if new_parent is INDEX_NONE).
+        Returns false if new_parent is node or one of its descendants. */
+    bool set_parent(scene_node_id node, scene_node_id new_parent);
+    scene_node_id get_parent(scene_node_id node) const;
+    std::vector<scene_node_id> get_children(scene_node_id node) const;
+
+    vec3 get_pos(scene_node_id node) const;
+    void set_pos(scene_node_id node, const vec3& pos);
+    quaternion get_orient(scene_node_id node) const;
+    void set_orient(scene_node_id node, const quaternion& orient);
+    vec3 get_scale(scene_node_id node) const;
+    void set_scale(scene_node_id node, const vec3& scale);
+
+    mesh_group_t* get_render_model(scene_node_id node) const { return render_models[id_to_index[node]]; }
+    void set_render_model(scene_node_id node, mesh_group_t* model) { render_models[id_to_index[node]] = model; ++structure_version; }
+    game_object* get_owner(scene_node_id node) const { return owners[id_to_index[node]]; }
+    /** Static nodes are expected not to move, so e.g. shadow maps keep their depth between frames.
+        They still can, it just costs a redraw of what was cached. */
+    bool is_static(scene_node_id node) const { return static_flags[id_to_index[node]] != 0; }
+    void set_static(scene_node_id node, bool b_static) { static_flags[id_to_index[node]] = b_static; ++structure_version; }
+
+    /** Recalculates the world matrix of every node whose transform or whose ancestor's transform
+        changed since the last call. */
+    void update_world_matrices();
+
+    /** Number of world matrices recalculated by the last update_world_matrices call */
+    i32 get_last_update_count() const { return (i32) last_updated_nodes.size(); }
+    /** Nodes whose world matrices were recalculated by the last update_world_matrices call */
+    const std::vector<scene_node_id>& get_last_updated_nodes() const { return last_updated_nodes; }
+    /** Incremented whenever nodes are created, destroyed, re-parented, or change render model or static flag */
+    u32 get_structure_version() const { return structure_version; }
+
+    // Linear access by node index, e.g. for (i = index; i < index + get_subtree_size(index); ++i)
+    i32 node_count() const { return (i32) parent_indices.size(); }
+    i32 get_index(scene_node_id node) const { return id_to_index[node]; }
+    /** Node ids are less than this */
+    i32 get_max_node_id() const { return (i32) id_to_index.size(); }
+    scene_node_id get_id(i32 index) const { return index_to_id[index]; }
+    i32 get_parent_index(i32 index) const { return parent_indices[index]; }
+    i32 get_subtree_size(i32 index) const { return subtree_sizes[index]; }
+    const mat4& get_world_matrix(i32 index) const { return world_matrices[index]; }
+    mesh_group_t* get_render_model_at(i32 index) const { return render_models[index]; }
+    game_object* get_owner_at(i32 index) const { return owners[index]; }
+    bool is_static_at(i32 index) const { return static_flags[index] != 0; }
+
+private:
+    // Hierarchy
+    std::vector<i32>            parent_indices;
+    std::vector<i32>            subtree_sizes;
+    // Local transforms
+    std::vector<float>          pos_x;
+    std::vector<float>          pos_y;
+    std::vector<float>          pos_z;
+    std::vector<float>          orient_w;
+    std::vector<float>          orient_x;
+    std::vector<float>          orient_y;
+    std::vector<float>          orient_z;
+    std::vector<float>          scale_x;
+    std::vector<float>          scale_y;
+    std::vector<float>          scale_z;
+    std::vector<u8>             transform_dirty;
+    // Output
+    std::vector<mat4>           world_matrices;
+    // Render data and owners
+    std::vector<mesh_group_t*>  render_models;
+    std::vector<u8>             static_flags;
+    std::vector<game_object*>   owners;
+    // Id <-> index
+    std::vector<scene_node_id>  index_to_id;
+    std::vector<i32>            id_to_index;
+    std::vector<scene_node_id>  free_ids;
+
+    std::vector<mat4>           local_matrices; // scratch for batched updates
+    i32 dirty_count = 0;
+    std::vector<scene_node_id>  last_updated_nodes;
+    u32 structure_version = 0;
+
+    void mark_dirty(i32 index);
+    /** Moves the count nodes starting at begin so they start right before destination
+        (destination is an index in the current order, outside the moved range). */
+    void move_nodes(i32 begin, i32 count, i32 destination);
+};
+
+/** The scene graph all game_objects live in */
+scene_graph& get_scene_graph();
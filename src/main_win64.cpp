@@ -13,8 +13,6 @@ TODO:
         - documentation to say that one can use translation and scaling matrices with the resulting
           vertices in order to transform them on the screen (e.g. animate the text).
     ~~~
-    - CASCADED SHADOW MAPS https://developer.download.nvidia.com/SDK/10.5/opengl/src/cascaded_shadow_maps/doc/cascaded_shadow_maps.pdf
-        - make a test map for CSM. (e.g. field of trees or cubes all with shadows)
     - STATIC and DYNAMIC lights and STATIC and DYNAMIC objects/casters
         - DYNAMIC lights need to be marked dirty to update shaders etc. (don't update_scene shaders with light info every frame)
         - for dynamic objects, render the shadow map on-top of the existing shadow map e.g. add more dark spots
@@ -39,6 +37,7 @@ BUILD MODES
         1 - Slow code fine
 
 */
+#include <cstring>
 #include "game_defines.h"
 #include "core/timer.h"
 #include "debugging/console.h"
@@ -109,7 +108,15 @@ int main(int argc, char* argv[]) // Our main entry point MUST be in this form wh
 
     game_statics::the_renderer->load_shaders();
 
-    i_game_state.temp_initialize_Sponza_Pointlight();
+    // e.g. "xngine cube_field" for the shadow cascade test map
+    if(argc > 1 && strcmp(argv[1], "cube_field") == 0)
+    {
+        i_game_state.temp_initialize_cube_field();
+    }
+    else
+    {
+        i_game_state.temp_initialize_Sponza_Pointlight();
+    }
     game_statics::the_renderer->temp_create_shadow_maps();
     game_statics::the_renderer->temp_create_geometry_buffer();
 
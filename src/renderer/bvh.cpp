@@ -0,0 +1,388 @@
+#include <algorithm>
+#include "bvh.h"
+
+INTERNAL const i32 BVH_BIN_COUNT = 12;
+INTERNAL const i32 BVH_MAX_LEAF_SIZE = 4;
+INTERNAL const i32 BVH_MAX_DEPTH = 64;
+
+INTERNAL float surface_area(const aabb_t& box)
+{
+    if(box.is_empty())
+    {
+        return 0.f;
+    }
+    vec3 size = box.max - box.min;
+    return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+struct bvh_bin_t
+{
+    aabb_t bounds = aabb_t::make_empty();
+    i32 count = 0;
+};
+
+void bvh_t::build(const aabb_t* in_primitive_bounds, i32 primitive_count)
+{
+    primitive_bounds.assign(in_primitive_bounds, in_primitive_bounds + primitive_count);
+    primitive_order.resize(primitive_count);
+    primitive_leaves.assign(primitive_count, INDEX_NONE);
+    nodes.clear();
+    node_parents.clear();
+    if(primitive_count == 0)
+    {
+        return;
+    }
+    nodes.reserve(2 * (primitive_count / BVH_MAX_LEAF_SIZE + 1));
+    node_parents.reserve(nodes.capacity());
+
+    std::vector<vec3> centers(primitive_count);
+    for(i32 i = 0; i < primitive_count; ++i)
+    {
+        primitive_order[i] = i;
+        centers[i] = primitive_bounds[i].get_center();
+    }
+
+    bvh_node_t root;
+    root.first = 0;
+    root.count = primitive_count;
+    nodes.push_back(root);
+    node_parents.push_back(INDEX_NONE);
+
+    struct build_task_t { i32 node; i32 depth; };
+    std::vector<build_task_t> stack;
+    stack.push_back({ 0, 0 });
+    while(!stack.empty())
+    {
+        build_task_t task = stack.back();
+        stack.pop_back();
+
+        i32 first = nodes[task.node].first;
+        i32 count = nodes[task.node].count;
+        aabb_t bounds = aabb_t::make_empty();
+        aabb_t center_bounds = aabb_t::make_empty();
+        for(i32 i = first; i < first + count; ++i)
+        {
+            bounds.grow(primitive_bounds[primitive_order[i]]);
+            center_bounds.grow(centers[primitive_order[i]]);
+        }
+        nodes[task.node].bounds = bounds;
+
+        // Find the cheapest split with the surface area heuristic, binning primitive centers along each axis
+        i32 best_axis = INDEX_NONE;
+        i32 best_split = 0;
+        float best_cost = (float) count * surface_area(bounds);
+        if(count > BVH_MAX_LEAF_SIZE && task.depth < BVH_MAX_DEPTH)
+        {
+            for(i32 axis = 0; axis < 3; ++axis)
+            {
+                float axis_min = center_bounds.min[axis];
+                float axis_extent = center_bounds.max[axis] - axis_min;
+                if(axis_extent <= 0.f)
+                {
+                    continue;
+                }
+                float bin_scale = (float) BVH_BIN_COUNT / axis_extent;
+
+                bvh_bin_t bins[BVH_BIN_COUNT];
+                for(i32 i = first; i < first + count; ++i)
+                {
+                    i32 bin = kc_min((i32) ((centers[primitive_order[i]][axis] - axis_min) * bin_scale), BVH_BIN_COUNT - 1);
+                    bins[bin].bounds.grow(primitive_bounds[primitive_order[i]]);
+                    ++bins[bin].count;
+                }
+
+                // Sweep from the right to get the cost of the right side of each split, then from the left
+                float right_areas[BVH_BIN_COUNT];
+                i32 right_counts[BVH_BIN_COUNT];
+                aabb_t right_bounds = aabb_t::make_empty();
+                i32 right_count = 0;
+                for(i32 bin = BVH_BIN_COUNT - 1; bin > 0; --bin)
+                {
+                    right_bounds.grow(bins[bin].bounds);
+                    right_count += bins[bin].count;
+                    right_areas[bin] = surface_area(right_bounds);
+                    right_counts[bin] = right_count;
+                }
+                aabb_t left_bounds = aabb_t::make_empty();
+                i32 left_count = 0;
+                for(i32 split = 1; split < BVH_BIN_COUNT; ++split)
+                {
+                    left_bounds.grow(bins[split - 1].bounds);
+                    left_count += bins[split - 1].count;
+                    if(left_count == 0 || right_counts[split] == 0)
+                    {
+                        continue;
+                    }
+                    float cost = (float) left_count * surface_area(left_bounds) + (float) right_counts[split] * right_areas[split];
+                    if(cost < best_cost)
+                    {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_split = split;
+                    }
+                }
+            }
+        }
+
+        i32 middle;
+        if(best_axis != INDEX_NONE)
+        {
+            float axis_min = center_bounds.min[best_axis];
+            float bin_scale = (float) BVH_BIN_COUNT / (center_bounds.max[best_axis] - axis_min);
+            i32* split_point = std::partition(&primitive_order[first], &primitive_order[first] + count, [&](i32 primitive) {
+                i32 bin = kc_min((i32) ((centers[primitive][best_axis] - axis_min) * bin_scale), BVH_BIN_COUNT - 1);
+                return bin < best_split;
+            });
+            middle = (i32) (split_point - &primitive_order[0]);
+        }
+        else if(count > BVH_MAX_LEAF_SIZE * 4 && task.depth < BVH_MAX_DEPTH)
+        {
+            // Splitting doesn't pay off by the heuristic (e.g. every center is in the same spot), but don't make huge leaves
+            middle = first + count / 2;
+        }
+        else
+        {
+            for(i32 i = first; i < first + count; ++i)
+            {
+                primitive_leaves[primitive_order[i]] = task.node;
+            }
+            continue;
+        }
+
+        i32 left_child = (i32) nodes.size();
+        bvh_node_t left;
+        left.first = first;
+        left.count = middle - first;
+        bvh_node_t right;
+        right.first = middle;
+        right.count = first + count - middle;
+        nodes.push_back(left);
+        nodes.push_back(right);
+        node_parents.push_back(task.node);
+        node_parents.push_back(task.node);
+        nodes[task.node].first = left_child;
+        nodes[task.node].count = 0;
+        stack.push_back({ left_child + 1, task.depth + 1 });
+        stack.push_back({ left_child, task.depth + 1 });
+    }
+}
+
+void bvh_t::refit_primitive(i32 primitive, const aabb_t& new_bounds)
+{
+    primitive_bounds[primitive] = new_bounds;
+
+    i32 node_index = primitive_leaves[primitive];
+    bvh_node_t& leaf = nodes[node_index];
+    aabb_t leaf_bounds = aabb_t::make_empty();
+    for(i32 i = leaf.first; i < leaf.first + leaf.count; ++i)
+    {
+        leaf_bounds.grow(primitive_bounds[primitive_order[i]]);
+    }
+    leaf.bounds = leaf_bounds;
+
+    // Walk up until a node's bounds don't change
+    for(node_index = node_parents[node_index]; node_index != INDEX_NONE; node_index = node_parents[node_index])
+    {
+        bvh_node_t& node = nodes[node_index];
+        aabb_t bounds = nodes[node.first].bounds;
+        bounds.grow(nodes[node.first + 1].bounds);
+        if(bounds.min.x == node.bounds.min.x && bounds.min.y == node.bounds.min.y && bounds.min.z == node.bounds.min.z
+           && bounds.max.x == node.bounds.max.x && bounds.max.y == node.bounds.max.y && bounds.max.z == node.bounds.max.z)
+        {
+            break;
+        }
+        node.bounds = bounds;
+    }
+}
+
+void bvh_t::set_primitive_bounds(i32 primitive, const aabb_t& new_bounds)
+{
+    primitive_bounds[primitive] = new_bounds;
+}
+
+void bvh_t::refit()
+{
+    for(i32 node_index = (i32) nodes.size() - 1; node_index >= 0; --node_index)
+    {
+        bvh_node_t& node = nodes[node_index];
+        aabb_t bounds = aabb_t::make_empty();
+        if(node.count > 0)
+        {
+            for(i32 i = node.first; i < node.first + node.count; ++i)
+            {
+                bounds.grow(primitive_bounds[primitive_order[i]]);
+            }
+        }
+        else
+        {
+            bounds.grow(nodes[node.first].bounds);
+            bounds.grow(nodes[node.first + 1].bounds);
+        }
+        node.bounds = bounds;
+    }
+}
+
+void bvh_t::add_subtree(i32 node_index, std::vector<i32>& out_primitives) const
+{
+    // Leaves of a subtree don't cover a contiguous range of primitive_order in general, so walk it
+    i32 stack[BVH_MAX_DEPTH + 2];
+    i32 stack_size = 0;
+    stack[stack_size++] = node_index;
+    while(stack_size > 0)
+    {
+        const bvh_node_t& node = nodes[stack[--stack_size]];
+        if(node.count > 0)
+        {
+            out_primitives.insert(out_primitives.end(), primitive_order.begin() + node.first, primitive_order.begin() + node.first + node.count);
+        }
+        else
+        {
+            stack[stack_size++] = node.first + 1;
+            stack[stack_size++] = node.first;
+        }
+    }
+}
+
+void bvh_t::query_cull_view(const cull_view_t& view, std::vector<i32>& out_primitives) const
+{
+    if(nodes.empty())
+    {
+        return;
+    }
+
+    i32 stack[BVH_MAX_DEPTH + 2];
+    i32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while(stack_size > 0)
+    {
+        i32 node_index = stack[--stack_size];
+        const bvh_node_t& node = nodes[node_index];
+        if(!view.get_visibility_mask(node.bounds))
+        {
+            continue;
+        }
+        if(node.count > 0)
+        {
+            for(i32 i = node.first; i < node.first + node.count; ++i)
+            {
+                if(view.get_visibility_mask(primitive_bounds[primitive_order[i]]))
+                {
+                    out_primitives.push_back(primitive_order[i]);
+                }
+            }
+        }
+        else if(view.contains(node.bounds))
+        {
+            add_subtree(node_index, out_primitives);
+        }
+        else
+        {
+            stack[stack_size++] = node.first + 1;
+            stack[stack_size++] = node.first;
+        }
+    }
+}
+
+void bvh_t::query_sphere(vec3 center, float radius, std::vector<i32>& out_primitives) const
+{
+    if(nodes.empty())
+    {
+        return;
+    }
+
+    i32 stack[BVH_MAX_DEPTH + 2];
+    i32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while(stack_size > 0)
+    {
+        const bvh_node_t& node = nodes[stack[--stack_size]];
+        if(!sphere_intersects_aabb(center, radius, node.bounds))
+        {
+            continue;
+        }
+        if(node.count > 0)
+        {
+            for(i32 i = node.first; i < node.first + node.count; ++i)
+            {
+                if(sphere_intersects_aabb(center, radius, primitive_bounds[primitive_order[i]]))
+                {
+                    out_primitives.push_back(primitive_order[i]);
+                }
+            }
+        }
+        else
+        {
+            stack[stack_size++] = node.first + 1;
+            stack[stack_size++] = node.first;
+        }
+    }
+}
+
+i32 bvh_t::raycast(vec3 origin, vec3 direction, float max_distance, float* out_distance) const
+{
+    if(nodes.empty())
+    {
+        return INDEX_NONE;
+    }
+
+    vec3 direction_inverse;
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        float component = direction[axis];
+        direction_inverse[axis] = 1.f / (kc_abs(component) > 1e-20f ? component : 1e-20f);
+    }
+
+    i32 hit_primitive = INDEX_NONE;
+    float closest = max_distance;
+    float distance;
+    i32 stack[BVH_MAX_DEPTH + 2];
+    i32 stack_size = 0;
+    stack[stack_size++] = 0;
+    while(stack_size > 0)
+    {
+        const bvh_node_t& node = nodes[stack[--stack_size]];
+        if(!ray_intersects_aabb(origin, direction_inverse, closest, node.bounds, &distance))
+        {
+            continue;
+        }
+        if(node.count > 0)
+        {
+            for(i32 i = node.first; i < node.first + node.count; ++i)
+            {
+                if(ray_intersects_aabb(origin, direction_inverse, closest, primitive_bounds[primitive_order[i]], &distance))
+                {
+                    closest = distance;
+                    hit_primitive = primitive_order[i];
+                }
+            }
+        }
+        else
+        {
+            // Visit the nearer child first so the far one is more likely to be pruned
+            float left_distance = 0.f;
+            float right_distance = 0.f;
+            bool b_left = ray_intersects_aabb(origin, direction_inverse, closest, nodes[node.first].bounds, &left_distance);
+            bool b_right = ray_intersects_aabb(origin, direction_inverse, closest, nodes[node.first + 1].bounds, &right_distance);
+            if(b_left && b_right)
+            {
+                bool b_left_first = left_distance <= right_distance;
+                stack[stack_size++] = b_left_first ? node.first + 1 : node.first;
+                stack[stack_size++] = b_left_first ? node.first : node.first + 1;
+            }
+            else if(b_left)
+            {
+                stack[stack_size++] = node.first;
+            }
+            else if(b_right)
+            {
+                stack[stack_size++] = node.first + 1;
+            }
+        }
+    }
+
+    if(hit_primitive != INDEX_NONE)
+    {
+        *out_distance = closest;
+    }
+    return hit_primitive;
+}
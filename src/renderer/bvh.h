@@ -0,0 +1,59 @@
+#pragma once
+
+#include <vector>
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+#include "frustum.h"
+
+struct bvh_node_t
+{
+    aabb_t bounds;
+    /** Leaf: index of the node's first entry in primitive_order. Internal: index of the left child
+        (the right child is always first + 1). */
+    i32 first = 0;
+    /** Number of primitives if leaf, 0 if internal */
+    i32 count = 0;
+};
+
+/** Bounding volume hierarchy over a set of AABB primitives (e.g. the bounds of scene objects)
+
+    Built top-down with a binned surface area heuristic. Children are always stored after their
+    parent, so refitting is a single reverse sweep over the nodes. When primitives move, the tree
+    is refit instead of rebuilt: its topology stays the same and only bounds change. That's fine for
+    objects that move a little, but quality degrades if they move a lot, so rebuild occasionally.
+
+    Primitives are referred to by their index in the array given to build.
+*/
+struct bvh_t
+{
+    void build(const aabb_t* primitive_bounds, i32 primitive_count);
+
+    /** Sets the bounds of one primitive and refits the nodes above it */
+    void refit_primitive(i32 primitive, const aabb_t& new_bounds);
+    /** Sets the bounds of one primitive without refitting. Call refit after changing many primitives. */
+    void set_primitive_bounds(i32 primitive, const aabb_t& new_bounds);
+    /** Recalculates every node's bounds from its children */
+    void refit();
+
+    /** Appends every primitive whose bounds are visible in view to out_primitives */
+    void query_cull_view(const cull_view_t& view, std::vector<i32>& out_primitives) const;
+    /** Appends every primitive whose bounds overlap the sphere to out_primitives */
+    void query_sphere(vec3 center, float radius, std::vector<i32>& out_primitives) const;
+    /** Returns the primitive whose bounds the ray enters first (within max_distance), INDEX_NONE if the ray hits nothing */
+    i32 raycast(vec3 origin, vec3 direction, float max_distance, float* out_distance) const;
+
+    i32 get_primitive_count() const { return (i32) primitive_bounds.size(); }
+    i32 get_node_count() const { return (i32) nodes.size(); }
+    const aabb_t& get_primitive_bounds(i32 primitive) const { return primitive_bounds[primitive]; }
+
+private:
+    std::vector<bvh_node_t> nodes;
+    std::vector<i32>        node_parents;
+    /** Leaves refer to ranges of this */
+    std::vector<i32>        primitive_order;
+    std::vector<aabb_t>     primitive_bounds;
+    /** Leaf node containing each primitive */
+    std::vector<i32>        primitive_leaves;
+
+    void add_subtree(i32 node_index, std::vector<i32>& out_primitives) const;
+};
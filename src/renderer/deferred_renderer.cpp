@@ -1,11 +1,18 @@
 #include <GL/glew.h>
+#include <algorithm>
+#include <cstring>
 
 #include "deferred_renderer.h"
 #include "../game/game_state.h"
 #include "../debugging/console.h"
 #include "../debugging/profiling/profiler.h"
 #include "../debugging/debug_drawer.h"
+#include "frustum.h"
+#include "render_queue.h"
+#include "stream_buffer.h"
+#include "gl_state.h"
 #include "../core/input.h"
+#include "../core/timer.h"
 #include "../game_statics.h"
 #include <stb_sprintf.h>
 
@@ -14,6 +21,9 @@ static const char* deferred_geometry_fs_path = "shaders/deferred/deferred_geomet
 static const char* deferred_tiled_cs_path = "shaders/deferred/tiled_deferred_lighting.comp";
 static const char* deferred_final_vs_path = "shaders/deferred/deferred_final.vert";
 static const char* deferred_final_fs_path = "shaders/deferred/deferred_final.frag";
+static const char* gpu_instance_culling_cs_path = "shaders/culling/gpu_instance_culling.comp";
+static const char* hi_z_downsample_cs_path = "shaders/culling/hi_z_downsample.comp";
+static const char* light_clustering_cs_path = "shaders/deferred/light_clustering.comp";
 
 static const char* ui_vs_path = "shaders/ui.vert";
 static const char* ui_fs_path = "shaders/ui.frag";
@@ -25,6 +35,168 @@ static const char* simple_fs_path = "shaders/simple.frag";
 // Temporary
 bool g_b_wireframe = false;
 
+/** Connects the frame_constants and pass_constants blocks of a program (if it declares them) to their binding points */
+INTERNAL void gl_bind_constant_blocks(const shader_t& shader)
+{
+    shader.gl_bind_uniform_block("frame_constants", FRAME_CONSTANTS_UBO_BINDING);
+    shader.gl_bind_uniform_block("pass_constants", PASS_CONSTANTS_UBO_BINDING);
+}
+
+/** Layers of a shadow map texture: cube faces, cascades, or 1 for GL_TEXTURE_2D */
+INTERNAL i32 get_shadow_map_layer_count(GLenum target)
+{
+    switch(target)
+    {
+        case GL_TEXTURE_CUBE_MAP: return 6;
+        case GL_TEXTURE_2D_ARRAY: return SHADOW_CASCADE_COUNT;
+        default: return 1;
+    }
+}
+
+/** Creates a depth texture (GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY of the cascades, or GL_TEXTURE_CUBE_MAP) and a
+    framebuffer that draws only into it, all layers attached */
+INTERNAL void gl_create_shadow_depth_texture(GLenum target, i32 width, i32 height, u32& texture, u32& framebuffer,
+                                             GLenum internal_format = GL_DEPTH_COMPONENT)
+{
+    glGenFramebuffers(1, &framebuffer);
+
+    glGenTextures(1, &texture);
+    gl_state_bind_texture(0, target, texture);
+    if(target == GL_TEXTURE_CUBE_MAP)
+    {
+        for (unsigned int i = 0; i < 6; ++i)
+        {
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internal_format,
+                         width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    }
+    else
+    {
+        if(target == GL_TEXTURE_2D_ARRAY)
+        {
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, width, height, get_shadow_map_layer_count(target),
+                         0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        }
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        float smap_bordercolor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(target, GL_TEXTURE_BORDER_COLOR, smap_bordercolor);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    }
+
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/** Position (xyz) and far plane (w) of a light's shadow */
+INTERNAL vec4 get_light_shadow_sphere(const point_light_t& light)
+{
+    return make_vec4(light.position.x, light.position.y, light.position.z, light.get_radius());
+}
+
+/** Direction (xyz) and cosine cutoff (w) of a spotlight, all 0 for a point light */
+INTERNAL vec4 get_light_shadow_spotlight(const point_light_t& light)
+{
+    if(!light.is_b_spotlight())
+    {
+        return make_vec4(0.f, 0.f, 0.f, 0.f);
+    }
+    vec3 direction = normalize(light.get_direction());
+    return make_vec4(direction.x, direction.y, direction.z, light.cosine_cutoff());
+}
+
+/** Makes the view projections of the six cube faces for a light at light_sphere's xyz with its far plane at w, or
+    the one of its cone if spotlight (see get_light_shadow_spotlight) isn't all 0 */
+INTERNAL void set_omni_shadow_transforms(omni_shadow_map_t& shadow_map, vec4 light_sphere, vec4 spotlight)
+{
+    float nearPlane = 1.0f;
+    vec3 lightPos = make_vec3(light_sphere.x, light_sphere.y, light_sphere.z);
+    shadow_map.shadowTransforms.clear();
+    if(spotlight.x != 0.f || spotlight.y != 0.f || spotlight.z != 0.f)
+    {
+        // A bit wider than the cone so filtering at its edge stays in the tile. Cones too wide for one projection
+        // are only shadowed in the middle.
+        float fov = kc_min(2.2f * acosf(kc_clamp(spotlight.w, -1.f, 1.f)), 170.f * KC_DEG2RAD);
+        vec3 direction = make_vec3(spotlight.x, spotlight.y, spotlight.z);
+        vec3 up = fabsf(direction.y) > 0.99f ? make_vec3(0.f, 0.f, 1.f) : make_vec3(0.f, 1.f, 0.f);
+        shadow_map.shadowTransforms.push_back(projection_matrix_perspective(fov, 1.f, nearPlane, light_sphere.w)
+                                              * view_matrix_look_at(lightPos, lightPos + direction, up));
+    }
+    else
+    {
+        mat4 shadowProj = projection_matrix_perspective(90.f * KC_DEG2RAD, 1.f, nearPlane, light_sphere.w);
+        shadow_map.shadowTransforms.push_back(
+                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_FORWARD_VECTOR, WORLD_DOWN_VECTOR));
+        shadow_map.shadowTransforms.push_back(
+                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_BACKWARD_VECTOR, WORLD_DOWN_VECTOR));
+        shadow_map.shadowTransforms.push_back(
+                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_UP_VECTOR, WORLD_RIGHT_VECTOR));
+        shadow_map.shadowTransforms.push_back(
+                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_DOWN_VECTOR, WORLD_LEFT_VECTOR));
+        shadow_map.shadowTransforms.push_back(
+                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_RIGHT_VECTOR, WORLD_DOWN_VECTOR));
+        shadow_map.shadowTransforms.push_back(
+                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_LEFT_VECTOR, WORLD_DOWN_VECTOR));
+    }
+    shadow_map.shadowTransformsLightSphere = light_sphere;
+    shadow_map.shadowTransformsSpotlight = spotlight;
+}
+
+/** Points viewport and scissor box i at the light's tile i, where omni_shadow_map.geom sends face i. With b_clear,
+    clears the tiles of the bound framebuffer first. */
+INTERNAL void gl_set_shadow_atlas_viewports(const vec2i* tile_corners, i32 tile_size, i32 view_count, bool b_clear)
+{
+    if(b_clear)
+    {
+        // glClear only uses scissor box 0 but glScissor sets every box, so clear all the tiles first
+        for(i32 view = 0; view < view_count; ++view)
+        {
+            vec2i corner = tile_corners[view];
+            glScissor(corner.x, corner.y, tile_size, tile_size);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+    }
+    for(i32 view = 0; view < view_count; ++view)
+    {
+        vec2i corner = tile_corners[view];
+        glViewportIndexedf(view, (float) corner.x, (float) corner.y, (float) tile_size, (float) tile_size);
+        glScissorIndexed(view, corner.x, corner.y, tile_size, tile_size);
+    }
+}
+
+/** Every other bit of a Z-order (Morton) index, i.e. its x coordinate; shift the index right by one for y */
+INTERNAL u32 z_order_compact_bits(u32 index)
+{
+    index &= 0x55555555;
+    index = (index | (index >> 1)) & 0x33333333;
+    index = (index | (index >> 2)) & 0x0f0f0f0f;
+    index = (index | (index >> 4)) & 0x00ff00ff;
+    index = (index | (index >> 8)) & 0x0000ffff;
+    return index;
+}
+
+INTERNAL std::string make_light_culling_defines(i32 max_lights_per_tile)
+{
+    char defines[256];
+    stbsp_snprintf(defines, sizeof(defines),
+                   "#define LIGHT_TILE_SIZE %d\n#define MAX_LIGHTS_PER_TILE %d\n#define CLUSTER_DEPTH_SLICES %d\n#define MAX_LIGHTS_PER_CLUSTER %d\n",
+                   LIGHT_TILE_SIZE, max_lights_per_tile, CLUSTER_DEPTH_SLICES, MAX_LIGHTS_PER_CLUSTER);
+    return std::string(defines);
+}
+
 void deferred_renderer::initialize()
 {
     // Initialize GLEW
@@ -35,10 +207,11 @@ void deferred_renderer::initialize()
         // todo return false;
     }
     console_printf("GLEW initialized.\n");
+    gl_state_invalidate();
 
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // alpha blending func: a * (rgb) + (1 - a) * (rgb) = final color output
     glBlendEquation(GL_FUNC_ADD);
-    glEnable(GL_CULL_FACE);
+    gl_state_set_enabled(GL_CULL_FACE, true);
 
     update_buffer_size(back_buffer_width, back_buffer_height);
     matrix_projection_ortho = projection_matrix_orthographic_2d(0.0f, (float)back_buffer_width, (float)back_buffer_height, 0.0f);
@@ -52,92 +225,538 @@ void deferred_renderer::initialize()
     skybox_faces_paths.push_back("data/textures/skyboxes/sky/skybox_nz.jpg");
     cubemap_t::gl_create_from_files(m_skybox_renderer.skybox_cubemap, skybox_faces_paths);
     m_skybox_renderer.init();
+
+    constants_stream.gl_create(CONSTANTS_STREAM_BYTES_PER_FRAME);
+
+    get_console().bind_cvar("frustum_culling", &b_frustum_culling);
+    get_console().bind_cvar("gpu_culling", &b_gpu_culling);
+    get_console().bind_cvar("occlusion_culling", &b_occlusion_culling);
+    get_console().bind_cvar("software_occlusion", &b_software_occlusion);
+    get_console().bind_cvar("software_occlusion_threads", &software_occlusion_threads);
+    get_console().bind_cvar("gbuffer_position_target", &b_gbuffer_position_target);
+    get_console().bind_cvar("gbuffer_compact_normals", &b_gbuffer_compact_normals);
+    get_console().bind_cvar("clustered_shading", &b_clustered_shading);
+    get_console().bind_cvar("tile_depth_culling", &tile_depth_culling);
+    get_console().bind_cvar("tile_light_capacity", &tile_light_capacity);
+    get_console().bind_cvar("stress_lights_animated", &stress_lights_animated);
+    get_console().bind_cvar("shadow_caching", &b_shadow_caching);
+    get_console().bind_cvar("shadow_distance", &shadow_distance);
+    get_console().bind_cvar("shadow_cascade_split", &shadow_cascade_split);
+    get_console().bind_cvar("shadow_resolution_scale", &shadow_resolution_scale);
+    get_console().bind_cmd("gbuffer_memory", [this](std::istream& is, std::ostream& os){
+        print_geometry_buffer_memory();
+    });
+    get_console().bind_cmd("tile_light_histogram", [this](std::istream& is, std::ostream& os){
+        b_tile_light_histogram_requested = true;
+    });
+    get_console().bind_cmd("stress_lights", [this](std::istream& is, std::ostream& os){
+        i32 count = 0;
+        float extent = 100.f;
+        i32 shadowed = 0;
+        is >> count >> extent >> shadowed;
+        generate_stress_lights(count, extent, shadowed);
+    });
 }
 
 void deferred_renderer::render()
 {
+    profiler_begin_frame();
+    stream_buffers_begin_frame();
+    update_shadow_map_transforms();
+    allocate_shadow_atlas_tiles();
+    gl_upload_frame_constants();
+
+    i64 shadow_maps_start = timer::get_ticks();
     render_pass_directional_shadow_map();
     render_pass_omnidirectional_shadow_map();
+    profiler_get_frame_stats().shadow_maps_ms = profiler_ms_since(shadow_maps_start);
     render_pass_main();
+
+    stream_buffers_end_frame();
 }
 
 void deferred_renderer::render_pass_directional_shadow_map()
 {
     shader_t::gl_use_shader(shader_directional_shadow_map);
 
-    shader_directional_shadow_map.gl_bind_matrix4fv("directionalLightTransform", 1, directional_shadow_map.directionalLightSpaceMatrix.ptr());
+    // All cascades in one go: each instance's face mask says which cascades' frusta it's in, and
+    // directional_shadow_map.geom draws it into those layers
+    pass_constants_t constants = {};
+    cull_view_t cull_view;
+    for(i32 cascade = 0; cascade < SHADOW_CASCADE_COUNT; ++cascade)
+    {
+        constants.light_matrices[cascade] = directional_shadow_map.cascadeLightSpaceMatrices[cascade];
+        cull_view.add_frustum(directional_shadow_map.cascadeLightSpaceMatrices[cascade]);
+    }
+    gl_upload_pass_constants(constants);
     glViewport(0, 0, directional_shadow_map.SHADOW_WIDTH, directional_shadow_map.SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, directional_shadow_map.directionalShadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
 
     //glCullFace(GL_FRONT);
 
-    render_scene(shader_directional_shadow_map);
+    render_shadow_map(directional_shadow_map.cache, directional_shadow_map.directionalShadowMapFBO,
+                      directional_shadow_map.directionalShadowMapTexture, GL_TEXTURE_2D_ARRAY,
+                      directional_shadow_map.SHADOW_WIDTH, directional_shadow_map.SHADOW_HEIGHT,
+                      shader_directional_shadow_map, directional_shadow_map.directionalLightPosition, cull_view,
+                      b_shadow_caching, false);
 
     //glCullFace(GL_BACK);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void deferred_renderer::render_pass_omnidirectional_shadow_map()
 {
+    profiler_frame_stats_t& stats = profiler_get_frame_stats();
     shader_t::gl_use_shader(shader_omni_shadow_map);
-    for(auto & omni_shadow_map : omni_shadow_maps)
+    gl_state_set_enabled(GL_SCISSOR_TEST, true);
+    for(u32 shadow_index = 0; shadow_index < omni_shadow_maps.size(); ++shadow_index)
+    {
+        omni_shadow_map_t& omni_shadow_map = omni_shadow_maps[shadow_index];
+        i32 view_count = (i32) omni_shadow_map.shadowTransforms.size();
+        i32 tile_size = omni_shadow_map.tile_size;
+
+        // What the lighting pass reads, zero sized tiles if the light got none
+        shadow_atlas_tile_t* tiles = &shadow_atlas_tiles[shadow_index * SHADOW_ATLAS_VIEWS_PER_LIGHT];
+        for(i32 view = 0; view < SHADOW_ATLAS_VIEWS_PER_LIGHT; ++view)
+        {
+            tiles[view] = {};
+            if(view < view_count && tile_size > 0)
+            {
+                vec2i corner = omni_shadow_map.tile_corners[view];
+                tiles[view].view_projection = omni_shadow_map.shadowTransforms[view];
+                tiles[view].atlas_rect = make_vec4((float) corner.x, (float) corner.y, (float) tile_size, (float) tile_size)
+                                         * (1.f / (float) SHADOW_ATLAS_SIZE);
+            }
+        }
+
+        // Other lights may have drawn over the tiles' old place, or over their new one last frame. The static
+        // depth only has to be drawn again when the static tiles move, moved atlas tiles are copied to again.
+        bool b_tiles_moved = tile_size != omni_shadow_map.drawn_tile_size
+                             || memcmp(omni_shadow_map.tile_corners, omni_shadow_map.drawn_tile_corners, sizeof(omni_shadow_map.tile_corners)) != 0;
+        bool b_static_tiles_moved = tile_size != omni_shadow_map.drawn_tile_size
+                                    || omni_shadow_map.b_static_tiles != omni_shadow_map.b_drawn_static_tiles
+                                    || memcmp(omni_shadow_map.static_tile_corners, omni_shadow_map.drawn_static_tile_corners,
+                                              sizeof(omni_shadow_map.static_tile_corners)) != 0;
+        omni_shadow_map.drawn_tile_size = tile_size;
+        memcpy(omni_shadow_map.drawn_tile_corners, omni_shadow_map.tile_corners, sizeof(omni_shadow_map.tile_corners));
+        omni_shadow_map.b_drawn_static_tiles = omni_shadow_map.b_static_tiles;
+        memcpy(omni_shadow_map.drawn_static_tile_corners, omni_shadow_map.static_tile_corners, sizeof(omni_shadow_map.static_tile_corners));
+        shadow_cache_t& cache = omni_shadow_map.cache;
+        if(tile_size == 0 || !omni_shadow_map.b_static_tiles || b_static_tiles_moved)
+        {
+            cache.b_valid = false;
+        }
+        if(tile_size == 0)
+        {
+            continue;
+        }
+
+        // The transforms were made for where the light is this frame, see update_shadow_map_transforms
+        vec4 light_sphere = omni_shadow_map.shadowTransformsLightSphere;
+        vec3 lightPos = make_vec3(light_sphere.x, light_sphere.y, light_sphere.z);
+        cull_view_t cull_view;
+        for(const mat4& view_transform : omni_shadow_map.shadowTransforms)
+        {
+            cull_view.add_frustum(view_transform);
+        }
+        cull_view.set_sphere(lightPos, light_sphere.w);
+
+        // Same as render_shadow_map, with the static depth in the light's tiles of shadow_atlas_static_texture
+        const point_light_t& light = gs->pointlights[omni_shadow_map.owning_light_index];
+        bool b_cached = b_shadow_caching && light.is_b_static() && omni_shadow_map.b_static_tiles;
+        bool b_prebaked = b_cached && light.is_b_prebaked_shadow();
+        bool b_stale = b_cached && (!cache.b_valid || (!b_prebaked && cache.static_objects_version != gs->get_static_objects_version()));
+        bool b_dynamic = b_cached && !b_prebaked && gs->has_dynamic_objects_in_view(cull_view);
+        if(b_cached && !b_stale && !b_dynamic && !cache.b_map_has_dynamic && !b_tiles_moved)
+        {
+            // The tiles still hold the static depth and nothing else
+            ++stats.shadow_maps_reused;
+            continue;
+        }
+
+        pass_constants_t constants = {};
+        for(i32 view = 0; view < view_count; ++view)
+        {
+            constants.light_matrices[view] = omni_shadow_map.shadowTransforms[view];
+        }
+        constants.light_position = light_sphere;
+        gl_upload_pass_constants(constants);
+
+        if(!b_cached)
+        {
+            cache.b_valid = false;
+            gl_state_bind_framebuffer(GL_FRAMEBUFFER, shadow_atlas_FBO);
+            gl_set_shadow_atlas_viewports(omni_shadow_map.tile_corners, tile_size, view_count, true);
+            render_scene(shader_omni_shadow_map, lightPos, &cull_view);
+            ++stats.shadow_maps_drawn;
+            continue;
+        }
+
+        if(b_stale)
+        {
+            if(shadow_atlas_static_texture == 0)
+            {
+                gl_create_shadow_depth_texture(GL_TEXTURE_2D, SHADOW_ATLAS_STATIC_SIZE, SHADOW_ATLAS_STATIC_SIZE, shadow_atlas_static_texture,
+                                               shadow_atlas_static_FBO, GL_DEPTH_COMPONENT16);
+            }
+            gl_state_bind_framebuffer(GL_FRAMEBUFFER, shadow_atlas_static_FBO);
+            gl_set_shadow_atlas_viewports(omni_shadow_map.static_tile_corners, tile_size, view_count, true);
+            render_scene(shader_omni_shadow_map, lightPos, &cull_view, SCENE_OBJECTS_STATIC);
+            cache.static_objects_version = gs->get_static_objects_version();
+            cache.b_valid = true;
+            ++stats.shadow_maps_drawn;
+        }
+
+        // Start the tiles over from the static depth, then draw the dynamic casters over it
+        for(i32 view = 0; view < view_count; ++view)
+        {
+            vec2i static_corner = omni_shadow_map.static_tile_corners[view];
+            vec2i corner = omni_shadow_map.tile_corners[view];
+            glCopyImageSubData(shadow_atlas_static_texture, GL_TEXTURE_2D, 0, static_corner.x, static_corner.y, 0,
+                               shadow_atlas_texture, GL_TEXTURE_2D, 0, corner.x, corner.y, 0,
+                               tile_size, tile_size, 1);
+        }
+        cache.b_map_has_dynamic = b_dynamic;
+        if(b_dynamic)
+        {
+            gl_state_bind_framebuffer(GL_FRAMEBUFFER, shadow_atlas_FBO);
+            gl_set_shadow_atlas_viewports(omni_shadow_map.tile_corners, tile_size, view_count, false);
+            render_scene(shader_omni_shadow_map, lightPos, &cull_view, SCENE_OBJECTS_DYNAMIC);
+        }
+    }
+    gl_state_set_enabled(GL_SCISSOR_TEST, false);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void deferred_renderer::allocate_shadow_atlas_tiles()
+{
+    const camera_t& camera = gs->m_camera;
+    frustum_t view_frustum = make_frustum(camera.matrix_perspective * camera.matrix_view);
+    // Pixels a unit long thing covers a unit away from the camera
+    float pixels_per_unit = 0.5f * (float) back_buffer_height * camera.matrix_perspective[1][1];
+    float resolution_scale = kc_max(shadow_resolution_scale, 0.f);
+
+    shadow_atlas_order.clear();
+    u64 atlas_area = 0;
+    for(u32 shadow_index = 0; shadow_index < omni_shadow_maps.size(); ++shadow_index)
     {
-        glViewport(0, 0, omni_shadow_map.CUBE_SHADOW_WIDTH, omni_shadow_map.CUBE_SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, omni_shadow_map.depthCubeMapFBO);
+        omni_shadow_map_t& omni_shadow_map = omni_shadow_maps[shadow_index];
+        omni_shadow_map.importance = 0.f;
+        omni_shadow_map.tile_size = 0;
+
+        // A light whose volume is out of view lights nothing on screen, and needs no shadow
+        vec4 light_sphere = omni_shadow_map.shadowTransformsLightSphere;
+        vec3 light_position = make_vec3(light_sphere.x, light_sphere.y, light_sphere.z);
+        aabb_t light_bounds;
+        light_bounds.min = light_position - make_vec3(light_sphere.w, light_sphere.w, light_sphere.w);
+        light_bounds.max = light_position + make_vec3(light_sphere.w, light_sphere.w, light_sphere.w);
+        if(omni_shadow_map.shadowTransforms.empty() || light_sphere.w <= 0.f || !frustum_intersects_aabb(view_frustum, light_bounds))
+        {
+            continue;
+        }
+
+        // Radius on screen in pixels, which stops growing once the camera is inside the light
+        float distance = kc_max(magnitude(light_position - camera.position), light_sphere.w);
+        omni_shadow_map.importance = pixels_per_unit * light_sphere.w / distance;
+        i32 tile_size = SHADOW_ATLAS_MIN_TILE_SIZE;
+        while(tile_size < SHADOW_ATLAS_MAX_TILE_SIZE && (float) (tile_size * 2) <= omni_shadow_map.importance * resolution_scale)
+        {
+            tile_size *= 2;
+        }
+        omni_shadow_map.tile_size = tile_size;
+        atlas_area += (u64) omni_shadow_map.shadowTransforms.size() * tile_size * tile_size;
+        shadow_atlas_order.push_back(shadow_index);
+    }
+
+    // Over budget: halve the tiles of every light, least important first, until they fit. Once all of them are
+    // as small as they get, the least important lights go without.
+    std::sort(shadow_atlas_order.begin(), shadow_atlas_order.end(), [this](u32 a, u32 b){
+        return omni_shadow_maps[a].importance > omni_shadow_maps[b].importance;
+    });
+    const u64 atlas_capacity = (u64) SHADOW_ATLAS_SIZE * SHADOW_ATLAS_SIZE;
+    bool b_shrunk = true;
+    while(atlas_area > atlas_capacity && b_shrunk)
+    {
+        b_shrunk = false;
+        for(auto it = shadow_atlas_order.rbegin(); it != shadow_atlas_order.rend() && atlas_area > atlas_capacity; ++it)
+        {
+            omni_shadow_map_t& omni_shadow_map = omni_shadow_maps[*it];
+            if(omni_shadow_map.tile_size > SHADOW_ATLAS_MIN_TILE_SIZE)
+            {
+                u64 tile_area = (u64) omni_shadow_map.tile_size * omni_shadow_map.tile_size;
+                atlas_area -= (u64) omni_shadow_map.shadowTransforms.size() * (tile_area - tile_area / 4);
+                omni_shadow_map.tile_size /= 2;
+                b_shrunk = true;
+            }
+        }
+    }
+    while(atlas_area > atlas_capacity)
+    {
+        omni_shadow_map_t& omni_shadow_map = omni_shadow_maps[shadow_atlas_order.back()];
+        atlas_area -= (u64) omni_shadow_map.shadowTransforms.size() * omni_shadow_map.tile_size * omni_shadow_map.tile_size;
+        omni_shadow_map.tile_size = 0;
+        shadow_atlas_order.pop_back();
+    }
+
+    // Pack the biggest tiles first, each at the next free cell along a Z-order curve over the atlas in
+    // SHADOW_ATLAS_MIN_TILE_SIZE cells. The sizes are powers of two, so every tile starts aligned to its own size
+    // and they fill the atlas without gaps. Lights with the same size stay in the same order, so tiles only move
+    // when a size changes.
+    std::sort(shadow_atlas_order.begin(), shadow_atlas_order.end(), [this](u32 a, u32 b){
+        i32 size_a = omni_shadow_maps[a].tile_size;
+        i32 size_b = omni_shadow_maps[b].tile_size;
+        return size_a != size_b ? size_a > size_b : a < b;
+    });
+    u32 cell = 0;
+    for(u32 shadow_index : shadow_atlas_order)
+    {
+        omni_shadow_map_t& omni_shadow_map = omni_shadow_maps[shadow_index];
+        u32 cells_per_side = (u32) (omni_shadow_map.tile_size / SHADOW_ATLAS_MIN_TILE_SIZE);
+        for(size_t view = 0; view < omni_shadow_map.shadowTransforms.size(); ++view)
+        {
+            omni_shadow_map.tile_corners[view].x = (i32) z_order_compact_bits(cell) * SHADOW_ATLAS_MIN_TILE_SIZE;
+            omni_shadow_map.tile_corners[view].y = (i32) z_order_compact_bits(cell >> 1) * SHADOW_ATLAS_MIN_TILE_SIZE;
+            cell += cells_per_side * cells_per_side;
+        }
+    }
+
+    // The cached lights' static tiles have their own, smaller budget: the most important ones get tiles of the
+    // same size in the static atlas, packed the same way. The others are drawn every frame as if uncached.
+    shadow_atlas_static_order.clear();
+    for(omni_shadow_map_t& omni_shadow_map : omni_shadow_maps)
+    {
+        omni_shadow_map.b_static_tiles = false;
+        for(vec2i& corner : omni_shadow_map.static_tile_corners)
+        {
+            corner = vec2i();
+        }
+    }
+    if(!b_shadow_caching)
+    {
+        return;
+    }
+    std::sort(shadow_atlas_order.begin(), shadow_atlas_order.end(), [this](u32 a, u32 b){
+        return omni_shadow_maps[a].importance > omni_shadow_maps[b].importance;
+    });
+    const u64 static_atlas_capacity = (u64) SHADOW_ATLAS_STATIC_SIZE * SHADOW_ATLAS_STATIC_SIZE;
+    u64 static_atlas_area = 0;
+    for(u32 shadow_index : shadow_atlas_order)
+    {
+        omni_shadow_map_t& omni_shadow_map = omni_shadow_maps[shadow_index];
+        u64 light_area = (u64) omni_shadow_map.shadowTransforms.size() * omni_shadow_map.tile_size * omni_shadow_map.tile_size;
+        if(gs->pointlights[omni_shadow_map.owning_light_index].is_b_static() && static_atlas_area + light_area <= static_atlas_capacity)
+        {
+            static_atlas_area += light_area;
+            shadow_atlas_static_order.push_back(shadow_index);
+        }
+    }
+    std::sort(shadow_atlas_static_order.begin(), shadow_atlas_static_order.end(), [this](u32 a, u32 b){
+        i32 size_a = omni_shadow_maps[a].tile_size;
+        i32 size_b = omni_shadow_maps[b].tile_size;
+        return size_a != size_b ? size_a > size_b : a < b;
+    });
+    cell = 0;
+    for(u32 shadow_index : shadow_atlas_static_order)
+    {
+        omni_shadow_map_t& omni_shadow_map = omni_shadow_maps[shadow_index];
+        u32 cells_per_side = (u32) (omni_shadow_map.tile_size / SHADOW_ATLAS_MIN_TILE_SIZE);
+        for(size_t view = 0; view < omni_shadow_map.shadowTransforms.size(); ++view)
+        {
+            omni_shadow_map.static_tile_corners[view].x = (i32) z_order_compact_bits(cell) * SHADOW_ATLAS_MIN_TILE_SIZE;
+            omni_shadow_map.static_tile_corners[view].y = (i32) z_order_compact_bits(cell >> 1) * SHADOW_ATLAS_MIN_TILE_SIZE;
+            cell += cells_per_side * cells_per_side;
+        }
+        omni_shadow_map.b_static_tiles = true;
+    }
+}
+
+void deferred_renderer::render_shadow_map(shadow_cache_t& cache, u32 map_FBO, u32 map_texture, GLenum target, i32 width, i32 height,
+                                          shader_t& shader, vec3 view_position, const cull_view_t& cull_view, bool b_cached, bool b_prebaked)
+{
+    profiler_frame_stats_t& stats = profiler_get_frame_stats();
+    if(!b_cached)
+    {
+        cache.b_valid = false;
+        gl_state_bind_framebuffer(GL_FRAMEBUFFER, map_FBO);
         glClear(GL_DEPTH_BUFFER_BIT);
+        render_scene(shader, view_position, &cull_view);
+        gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+        ++stats.shadow_maps_drawn;
+        return;
+    }
 
-        shader_omni_shadow_map.gl_bind_matrix4fv("lightMatrices[0]", 6, (float*) omni_shadow_map.shadowTransforms.data());
-        vec3 lightPos = omni_shadow_map.owning_light->position;
-        shader_omni_shadow_map.gl_bind_3f("lightPos", lightPos.x, lightPos.y, lightPos.z);
-        shader_omni_shadow_map.gl_bind_1f("farPlane", omni_shadow_map.get_far_plane());
+    bool b_stale = !cache.b_valid || (!b_prebaked && cache.static_objects_version != gs->get_static_objects_version());
+    bool b_dynamic = !b_prebaked && gs->has_dynamic_objects_in_view(cull_view);
+    if(!b_stale && !b_dynamic && !cache.b_map_has_dynamic)
+    {
+        // The map still holds the static depth and nothing else
+        ++stats.shadow_maps_reused;
+        return;
+    }
 
-        render_scene(shader_omni_shadow_map);
+    if(b_stale)
+    {
+        if(cache.static_depth_texture == 0)
+        {
+            gl_create_shadow_depth_texture(target, width, height, cache.static_depth_texture, cache.static_depth_FBO);
+        }
+        gl_state_bind_framebuffer(GL_FRAMEBUFFER, cache.static_depth_FBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        render_scene(shader, view_position, &cull_view, SCENE_OBJECTS_STATIC);
+        cache.static_objects_version = gs->get_static_objects_version();
+        cache.b_valid = true;
+        ++stats.shadow_maps_drawn;
+    }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Start the map over from the static depth (all faces or cascades at once), then draw the dynamic casters
+    // over it with the depth test, which keeps whichever caster is closer to the light
+    glCopyImageSubData(cache.static_depth_texture, target, 0, 0, 0, 0,
+                       map_texture, target, 0, 0, 0, 0,
+                       width, height, get_shadow_map_layer_count(target));
+    cache.b_map_has_dynamic = b_dynamic;
+    if(b_dynamic)
+    {
+        gl_state_bind_framebuffer(GL_FRAMEBUFFER, map_FBO);
+        render_scene(shader, view_position, &cull_view, SCENE_OBJECTS_DYNAMIC);
+        gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
     }
 }
 
-void deferred_renderer::render_pass_main()
+void deferred_renderer::update_shadow_map_transforms()
 {
-    camera_t& camera = gs->m_camera;
+    const camera_t& camera = gs->m_camera;
+    vec3 light_direction = normalize(orientation_to_direction(gs->directionallight.orientation));
+    vec3 light_up = fabsf(light_direction.y) > 0.99f ? make_vec3(0.f, 0.f, 1.f) : make_vec3(0.f, 1.f, 0.f);
+    float near_clip = camera.nearclip;
+    float far_clip = kc_clamp(shadow_distance, near_clip + 1.f, camera.farclip);
+    float split = kc_clamp(shadow_cascade_split, 0.f, 1.f);
+    // The projection matrix holds 1 / tan(fovy/2) and 1 / (aspect * tan(fovy/2)), see game_state::pick_object
+    float right_per_depth = 1.f / camera.matrix_perspective[0][0];
+    float up_per_depth = 1.f / camera.matrix_perspective[1][1];
+    float half_resolution = 0.5f * (float) directional_shadow_map.SHADOW_WIDTH;
+
+    float cascade_near = near_clip;
+    for(i32 cascade = 0; cascade < SHADOW_CASCADE_COUNT; ++cascade)
+    {
+        // Blend of logarithmic splits (the same texels per pixel in every cascade) and uniform ones (which keep the
+        // first cascades from getting tiny)
+        float fraction = (float) (cascade + 1) / (float) SHADOW_CASCADE_COUNT;
+        float log_split = near_clip * powf(far_clip / near_clip, fraction);
+        float uniform_split = near_clip + (far_clip - near_clip) * fraction;
+        float cascade_far = split * log_split + (1.f - split) * uniform_split;
+
+        // Fit the cascade to the bounding sphere of its slice of the view frustum. The sphere stays the same size
+        // when the camera turns, so the texels do too, and snapping them to the world below keeps the shadow edges
+        // from crawling as the camera moves.
+        vec3 corners[8];
+        vec3 center = make_vec3(0.f, 0.f, 0.f);
+        for(i32 corner = 0; corner < 8; ++corner)
+        {
+            float depth = (corner & 4) ? cascade_far : cascade_near;
+            float right = (corner & 1) ? right_per_depth : -right_per_depth;
+            float up = (corner & 2) ? up_per_depth : -up_per_depth;
+            corners[corner] = camera.position + camera.calculated_direction * depth
+                              + camera.calculated_right * (right * depth) + camera.calculated_up * (up * depth);
+            center += corners[corner] * 0.125f;
+        }
+        float radius = 0.f;
+        for(const vec3& corner : corners)
+        {
+            radius = kc_max(radius, magnitude(corner - center));
+        }
+        radius = ceilf(radius * 16.f) / 16.f; // so rounding errors don't change the texel size from frame to frame
+
+        vec3 eye = center - light_direction * (radius + SHADOW_CASCADE_CASTER_DISTANCE);
+        mat4 light_space_matrix = projection_matrix_orthographic(-radius, radius, -radius, radius, 0.f, 2.f * radius + SHADOW_CASCADE_CASTER_DISTANCE)
+                                  * view_matrix_look_at(eye, center, light_up);
+        // Move the projection by less than a texel so the world origin, and with it everything else, lands on texel corners
+        vec4 origin = light_space_matrix * make_vec4(0.f, 0.f, 0.f, 1.f);
+        light_space_matrix[3].x += (roundf(origin.x * half_resolution) - origin.x * half_resolution) / half_resolution;
+        light_space_matrix[3].y += (roundf(origin.y * half_resolution) - origin.y * half_resolution) / half_resolution;
+
+        if(memcmp(&light_space_matrix, &directional_shadow_map.cascadeLightSpaceMatrices[cascade], sizeof(mat4)) != 0)
+        {
+            directional_shadow_map.cascadeLightSpaceMatrices[cascade] = light_space_matrix;
+            directional_shadow_map.cache.b_valid = false;
+        }
+        directional_shadow_map.cascadeFarDepths[cascade] = cascade_far;
+        directional_shadow_map.directionalLightPosition = eye;
+        cascade_near = cascade_far;
+    }
+
+    for(omni_shadow_map_t& omni_shadow_map : omni_shadow_maps)
+    {
+        if(omni_shadow_map.owning_light_index >= gs->pointlights.size())
+        {
+            continue;
+        }
+        const point_light_t& light = gs->pointlights[omni_shadow_map.owning_light_index];
+        vec4 light_sphere = get_light_shadow_sphere(light);
+        vec4 spotlight = get_light_shadow_spotlight(light);
+        if(memcmp(&light_sphere, &omni_shadow_map.shadowTransformsLightSphere, sizeof(vec4)) != 0
+           || memcmp(&spotlight, &omni_shadow_map.shadowTransformsSpotlight, sizeof(vec4)) != 0)
+        {
+            set_omni_shadow_transforms(omni_shadow_map, light_sphere, spotlight);
+            omni_shadow_map.cache.b_valid = false;
+        }
+    }
+}
 
+void deferred_renderer::render_pass_main()
+{
     glViewport(0, 0, back_buffer_width, back_buffer_height);
     glClearColor(0.39f, 0.582f, 0.926f, 1.f);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // Clear opengl context's buffer
 
 // NOT ALPHA BLENDED
-    glDisable(GL_BLEND);
+    gl_state_set_enabled(GL_BLEND, false);
 // DEPTH TESTED
-    glEnable(GL_DEPTH_TEST);
+    gl_state_set_enabled(GL_DEPTH_TEST, true);
     // TODO Probably make frag color constant if in wireframe mode instead of using albedo and lighting
     if (g_b_wireframe) {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        gl_state_polygon_mode(GL_LINE);
     } else {
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        gl_state_polygon_mode(GL_FILL);
     }
 
-    camera.calculate_view_matrix();
+    profiler_frame_stats_t& stats = profiler_get_frame_stats();
 
     // 1. Geometry pass
+    i64 pass_start = timer::get_ticks();
     deferred_geometry_pass();
-    // 2. Compute shader pass - Light culling, shading, composition
+    stats.geometry_pass_ms = profiler_ms_since(pass_start);
+    // 2. Compute shader pass - Light culling (per cluster in its own pass if clustered), shading, composition
+    pass_start = timer::get_ticks();
+    animate_stress_lights();
+    gs->pointlights.gl_upload(POINT_LIGHTS_SSBO_BINDING);
+    stats.light_bytes_uploaded += gs->pointlights.get_uploaded_bytes();
+    stats.light_upload_calls += gs->pointlights.get_upload_calls();
+    stats.light_upload_ms = profiler_ms_since(pass_start);
+    if(b_tile_light_histogram_requested)
+    {
+        // Before the lighting pass below, which shades the frame again
+        b_tile_light_histogram_requested = false;
+        print_tile_light_histogram();
+    }
+    pass_start = timer::get_ticks();
+    if(b_clustered_shading)
+    {
+        light_clustering_pass();
+    }
     deferred_lighting_and_composition_pass();
     // 3. Render Deferred Composition to Screen Quad
     deferred_render_to_quad_pass();
+    stats.lighting_pass_ms = profiler_ms_since(pass_start);
 
     copy_depth_from_gbuffer_to_defaultbuffer();
 
-    m_skybox_renderer.render(camera);
+    m_skybox_renderer.render();
 
 // ALPHA BLENDED
-    glEnable(GL_BLEND);
-    debug_render(shader_simple, camera);
+    gl_state_set_enabled(GL_BLEND, true);
+    debug_render(shader_simple);
 
 // NOT DEPTH TESTED
-    glDisable(GL_DEPTH_TEST);
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    gl_state_set_enabled(GL_DEPTH_TEST, false);
+    gl_state_polygon_mode(GL_FILL);
 
 #if INTERNAL_BUILD
     if(game_statics::the_input->g_keystate[SDL_SCANCODE_F3])
@@ -162,109 +781,233 @@ void deferred_renderer::render_pass_main()
             mesh_t::gl_create_mesh(quad, quadvertices, quadindices, 16, 6, 2, 2, 0);
         }
         shader_t::gl_use_shader(shader_debug_dir_shadow_map);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, directional_shadow_map.directionalShadowMapTexture);
+        gl_state_bind_texture(0, GL_TEXTURE_2D_ARRAY, directional_shadow_map.directionalShadowMapTexture);
         quad.gl_render_mesh();
-        glUseProgram(0);
     }
 #endif
 
+    // Everything above should run without touching the heap, the UI below still builds strings
+    stats.render_allocations = profiler_allocations_this_frame();
+    pass_start = timer::get_ticks();
     profiler_render(&shader_ui, &shader_text);
     console_render(&shader_ui, &shader_text);
+    stats.ui_ms = profiler_ms_since(pass_start);
 
     // Enable depth test before swapping buffers
     // (NOTE: if we don't enable depth test before swap, the shadow map shows up as blank white texture on the quad.)
-    glEnable(GL_DEPTH_TEST);
+    gl_state_set_enabled(GL_DEPTH_TEST, true);
 }
 
 void deferred_renderer::deferred_geometry_pass()
 {
     camera_t& camera = gs->m_camera;
 
-    glBindFramebuffer(GL_FRAMEBUFFER, g_buffer_FBO);
+    if(b_gbuffer_position_target != (g_position_texture != 0)
+       || b_gbuffer_compact_normals != (g_normal_format == GL_RGB10_A2))
+    {
+        gl_set_geometry_buffer_layout(b_gbuffer_position_target, b_gbuffer_compact_normals);
+    }
+
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, g_buffer_FBO);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     shader_t::gl_use_shader(shader_deferred_geometry_pass);
 
-    shader_deferred_geometry_pass.gl_bind_matrix4fv("matrix_view", 1, camera.matrix_view.ptr());
-    shader_deferred_geometry_pass.gl_bind_matrix4fv("matrix_proj_perspective", 1, camera.matrix_perspective.ptr());
-    shader_deferred_geometry_pass.gl_bind_1i("texture_sampler_0", 1);
+    pass_constants_t constants = {};
+    constants.b_compact_normals = g_normal_format == GL_RGB10_A2;
+    gl_upload_pass_constants(constants);
 
-    render_scene(shader_deferred_geometry_pass);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    mat4 view_projection = camera.matrix_perspective * camera.matrix_view;
+    cull_view_t cull_view;
+    cull_view.add_frustum(view_projection);
+    if(b_gpu_culling && b_occlusion_culling)
+    {
+        render_scene_occlusion_culled(shader_deferred_geometry_pass, camera.position,
+                                      b_frustum_culling ? &cull_view : nullptr, view_projection);
+    }
+    else if(!b_gpu_culling && b_software_occlusion)
+    {
+        software_occlusion.set_thread_count(software_occlusion_threads);
+        software_occlusion.begin(view_projection);
+        gs->render_scene(&shader_deferred_geometry_pass, camera.position, b_frustum_culling ? &cull_view : nullptr,
+                         nullptr, &software_occlusion);
+    }
+    else
+    {
+        render_scene(shader_deferred_geometry_pass, camera.position, &cull_view);
+    }
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void deferred_renderer::deferred_lighting_and_composition_pass()
 {
-    camera_t& camera = gs->m_camera;
+    if(tile_light_capacity != loaded_tile_light_capacity)
+    {
+        shader_t::gl_delete_shader(shader_tiled_deferred_lighting);
+        gl_load_tiled_lighting_shader();
+    }
+
+    if(tile_light_spill_buffer == 0)
+    {
+        glGenBuffers(1, &tile_light_spill_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_light_spill_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (2 + TILE_LIGHT_SPILL_CAPACITY) * sizeof(u32), nullptr, GL_DYNAMIC_COPY);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_light_spill_buffer);
+    if(profiler_get_level() >= 2)
+    {
+        // Last frame's count, like the occlusion stats
+        u32 spill_stats[2] = { 0, 0 };
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(spill_stats), spill_stats);
+        profiler_get_frame_stats().light_tiles_spilled = spill_stats[1];
+    }
+    u32 zeros[2] = { 0, 0 };
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_LIGHT_SPILL_SSBO_BINDING, tile_light_spill_buffer);
 
     shader_t::gl_use_shader(shader_tiled_deferred_lighting);
-    glBindImageTexture(0, g_position_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
-    glBindImageTexture(1, g_normal_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+    if(g_position_texture)
+    {
+        glBindImageTexture(0, g_position_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+    }
+    if(g_normal_format == GL_RGB10_A2)
+    {
+        glBindImageTexture(4, g_normal_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGB10_A2);
+    }
+    else
+    {
+        glBindImageTexture(1, g_normal_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA16F);
+    }
     glBindImageTexture(2, g_albedo_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
     glBindImageTexture(3, deferred_composition_output_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
 
+    gl_state_bind_texture(2, GL_TEXTURE_2D, g_depth_texture);
+    gl_state_bind_texture(1, GL_TEXTURE_2D_ARRAY, directional_shadow_map.directionalShadowMapTexture);
+    gl_state_bind_texture(5, GL_TEXTURE_2D, shadow_atlas_texture);
+    if(!shadow_atlas_tiles.empty())
     {
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, directional_shadow_map.directionalShadowMapTexture);
-        shader_tiled_deferred_lighting.gl_bind_1i("directional_shadow_map", 1);
-        shader_tiled_deferred_lighting.gl_bind_matrix4fv("directional_light_transform", 1,
-                                                         directional_shadow_map.directionalLightSpaceMatrix.ptr());
+        u32 tiles_size = (u32) (shadow_atlas_tiles.size() * sizeof(shadow_atlas_tile_t));
+        u32 tiles_offset = shadow_atlas_tile_stream.push(shadow_atlas_tiles.data(), tiles_size, gl_get_storage_buffer_offset_alignment());
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, SHADOW_ATLAS_TILES_SSBO_BINDING, shadow_atlas_tile_stream.get_id(), tiles_offset, tiles_size);
     }
+
+    pass_constants_t constants = {};
+    constants.b_position_target = g_position_texture != 0;
+    constants.b_compact_normals = g_normal_format == GL_RGB10_A2;
+    constants.b_clustered = b_clustered_shading;
+    constants.tile_depth_culling = tile_depth_culling;
+    constants.b_light_histogram = b_tile_light_histogram;
+    gl_upload_pass_constants(constants);
+
+    u32 dispatch_width = (back_buffer_width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    u32 dispatch_height = (back_buffer_height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE;
+    glDispatchCompute(dispatch_width, dispatch_height, 1);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void deferred_renderer::generate_stress_lights(i32 count, float extent, i32 shadowed)
+{
+    light_manager_t& point_lights = gs->pointlights;
+    if(stress_light_first_index != STRESS_LIGHTS_NONE)
     {
-        i32 omni_shadow_count = (i32) omni_shadow_maps.size();
-        shader_tiled_deferred_lighting.gl_bind_1i("omni_shadow_count", omni_shadow_count);
-        for(i32 omni_shadow_index = 0; omni_shadow_index < omni_shadow_count; ++omni_shadow_index)
-        {
-            glActiveTexture(GL_TEXTURE5 + omni_shadow_index);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, omni_shadow_maps[omni_shadow_index].depthCubeMapTexture);
+        point_lights.resize(stress_light_first_index);
+    }
+    stress_light_first_index = count > 0 ? point_lights.size() : STRESS_LIGHTS_NONE;
+    point_lights.reserve(point_lights.size() + kc_max(count, 0));
 
-            char name_buffer[128] = {'\0'};
-            stbsp_snprintf(name_buffer, sizeof(name_buffer), "omni_shadows[%d].light_index", omni_shadow_index);
-            i32 plight_address_offset = (i32)(omni_shadow_maps[omni_shadow_index].owning_light - gs->pointlights.data());
-            shader_tiled_deferred_lighting.gl_bind_1i(name_buffer, plight_address_offset);
-            stbsp_snprintf(name_buffer, sizeof(name_buffer), "omni_shadows[%d].shadow_cube", omni_shadow_index);
-            shader_tiled_deferred_lighting.gl_bind_1i(name_buffer, 5 + omni_shadow_index);
-            stbsp_snprintf(name_buffer, sizeof(name_buffer), "omni_shadows[%d].far_plane", omni_shadow_index);
-            shader_tiled_deferred_lighting.gl_bind_1f(name_buffer, omni_shadow_maps[omni_shadow_index].get_far_plane());
+    vec3 center = gs->m_camera.position;
+    for(i32 i = 0; i < count; ++i)
+    {
+        point_light_t light;
+        light.colour = make_vec3((float) rand() / RAND_MAX, (float) rand() / RAND_MAX, (float) rand() / RAND_MAX);
+        light.diffuse_intensity = 0.8f;
+        light.position = center + make_vec3(((float) rand() / RAND_MAX * 2.f - 1.f) * extent,
+                                            ((float) rand() / RAND_MAX * 2.f - 1.f) * extent,
+                                            ((float) rand() / RAND_MAX * 2.f - 1.f) * extent);
+        light.set_b_cast_shadow(i < shadowed);
+        if(i < shadowed && (i & 1))
+        {
+            light.set_b_spotlight(true);
+            light.set_direction(WORLD_DOWN_VECTOR);
         }
+        point_lights.add(light);
     }
+    register_shadow_casting_lights();
+    console_printf("%d stress lights within %.1f of the camera (%d shadowed), %d point lights total\n", count, extent,
+                   kc_clamp(shadowed, 0, kc_max(count, 0)), (i32) point_lights.size());
+}
 
-    shader_tiled_deferred_lighting.gl_bind_3f("camera_pos", camera.position.x, camera.position.y, camera.position.z);
+void deferred_renderer::animate_stress_lights()
+{
+    if(stress_light_first_index == STRESS_LIGHTS_NONE || stress_lights_animated <= 0)
+    {
+        return;
+    }
+    stress_light_time += timer::delta_time;
+    u32 animated_end = kc_min(stress_light_first_index + (u32) stress_lights_animated, gs->pointlights.size());
+    for(u32 index = stress_light_first_index; index < animated_end; ++index)
     {
-        directional_light_t light = gs->directionallight;
-        shader_tiled_deferred_lighting.gl_bind_3f("directional_light.colour", light.colour.x, light.colour.y,
-                                                  light.colour.z);
-        shader_tiled_deferred_lighting.gl_bind_1f("directional_light.ambient_intensity", light.ambient_intensity);
-        shader_tiled_deferred_lighting.gl_bind_1f("directional_light.diffuse_intensity", light.diffuse_intensity);
-        vec3 direction = orientation_to_direction(light.orientation);
-        shader_tiled_deferred_lighting.gl_bind_3f("directional_light.direction", direction.x, direction.y, direction.z);
+        float phase = stress_light_time + (float) index;
+        gs->pointlights.edit(index).position += make_vec3(cosf(phase), 0.f, sinf(phase)) * (STRESS_LIGHT_SPEED * timer::delta_time);
     }
+}
 
-    std::vector<point_light_t> plights = gs->pointlights;
-    shader_tiled_deferred_lighting.gl_bind_1i("point_light_count", plights.size());
+void deferred_renderer::gl_load_tiled_lighting_shader()
+{
+    tile_light_capacity = kc_clamp(tile_light_capacity, MIN_TILE_LIGHT_CAPACITY, MAX_TILE_LIGHT_CAPACITY);
+    shader_t::gl_load_compute_shader_program_from_file(shader_tiled_deferred_lighting, deferred_tiled_cs_path,
+                                                       make_light_culling_defines(tile_light_capacity).c_str());
+    loaded_tile_light_capacity = tile_light_capacity;
 
-    local_persist u32 lightsBuffer = 0;
-    if (lightsBuffer == 0) {
-        glGenBuffers(1, &lightsBuffer);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, lightsBuffer);
+    gl_bind_constant_blocks(shader_tiled_deferred_lighting);
+    shader_t::gl_use_shader(shader_tiled_deferred_lighting);
+    shader_tiled_deferred_lighting.gl_bind_1i("g_depth", 2);
+    shader_tiled_deferred_lighting.gl_bind_1i("directional_shadow_map", 1);
+    shader_tiled_deferred_lighting.gl_bind_1i("shadow_atlas", 5);
+    shader_tiled_deferred_lighting.gl_bind_1i("tile_light_spill_capacity", TILE_LIGHT_SPILL_CAPACITY);
+    shader_tiled_deferred_lighting.gl_bind_1i("cluster_tile_size", CLUSTER_TILE_SIZE);
+}
 
-        // todo only update changed data? glBufferSubData
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightsBuffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, plights.size() * sizeof(point_light_t), plights.data(), GL_DYNAMIC_COPY);
-        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+void deferred_renderer::light_clustering_pass()
+{
+    i32 clusters_x = (back_buffer_width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+    i32 clusters_y = (back_buffer_height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+    i32 new_cluster_count = clusters_x * clusters_y * CLUSTER_DEPTH_SLICES;
+    if(cluster_light_grid_buffer == 0)
+    {
+        glGenBuffers(1, &cluster_light_grid_buffer);
+        glGenBuffers(1, &cluster_light_index_buffer);
     }
+    if(new_cluster_count != cluster_count)
+    {
+        // Enough room for every cluster to be full, after the u32 count of indices written and the spilled cluster count
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_light_grid_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, new_cluster_count * 2 * sizeof(u32), nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_light_index_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, (2 + new_cluster_count * MAX_LIGHTS_PER_CLUSTER) * sizeof(u32), nullptr, GL_DYNAMIC_COPY);
+        cluster_count = new_cluster_count;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_light_index_buffer);
+    if(profiler_get_level() >= 2)
+    {
+        // Last frame's count, like the tile spill stats
+        u32 cluster_stats[2] = { 0, 0 };
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(cluster_stats), cluster_stats);
+        profiler_get_frame_stats().light_clusters_spilled = cluster_stats[1];
+    }
+    u32 zeros[2] = { 0, 0 };
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_GRID_SSBO_BINDING, cluster_light_grid_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDICES_SSBO_BINDING, cluster_light_index_buffer);
 
-    shader_tiled_deferred_lighting.gl_bind_matrix4fv("projection_matrix", 1, camera.matrix_perspective.ptr());
-    shader_tiled_deferred_lighting.gl_bind_matrix4fv("view_matrix", 1, camera.matrix_view.ptr());
-    //shader_tiled_deferred_lighting.gl_bind_2f("camera_near_far", camera.nearclip, camera.farclip);
-
-    const u32 COMPUTE_SHADER_TILE_GROUP_DIM = 16;
-    u32 dispatch_width = (back_buffer_width + COMPUTE_SHADER_TILE_GROUP_DIM - 1) / COMPUTE_SHADER_TILE_GROUP_DIM;
-    u32 dispatch_height = (back_buffer_height + COMPUTE_SHADER_TILE_GROUP_DIM - 1) / COMPUTE_SHADER_TILE_GROUP_DIM;
-    glDispatchCompute(dispatch_width, dispatch_height, 1);
+    shader_t::gl_use_shader(shader_light_clustering);
+    shader_light_clustering.gl_bind_1i(cluster_light_index_capacity_uniform, cluster_count * MAX_LIGHTS_PER_CLUSTER);
+    glDispatchCompute(clusters_x, clusters_y, 1);
 
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 }
 
 void deferred_renderer::deferred_render_to_quad_pass()
@@ -272,8 +1015,7 @@ void deferred_renderer::deferred_render_to_quad_pass()
     shader_t::gl_use_shader(shader_deferred_render_to_quad_pass);
     {
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, deferred_composition_output_texture);
+        gl_state_bind_texture(0, GL_TEXTURE_2D, deferred_composition_output_texture);
 
         local_persist mesh_t quad;
         local_persist bool meshmade = false;
@@ -294,41 +1036,178 @@ void deferred_renderer::deferred_render_to_quad_pass()
         }
         quad.gl_render_mesh();
     }
-    glUseProgram(0);
 }
 
 void deferred_renderer::copy_depth_from_gbuffer_to_defaultbuffer() const
 {
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, g_buffer_FBO);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    gl_state_bind_framebuffer(GL_READ_FRAMEBUFFER, g_buffer_FBO);
+    gl_state_bind_framebuffer(GL_DRAW_FRAMEBUFFER, 0);
     glBlitFramebuffer(0, 0, back_buffer_width, back_buffer_height, 0, 0, back_buffer_width, back_buffer_height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
 }
 
-void deferred_renderer::render_scene(shader_t& shader) const
+void deferred_renderer::render_scene(shader_t& shader, vec3 view_position, const cull_view_t* cull_view, u32 objects)
 {
-    gs->render_scene(&shader);
+    const cull_view_t* active_cull_view = b_frustum_culling ? cull_view : nullptr;
+    if(b_gpu_culling)
+    {
+        gpu_cull_params_t gpu_cull;
+        gpu_cull.cull_shader = &shader_gpu_instance_culling;
+        gpu_cull.cull_uniforms = &gpu_cull_uniforms;
+        gpu_cull.cull_view = active_cull_view;
+        gs->render_scene(&shader, view_position, nullptr, &gpu_cull, nullptr, objects);
+    }
+    else
+    {
+        gs->render_scene(&shader, view_position, active_cull_view, nullptr, nullptr, objects);
+    }
 }
 
 void deferred_renderer::load_shaders()
 {
     shader_t::gl_load_shader_program_from_file(shader_deferred_geometry_pass, deferred_geometry_vs_path, deferred_geometry_fs_path);
-    shader_t::gl_load_compute_shader_program_from_file(shader_tiled_deferred_lighting, deferred_tiled_cs_path);
+    gl_load_tiled_lighting_shader();
+    shader_t::gl_load_compute_shader_program_from_file(shader_gpu_instance_culling, gpu_instance_culling_cs_path);
+    gpu_cull_uniforms = gl_get_gpu_cull_uniforms(shader_gpu_instance_culling);
+    shader_t::gl_load_compute_shader_program_from_file(shader_hi_z_downsample, hi_z_downsample_cs_path);
+    shader_t::gl_load_compute_shader_program_from_file(shader_light_clustering, light_clustering_cs_path,
+                                                       make_light_culling_defines(MAX_LIGHTS_PER_TILE).c_str());
     shader_t::gl_load_shader_program_from_file(shader_deferred_render_to_quad_pass, deferred_final_vs_path, deferred_final_fs_path);
 
-    shader_t::gl_load_shader_program_from_file(shader_directional_shadow_map, "shaders/shadow_mapping/directional_shadow_map.vert", "shaders/shadow_mapping/directional_shadow_map.frag");
+    shader_t::gl_load_shader_program_from_file(shader_directional_shadow_map, "shaders/shadow_mapping/directional_shadow_map.vert", "shaders/shadow_mapping/directional_shadow_map.geom", "shaders/shadow_mapping/directional_shadow_map.frag");
     shader_t::gl_load_shader_program_from_file(shader_omni_shadow_map, "shaders/shadow_mapping/omni_shadow_map.vert", "shaders/shadow_mapping/omni_shadow_map.geom", "shaders/shadow_mapping/omni_shadow_map.frag");
     shader_t::gl_load_shader_program_from_file(shader_debug_dir_shadow_map, "shaders/debug_directional_shadow_map.vert", "shaders/debug_directional_shadow_map.frag");
 
     shader_t::gl_load_shader_program_from_file(shader_text, text_vs_path, text_fs_path);
     shader_t::gl_load_shader_program_from_file(shader_ui, ui_vs_path, ui_fs_path);
     shader_t::gl_load_shader_program_from_file(shader_simple, simple_vs_path, simple_fs_path);
+
+    shader_t* const programs[] = {
+        &shader_deferred_geometry_pass, &shader_gpu_instance_culling, &shader_hi_z_downsample, &shader_light_clustering,
+        &shader_deferred_render_to_quad_pass, &shader_directional_shadow_map, &shader_omni_shadow_map,
+        &shader_debug_dir_shadow_map, &shader_text, &shader_ui, &shader_simple
+    };
+    for(shader_t* program : programs)
+    {
+        gl_bind_constant_blocks(*program);
+    }
+
+    // Uniforms that never change are set once here instead of every frame
+    shader_t::gl_use_shader(shader_light_clustering);
+    shader_light_clustering.gl_bind_1i("cluster_tile_size", CLUSTER_TILE_SIZE);
+    cluster_light_index_capacity_uniform = shader_light_clustering.get_uniform_handle("cluster_light_index_capacity");
+    shader_t::gl_use_shader(shader_deferred_geometry_pass);
+    GLint texture_units[MAX_DRAW_TEXTURES];
+    for(i32 unit = 0; unit < MAX_DRAW_TEXTURES; ++unit)
+    {
+        texture_units[unit] = unit;
+    }
+    shader_deferred_geometry_pass.gl_bind_1iv(shader_deferred_geometry_pass.get_uniform_handle("texture_samplers[0]"),
+                                              MAX_DRAW_TEXTURES, texture_units);
+    shader_t::gl_use_shader(shader_hi_z_downsample);
+    shader_hi_z_downsample.gl_bind_1i("source", 0);
+    hi_z_b_copy_uniform = shader_hi_z_downsample.get_uniform_handle("b_copy");
+    hi_z_source_level_uniform = shader_hi_z_downsample.get_uniform_handle("source_level");
+}
+
+void deferred_renderer::gl_upload_frame_constants()
+{
+    camera_t& camera = gs->m_camera;
+    camera.calculate_view_matrix();
+
+    frame_constants.matrix_view = camera.matrix_view;
+    frame_constants.matrix_proj_perspective = camera.matrix_perspective;
+    frame_constants.matrix_proj_orthographic = matrix_projection_ortho;
+    frame_constants.inverse_view_projection = inverse(camera.matrix_perspective * camera.matrix_view);
+    for(i32 cascade = 0; cascade < SHADOW_CASCADE_COUNT; ++cascade)
+    {
+        frame_constants.cascade_light_transforms[cascade] = directional_shadow_map.cascadeLightSpaceMatrices[cascade];
+        frame_constants.cascade_far_depths[cascade] = directional_shadow_map.cascadeFarDepths[cascade];
+    }
+    frame_constants.camera_position = make_vec4(camera.position.x, camera.position.y, camera.position.z, 1.f);
+
+    const directional_light_t& light = gs->directionallight;
+    vec3 direction = orientation_to_direction(light.orientation);
+    frame_constants.directional_light_colour = make_vec4(light.colour.x, light.colour.y, light.colour.z, light.ambient_intensity);
+    frame_constants.directional_light_direction = make_vec4(direction.x, direction.y, direction.z, light.diffuse_intensity);
+
+    frame_constants.camera_near_far.x = camera.nearclip;
+    frame_constants.camera_near_far.y = camera.farclip;
+    frame_constants.screen_size[0] = back_buffer_width;
+    frame_constants.screen_size[1] = back_buffer_height;
+    frame_constants.point_light_count = (i32) gs->pointlights.size();
+
+    gl_bind_frame_constants();
+}
+
+void deferred_renderer::gl_bind_frame_constants()
+{
+    u32 offset = constants_stream.push(&frame_constants, sizeof(frame_constants_t), gl_get_uniform_buffer_offset_alignment());
+    glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_CONSTANTS_UBO_BINDING, constants_stream.get_id(), offset, sizeof(frame_constants_t));
+    ++profiler_get_frame_stats().uniform_buffer_updates;
+}
+
+void deferred_renderer::gl_upload_pass_constants(const pass_constants_t& constants)
+{
+    u32 id_before_push = constants_stream.get_id();
+    u32 offset = constants_stream.push(&constants, sizeof(pass_constants_t), gl_get_uniform_buffer_offset_alignment());
+    glBindBufferRange(GL_UNIFORM_BUFFER, PASS_CONSTANTS_UBO_BINDING, constants_stream.get_id(), offset, sizeof(pass_constants_t));
+    ++profiler_get_frame_stats().uniform_buffer_updates;
+    if(constants_stream.get_id() != id_before_push)
+    {
+        // The stream grew into a new buffer and deleting the old one unbound the frame constants
+        gl_bind_frame_constants();
+    }
 }
 
 void deferred_renderer::clean_up()
 {
+    get_console().unbind_cvar("frustum_culling");
+    get_console().unbind_cvar("gpu_culling");
+    get_console().unbind_cvar("occlusion_culling");
+    get_console().unbind_cvar("software_occlusion");
+    get_console().unbind_cvar("software_occlusion_threads");
+    get_console().unbind_cvar("gbuffer_position_target");
+    get_console().unbind_cvar("gbuffer_compact_normals");
+    get_console().unbind_cvar("clustered_shading");
+    get_console().unbind_cvar("tile_depth_culling");
+    get_console().unbind_cvar("tile_light_capacity");
+    get_console().unbind_cvar("stress_lights_animated");
+    get_console().unbind_cvar("shadow_caching");
+    get_console().unbind_cvar("shadow_distance");
+    get_console().unbind_cvar("shadow_cascade_split");
+    get_console().unbind_cvar("shadow_resolution_scale");
+    get_console().unbind_cmd("gbuffer_memory");
+    get_console().unbind_cmd("tile_light_histogram");
+    get_console().unbind_cmd("stress_lights");
+
+    gs->pointlights.gl_delete();
+    constants_stream.gl_delete();
+    shadow_atlas_tile_stream.gl_delete();
+    if(shadow_atlas_texture)
+    {
+        gl_state_forget_texture(shadow_atlas_texture);
+        gl_state_forget_framebuffer(shadow_atlas_FBO);
+        glDeleteTextures(1, &shadow_atlas_texture);
+        glDeleteFramebuffers(1, &shadow_atlas_FBO);
+        shadow_atlas_texture = 0;
+        shadow_atlas_FBO = 0;
+    }
+    if(shadow_atlas_static_texture)
+    {
+        gl_state_forget_texture(shadow_atlas_static_texture);
+        gl_state_forget_framebuffer(shadow_atlas_static_FBO);
+        glDeleteTextures(1, &shadow_atlas_static_texture);
+        glDeleteFramebuffers(1, &shadow_atlas_static_FBO);
+        shadow_atlas_static_texture = 0;
+        shadow_atlas_static_FBO = 0;
+    }
+
     shader_t::gl_delete_shader(shader_deferred_geometry_pass);
     shader_t::gl_delete_shader(shader_tiled_deferred_lighting);
+    shader_t::gl_delete_shader(shader_gpu_instance_culling);
+    shader_t::gl_delete_shader(shader_hi_z_downsample);
+    shader_t::gl_delete_shader(shader_light_clustering);
     shader_t::gl_delete_shader(shader_deferred_render_to_quad_pass);
 
     shader_t::gl_delete_shader(shader_directional_shadow_map);
@@ -365,149 +1244,336 @@ void deferred_renderer::temp_create_shadow_maps()
 {
 
 // direct
-    glGenFramebuffers(1, &directional_shadow_map.directionalShadowMapFBO);
-
-    glGenTextures(1, &directional_shadow_map.directionalShadowMapTexture);
-    glBindTexture(GL_TEXTURE_2D, directional_shadow_map.directionalShadowMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-                 directional_shadow_map.SHADOW_WIDTH, directional_shadow_map.SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    float smap_bordercolor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, smap_bordercolor);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, directional_shadow_map.directionalShadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, directional_shadow_map.directionalShadowMapTexture, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-    mat4 lightProjection = projection_matrix_orthographic(-50.0f, 50.0f, -50.0f, 50.0f, 0.1f, 150.f);
-    directional_shadow_map.directionalLightSpaceMatrix = lightProjection
-            //* view_matrix_look_at(-orientation_to_direction(loaded_maps[0].directionallight.orientation) + make_vec3(-47.f, 66.f, 0.f), make_vec3(-47.f, 66.f, 0.f), make_vec3(0.f,1.f,0.f)); // TODO make up 0,0,1 if light is straight up or down
-            //* view_matrix_look_at(make_vec3(-2.0f, 4.0f, -1.0f), make_vec3(0.f, 0.f, 0.f), make_vec3(0.f,1.f,0.f)); // TODO make up 0,0,1 if light is straight up or down
-            * view_matrix_look_at(make_vec3(-47.44f, 66.29f, 9.65f), make_vec3(-47.44f, 66.29f, 9.65f) + orientation_to_direction(gs->directionallight.orientation), make_vec3(0.f,1.f,0.f)); // TODO make up 0,0,1 if light is straight up or down
-
+    // The cascades are fitted to the camera every frame, see update_shadow_map_transforms
+    gl_create_shadow_depth_texture(GL_TEXTURE_2D_ARRAY, directional_shadow_map.SHADOW_WIDTH, directional_shadow_map.SHADOW_HEIGHT,
+                                   directional_shadow_map.directionalShadowMapTexture, directional_shadow_map.directionalShadowMapFBO);
+    directional_shadow_map.cache.b_valid = false;
+
+// point and spot
+    gl_create_shadow_depth_texture(GL_TEXTURE_2D, SHADOW_ATLAS_SIZE, SHADOW_ATLAS_SIZE, shadow_atlas_texture, shadow_atlas_FBO,
+                                   GL_DEPTH_COMPONENT16);
+    register_shadow_casting_lights();
+}
 
-// omni
+void deferred_renderer::register_shadow_casting_lights()
+{
+    light_manager_t& point_lights = gs->pointlights;
     omni_shadow_maps.clear();
-    for(int omniLightCount = 0; omniLightCount < gs->pointlights.size(); ++omniLightCount)
+    for(u32 light_index = 0; light_index < point_lights.size(); ++light_index)
     {
-        point_light_t& point_light = gs->pointlights[omniLightCount];
-        if(point_light.is_b_cast_shadow() == false)
+        const point_light_t& point_light = point_lights[light_index];
+        i32 shadow_index = -1;
+        if(point_light.is_b_cast_shadow())
         {
-            continue;
+            shadow_index = (i32) omni_shadow_maps.size();
+            omni_shadow_map_t shadow_map;
+            shadow_map.owning_light_index = light_index;
+            set_omni_shadow_transforms(shadow_map, get_light_shadow_sphere(point_light), get_light_shadow_spotlight(point_light));
+            omni_shadow_maps.push_back(shadow_map);
         }
-
-        omni_shadow_map_t shadow_map;
-        shadow_map.owning_light = &point_light;
-
-        glGenFramebuffers(1, &shadow_map.depthCubeMapFBO);
-
-        glGenTextures(1, &shadow_map.depthCubeMapTexture);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, shadow_map.depthCubeMapTexture);
-        for (unsigned int i = 0; i < 6; ++i)
+        // edit marks the light to be uploaded again, so only lights whose index changes are touched
+        if(point_light.get_shadow_index() != shadow_index)
         {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT,
-                         shadow_map.CUBE_SHADOW_WIDTH, shadow_map.CUBE_SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+            point_lights.edit(light_index).set_shadow_index(shadow_index);
         }
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, shadow_map.depthCubeMapFBO);
-        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadow_map.depthCubeMapTexture, 0);
-        glDrawBuffer(GL_NONE);
-        glReadBuffer(GL_NONE);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        float aspect = (float)shadow_map.CUBE_SHADOW_WIDTH/(float)shadow_map.CUBE_SHADOW_HEIGHT;
-        float nearPlane = 1.0f;
-        mat4 shadowProj = projection_matrix_perspective(90.f * KC_DEG2RAD, aspect, nearPlane, shadow_map.get_far_plane());
-
-        vec3 lightPos = gs->pointlights[omniLightCount].position;
-        shadow_map.shadowTransforms.push_back(
-                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_FORWARD_VECTOR, WORLD_DOWN_VECTOR));
-        shadow_map.shadowTransforms.push_back(
-                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_BACKWARD_VECTOR, WORLD_DOWN_VECTOR));
-        shadow_map.shadowTransforms.push_back(
-                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_UP_VECTOR, WORLD_RIGHT_VECTOR));
-        shadow_map.shadowTransforms.push_back(
-                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_DOWN_VECTOR, WORLD_LEFT_VECTOR));
-        shadow_map.shadowTransforms.push_back(
-                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_RIGHT_VECTOR, WORLD_DOWN_VECTOR));
-        shadow_map.shadowTransforms.push_back(
-                shadowProj * view_matrix_look_at(lightPos, lightPos + WORLD_LEFT_VECTOR, WORLD_DOWN_VECTOR));
-
-        omni_shadow_maps.push_back(shadow_map);
     }
+    shadow_atlas_tiles.assign(omni_shadow_maps.size() * SHADOW_ATLAS_VIEWS_PER_LIGHT, shadow_atlas_tile_t());
+    shadow_atlas_order.reserve(omni_shadow_maps.size());
+    shadow_atlas_static_order.reserve(omni_shadow_maps.size());
 }
 
 void deferred_renderer::temp_create_geometry_buffer()
 {
     glGenFramebuffers(1, &g_buffer_FBO);
-    glBindFramebuffer(GL_FRAMEBUFFER, g_buffer_FBO);
-
-    glGenTextures(1, &g_position_texture);
-    glBindTexture(GL_TEXTURE_2D, g_position_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g_position_texture, 0);
-
-    glGenTextures(1, &g_normal_texture);
-    glBindTexture(GL_TEXTURE_2D, g_normal_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, g_normal_texture, 0);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, g_buffer_FBO);
 
     glGenTextures(1, &g_albedo_texture);
-    glBindTexture(GL_TEXTURE_2D, g_albedo_texture);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, g_albedo_texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, g_albedo_texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, g_albedo_texture, 0);
 
-    u32 color_attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-    glDrawBuffers(3, color_attachments);
+    // A texture rather than a renderbuffer so that the Hi-Z pyramid can be built from it
+    glGenTextures(1, &g_depth_texture);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, g_depth_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, back_buffer_width, back_buffer_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, g_depth_texture, 0);
 
-    glGenRenderbuffers(1, &g_depth_RBO);
-    glBindRenderbuffer(GL_RENDERBUFFER, g_depth_RBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, back_buffer_width, back_buffer_height);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, g_depth_RBO);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    gl_set_geometry_buffer_layout(b_gbuffer_position_target, b_gbuffer_compact_normals);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glGenTextures(1, &deferred_composition_output_texture);
-    glBindTexture(GL_TEXTURE_2D, deferred_composition_output_texture);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, deferred_composition_output_texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
+
+    gl_create_hi_z_texture();
 
     flag_g_buffer_created = true;
 }
 
 void deferred_renderer::temp_update_geometry_buffer_size()
 {
-    glBindFramebuffer(GL_FRAMEBUFFER, g_buffer_FBO);
-    glBindTexture(GL_TEXTURE_2D, g_position_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-    glBindTexture(GL_TEXTURE_2D, g_normal_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-    glBindTexture(GL_TEXTURE_2D, g_albedo_texture);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, g_buffer_FBO);
+    if(g_position_texture)
+    {
+        gl_state_bind_texture(0, GL_TEXTURE_2D, g_position_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    }
+    gl_state_bind_texture(0, GL_TEXTURE_2D, g_normal_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, g_normal_format, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, g_albedo_texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-    glBindRenderbuffer(GL_RENDERBUFFER, g_depth_RBO);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, back_buffer_width, back_buffer_height);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, g_depth_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, back_buffer_width, back_buffer_height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glBindTexture(GL_TEXTURE_2D, deferred_composition_output_texture);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, deferred_composition_output_texture);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
+
+    gl_create_hi_z_texture();
+}
+
+/** Bytes per pixel of a G-buffer layout: normal, albedo, depth, and position if it has a position target */
+INTERNAL i32 get_geometry_buffer_bytes_per_pixel(bool b_position_target, bool b_compact_normals)
+{
+    return (b_compact_normals ? 4 : 8) + 4 + 4 + (b_position_target ? 8 : 0);
+}
+
+void deferred_renderer::gl_set_geometry_buffer_layout(bool b_position_target, bool b_compact_normals)
+{
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, g_buffer_FBO);
+    u32 normal_format = b_compact_normals ? GL_RGB10_A2 : GL_RGBA16F;
+    if(g_normal_texture == 0 || g_normal_format != normal_format)
+    {
+        if(g_normal_texture != 0)
+        {
+            gl_state_forget_texture(g_normal_texture);
+            glDeleteTextures(1, &g_normal_texture);
+        }
+        g_normal_format = normal_format;
+        glGenTextures(1, &g_normal_texture);
+        gl_state_bind_texture(0, GL_TEXTURE_2D, g_normal_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, g_normal_format, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, g_normal_texture, 0);
+    }
+    if(b_position_target && g_position_texture == 0)
+    {
+        glGenTextures(1, &g_position_texture);
+        gl_state_bind_texture(0, GL_TEXTURE_2D, g_position_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, back_buffer_width, back_buffer_height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, g_position_texture, 0);
+    }
+    else if(!b_position_target && g_position_texture != 0)
+    {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, 0, 0);
+        gl_state_forget_texture(g_position_texture);
+        glDeleteTextures(1, &g_position_texture);
+        g_position_texture = 0;
+    }
+    // Normal + shininess, albedo + specular intensity, then the position the geometry pass writes either way
+    u32 color_attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+    glDrawBuffers(b_position_target ? 3 : 2, color_attachments);
+    gl_state_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+    i32 bytes_per_pixel = get_geometry_buffer_bytes_per_pixel(b_position_target, b_compact_normals);
+    console_printf("G-buffer layout: %s, %s normals, %d bytes per pixel, %.1f MB at %dx%d\n",
+                   b_position_target ? "position target" : "position from depth", b_compact_normals ? "compact" : "RGBA16F",
+                   bytes_per_pixel, (float) bytes_per_pixel * back_buffer_width * back_buffer_height / (1024.f * 1024.f),
+                   back_buffer_width, back_buffer_height);
+}
+
+void deferred_renderer::print_tile_light_histogram()
+{
+    if(tile_light_histogram_buffer == 0)
+    {
+        glGenBuffers(1, &tile_light_histogram_buffer);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_LIGHT_HISTOGRAM_SSBO_BINDING, tile_light_histogram_buffer);
+
+    // Shades this frame's G-buffer once per mode, the frame's own lighting pass overwrites the output
+    const char* mode_names[3] = { "none", "min max", "depth mask" };
+    u32 histograms[3][TILE_LIGHT_HISTOGRAM_BUCKETS + 1];
+    bool b_was_clustered = b_clustered_shading;
+    i32 previous_tile_depth_culling = tile_depth_culling;
+    b_clustered_shading = false;
+    b_tile_light_histogram = true;
+    for(i32 mode = TILE_DEPTH_CULLING_NONE; mode <= TILE_DEPTH_CULLING_MASK; ++mode)
+    {
+        u32 zeros[TILE_LIGHT_HISTOGRAM_BUCKETS + 1] = { 0 };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_light_histogram_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(zeros), zeros, GL_DYNAMIC_READ);
+        tile_depth_culling = mode;
+        deferred_lighting_and_composition_pass();
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, tile_light_histogram_buffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(histograms[mode]), histograms[mode]);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    b_clustered_shading = b_was_clustered;
+    tile_depth_culling = previous_tile_depth_culling;
+    b_tile_light_histogram = false;
+
+    console_printf("tiles per light count, %d lights at %dx%d\n", (i32) gs->pointlights.size(), back_buffer_width, back_buffer_height);
+    console_printf("%12s %10s %10s %10s\n", "lights", mode_names[0], mode_names[1], mode_names[2]);
+    for(i32 bucket = 0; bucket < TILE_LIGHT_HISTOGRAM_BUCKETS; ++bucket)
+    {
+        char range[32];
+        if(bucket == 0)
+        {
+            stbsp_snprintf(range, sizeof(range), "0");
+        }
+        else if(bucket == TILE_LIGHT_HISTOGRAM_BUCKETS - 1)
+        {
+            stbsp_snprintf(range, sizeof(range), "%d+", 1 << (bucket - 1));
+        }
+        else
+        {
+            stbsp_snprintf(range, sizeof(range), "%d-%d", 1 << (bucket - 1), (1 << bucket) - 1);
+        }
+        console_printf("%12s %10u %10u %10u\n", range, histograms[0][bucket], histograms[1][bucket], histograms[2][bucket]);
+    }
+    float tile_count = (float) (((back_buffer_width + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE)
+                                * ((back_buffer_height + LIGHT_TILE_SIZE - 1) / LIGHT_TILE_SIZE));
+    console_printf("%12s %10.1f %10.1f %10.1f\n", "avg per tile", histograms[0][TILE_LIGHT_HISTOGRAM_BUCKETS] / tile_count,
+                   histograms[1][TILE_LIGHT_HISTOGRAM_BUCKETS] / tile_count, histograms[2][TILE_LIGHT_HISTOGRAM_BUCKETS] / tile_count);
+}
+
+void deferred_renderer::print_geometry_buffer_memory()
+{
+    // Bandwidth assumes every target is written once by the geometry pass (no overdraw) and read once by the lighting pass
+    const i32 resolutions[3][2] = { { 1600, 900 }, { 3840, 2160 }, { back_buffer_width, back_buffer_height } };
+    for(i32 layout = 0; layout < 4; ++layout)
+    {
+        bool b_position_target = (layout & 2) != 0;
+        bool b_compact_normals = (layout & 1) == 0;
+        i32 bytes_per_pixel = get_geometry_buffer_bytes_per_pixel(b_position_target, b_compact_normals);
+        bool b_current = b_position_target == (g_position_texture != 0) && b_compact_normals == (g_normal_format == GL_RGB10_A2);
+        console_printf("%s%s, %s normals: %d bytes per pixel\n", b_current ? "* " : "  ",
+                       b_position_target ? "position target" : "position from depth", b_compact_normals ? "compact" : "RGBA16F",
+                       bytes_per_pixel);
+        for(const i32* resolution : resolutions)
+        {
+            float megabytes = (float) bytes_per_pixel * resolution[0] * resolution[1] / (1024.f * 1024.f);
+            console_printf("    %dx%d: %.1f MB, %.1f MB per frame, %.2f GB/s at 60 fps\n", resolution[0], resolution[1],
+                           megabytes, 2.f * megabytes, 2.f * megabytes * 60.f / 1024.f);
+        }
+    }
+}
+
+void deferred_renderer::gl_create_hi_z_texture()
+{
+    if(hi_z_texture != 0)
+    {
+        gl_state_forget_texture(hi_z_texture);
+        glDeleteTextures(1, &hi_z_texture);
+    }
+    hi_z_level_count = 1;
+    while((kc_max(back_buffer_width, back_buffer_height) >> hi_z_level_count) > 0)
+    {
+        ++hi_z_level_count;
+    }
+    glGenTextures(1, &hi_z_texture);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, hi_z_texture);
+    glTexStorage2D(GL_TEXTURE_2D, hi_z_level_count, GL_R32F, back_buffer_width, back_buffer_height);
+    // Only ever read with texelFetch, but a mipmapped filter makes every level readable
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
+}
+
+void deferred_renderer::build_hi_z()
+{
+    shader_t::gl_use_shader(shader_hi_z_downsample);
+    const i32 HI_Z_GROUP_DIM = 8;
+    for(i32 level = 0; level < hi_z_level_count; ++level)
+    {
+        i32 level_width = kc_max(back_buffer_width >> level, 1);
+        i32 level_height = kc_max(back_buffer_height >> level, 1);
+        glBindImageTexture(0, hi_z_texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        if(level == 0)
+        {
+            gl_state_bind_texture(0, GL_TEXTURE_2D, g_depth_texture);
+            shader_hi_z_downsample.gl_bind_1i(hi_z_b_copy_uniform, 1);
+            shader_hi_z_downsample.gl_bind_1i(hi_z_source_level_uniform, 0);
+        }
+        else
+        {
+            gl_state_bind_texture(0, GL_TEXTURE_2D, hi_z_texture);
+            shader_hi_z_downsample.gl_bind_1i(hi_z_b_copy_uniform, 0);
+            shader_hi_z_downsample.gl_bind_1i(hi_z_source_level_uniform, level - 1);
+        }
+        glDispatchCompute((level_width + HI_Z_GROUP_DIM - 1) / HI_Z_GROUP_DIM, (level_height + HI_Z_GROUP_DIM - 1) / HI_Z_GROUP_DIM, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
+}
+
+void deferred_renderer::render_scene_occlusion_culled(shader_t& shader, vec3 view_position, const cull_view_t* cull_view,
+                                                      const mat4& view_projection)
+{
+    // One visibility flag per scene mesh, kept from frame to frame
+    gs->update_world_transforms();
+    u32 mesh_count = gs->get_scene_mesh_count();
+    if(occlusion_stats_buffer == 0)
+    {
+        u32 zero = 0;
+        glGenBuffers(1, &occlusion_stats_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, occlusion_stats_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(u32), &zero, GL_DYNAMIC_READ);
+        glGenBuffers(1, &occlusion_visibility_buffer);
+    }
+    if(mesh_count != occlusion_visibility_count || occlusion_visibility_count == 0)
+    {
+        // Nothing counts as visible last frame: phase 1 draws nothing and phase 2 tests everything
+        std::vector<u32> visibility(kc_max(mesh_count, 1u), 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, occlusion_visibility_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(u32) * visibility.size(), visibility.data(), GL_DYNAMIC_COPY);
+        occlusion_visibility_count = mesh_count;
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, occlusion_stats_buffer);
+    if(profiler_get_level() >= 2)
+    {
+        // Last frame's count: reading it a frame late gives the GPU time to get there
+        u32 occluded_count = 0;
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(u32), &occluded_count);
+        profiler_get_frame_stats().draws_occluded = occluded_count;
+    }
+    u32 zero = 0;
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(u32), &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    gpu_cull_params_t gpu_cull;
+    gpu_cull.cull_shader = &shader_gpu_instance_culling;
+    gpu_cull.cull_uniforms = &gpu_cull_uniforms;
+    gpu_cull.cull_view = cull_view;
+    gpu_cull.occlusion_visibility_buffer = occlusion_visibility_buffer;
+    gpu_cull.occlusion_stats_buffer = occlusion_stats_buffer;
+
+    // 1. Draw what was visible last frame
+    gpu_cull.occlusion_phase = OCCLUSION_PHASE_PREVIOUSLY_VISIBLE;
+    gs->render_scene(&shader, view_position, nullptr, &gpu_cull);
+
+    // 2. Test everything against what that drew, and draw what was missing
+    build_hi_z();
+    shader_t::gl_use_shader(shader);
+    gpu_cull.occlusion_phase = OCCLUSION_PHASE_NEWLY_VISIBLE;
+    gpu_cull.hi_z_texture = hi_z_texture;
+    gpu_cull.hi_z_level_count = hi_z_level_count;
+    gpu_cull.occlusion_view_projection = view_projection;
+    gs->render_scene_again(&gpu_cull);
 }
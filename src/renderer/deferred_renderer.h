@@ -4,32 +4,162 @@
 #include "shader.h"
 #include "../core/kc_math.h"
 #include "light.h"
+#include "light_manager.h"
 #include "../debugging/console.h"
 #include "skybox_renderer.h"
+#include "software_occlusion.h"
+#include "stream_buffer.h"
+#include "render_queue.h"
+#include "../game/scene_graph.h"
 
 struct game_state;
+struct cull_view_t;
+
+/** Clustered shading (see light_clustering.comp): the view frustum is split into CLUSTER_TILE_SIZE pixel screen
+    tiles and CLUSTER_DEPTH_SLICES depth slices, exponentially spaced between the near and far clip. Clusters with more
+    than MAX_LIGHTS_PER_CLUSTER lights are culled again straight into the global index list, which has room for
+    MAX_LIGHTS_PER_CLUSTER per cluster on average. The depth slices and max lights are compiled into the shaders. */
+#define CLUSTER_TILE_SIZE 64
+#define CLUSTER_DEPTH_SLICES 24
+#define MAX_LIGHTS_PER_CLUSTER 128
+/** Shader storage bindings of the per cluster (offset, count) grid and the light index list it points into */
+#define CLUSTER_LIGHT_GRID_SSBO_BINDING 12
+#define CLUSTER_LIGHT_INDICES_SSBO_BINDING 13
+
+/** Side in pixels of the screen tiles the lighting pass culls lights for, one work group each. Compiled into
+    tiled_deferred_lighting.comp. */
+#define LIGHT_TILE_SIZE 16
+/** How the tiled light culler uses the depth of each tile's pixels, see tiled_deferred_lighting.comp */
+#define TILE_DEPTH_CULLING_NONE 0       // side planes only
+#define TILE_DEPTH_CULLING_MIN_MAX 1    // also reject lights outside the tile's min and max view depth
+#define TILE_DEPTH_CULLING_MASK 2       // also reject lights outside every occupied 32nd of that range (2.5D culling)
+/** Buckets of the lights per tile histogram: tiles with no lights, then 1, 2-3, 4-7 ... 1024+ lights */
+#define TILE_LIGHT_HISTOGRAM_BUCKETS 12
+#define TILE_LIGHT_HISTOGRAM_SSBO_BINDING 14
+
+/** Default number of light indices each tile keeps in shared memory (see tile_light_capacity). Tiles with more
+    lights spill into a global list of TILE_LIGHT_SPILL_CAPACITY indices; lights past that are dropped. */
+#define MAX_LIGHTS_PER_TILE 256
+#define MIN_TILE_LIGHT_CAPACITY 16
+#define MAX_TILE_LIGHT_CAPACITY 4096 // shared memory is at least 32 KB
+#define TILE_LIGHT_SPILL_CAPACITY (1 << 22)
+#define TILE_LIGHT_SPILL_SSBO_BINDING 15
+
+/** Shader storage binding of the point lights (see light_manager_t) */
+#define POINT_LIGHTS_SSBO_BINDING 4
+/** Uniform buffer bindings of the frame and pass constants, set on every program by deferred_renderer::load_shaders */
+#define FRAME_CONSTANTS_UBO_BINDING 0
+#define PASS_CONSTANTS_UBO_BINDING 1
+/** Room for the frame constants and a few dozen passes' constants, the stream grows if a frame needs more */
+#define CONSTANTS_STREAM_BYTES_PER_FRAME 65536
+
+/** Cascaded shadow map of the directional light: the view frustum up to shadow_distance is split by depth into
+    SHADOW_CASCADE_COUNT slices, each shadowed by its own ortho projection in a layer of one depth texture array.
+    Compiled into the shaders (the frame_constants block, directional_shadow_map.geom, tiled_deferred_lighting.comp). */
+#define SHADOW_CASCADE_COUNT 4
+/** How far behind a cascade (towards the light) casters still throw shadows into it */
+#define SHADOW_CASCADE_CASTER_DISTANCE 100.f
+
+/** Constants every pass of a frame reads, the std140 frame_constants block of the shaders. Written once per frame. */
+struct frame_constants_t
+{
+    mat4 matrix_view;
+    mat4 matrix_proj_perspective;
+    mat4 matrix_proj_orthographic;
+    mat4 inverse_view_projection;
+    mat4 cascade_light_transforms[SHADOW_CASCADE_COUNT];
+    vec4 camera_position;               // w unused
+    vec4 directional_light_colour;      // w is the ambient intensity
+    vec4 directional_light_direction;   // w is the diffuse intensity
+    vec4 cascade_far_depths;            // view depth each cascade ends at
+    vec2 camera_near_far;               // x is near clip, y is far clip
+    i32  screen_size[2];
+    i32  point_light_count;
+    i32  padding[3];
+};
+static_assert(SHADOW_CASCADE_COUNT == 4, "cascade_far_depths holds a depth per cascade");
+static_assert(sizeof(frame_constants_t) == 608, "frame_constants_t must match the std140 frame_constants block");
+
+/** Constants of one pass, the std140 pass_constants block of the shaders. Each pass writes the members it uses. */
+struct pass_constants_t
+{
+    mat4 light_matrices[6];         // shadow passes: view projection of each cube face or cascade
+    vec4 light_position;            // omni shadow pass: w is the far plane
+    i32  b_position_target;         // G-buffer layout, see gl_set_geometry_buffer_layout
+    i32  b_compact_normals;
+    i32  b_clustered;               // lighting pass settings, see the cvars of the same names
+    i32  tile_depth_culling;
+    i32  b_light_histogram;
+    i32  padding[3];
+};
+static_assert(sizeof(pass_constants_t) == 432, "pass_constants_t must match the std140 pass_constants block");
+
+/** Units per second the animated stress lights move at */
+#define STRESS_LIGHT_SPEED 10.f
+/** stress_light_first_index while there are no stress lights, INDEX_NONE as a u32 */
+#define STRESS_LIGHTS_NONE 0xffffffffu
+
+/** Depth of a shadow map's static casters, kept between frames so the map is only redrawn from scratch when
+    the light or a static caster moves. Each frame the map is a copy of it with the dynamic casters drawn on top
+    (see deferred_renderer::render_shadow_map). Same format and size as the map it caches, created on first use. */
+struct shadow_cache_t
+{
+    u32 static_depth_texture = 0;
+    u32 static_depth_FBO = 0;
+    /** game_state::get_static_objects_version when static_depth_texture was drawn */
+    u32 static_objects_version = 0;
+    /** Cleared when the light moves */
+    bool b_valid = false;
+    /** The map holds dynamic casters drawn over the static depth, so it can't be reused as is */
+    bool b_map_has_dynamic = false;
+};
 
 struct directional_shadow_map_t
 {
     const i32 SHADOW_WIDTH = 2048;
     const i32 SHADOW_HEIGHT = 2048;
-    u32 directionalShadowMapTexture = 0;
+    u32 directionalShadowMapTexture = 0; // GL_TEXTURE_2D_ARRAY, a layer per cascade
     u32 directionalShadowMapFBO = 0;
-    mat4 directionalLightSpaceMatrix;
+    mat4 cascadeLightSpaceMatrices[SHADOW_CASCADE_COUNT];
+    float cascadeFarDepths[SHADOW_CASCADE_COUNT];
+    vec3 directionalLightPosition; // where the last cascade is seen from, casters are sorted by distance to it
+    shadow_cache_t cache;
 };
 
-struct omni_shadow_map_t
+/** Shadow atlas of the point lights and spotlights: one SHADOW_ATLAS_SIZE square depth texture (16 bit, 128 MB)
+    that every shadow casting light gets square tiles of, six for a point light (one per cube face) and one for a
+    spotlight. Tile sizes are powers of two between the min and max, picked every frame from how big the light
+    looks on screen; when they don't all fit, the least important lights get smaller tiles or none (see
+    deferred_renderer::allocate_shadow_atlas_tiles). Cached (static) lights also keep their static casters' depth
+    in tiles of the same size in a SHADOW_ATLAS_STATIC_SIZE static atlas (32 MB, 160 MB in all), the most important
+    first; the ones that don't fit are drawn every frame like uncached lights. */
+#define SHADOW_ATLAS_SIZE 8192
+#define SHADOW_ATLAS_STATIC_SIZE 4096
+#define SHADOW_ATLAS_MIN_TILE_SIZE 64
+#define SHADOW_ATLAS_MAX_TILE_SIZE 2048
+/** Tiles each light has in the shadow_atlas_tiles buffer, whether it uses them all or not.
+    Compiled into tiled_deferred_lighting.comp. */
+#define SHADOW_ATLAS_VIEWS_PER_LIGHT 6
+#define SHADOW_ATLAS_TILES_SSBO_BINDING 16
+
+/** A tile of the shadow atlas as the lighting shader sees it, the std430 shadow_atlas_tile_t of tiled_deferred_lighting.comp */
+struct shadow_atlas_tile_t
 {
-    const i32 CUBE_SHADOW_WIDTH = 1024;
-    const i32 CUBE_SHADOW_HEIGHT = 1024;
-    u32 depthCubeMapTexture = 0;
-    u32 depthCubeMapFBO = 0;
+    mat4 view_projection;
+    vec4 atlas_rect; // xy corner, zw size, in atlas uv. Zero size if the light has no tiles this frame
+};
+static_assert(sizeof(shadow_atlas_tile_t) == 80, "shadow_atlas_tile_t must match the std430 shadow_atlas_tile_t");
 
-    float get_far_plane() const
+/** A shadow casting point light or spotlight: its views, and where they are in the shadow atlas this frame.
+    The cache has no static depth texture of its own: a cached light's static casters are kept in its static tiles
+    of deferred_renderer's shadow_atlas_static_texture, and b_valid also goes false when those move. */
+struct omni_shadow_map_t
+{
+    float get_far_plane(const light_manager_t& point_lights) const
     {
-        if(owning_light)
+        if(owning_light_index < point_lights.size())
         {
-            return owning_light->get_radius();
+            return point_lights[owning_light_index].get_radius();
         }
         else
         {
@@ -38,8 +168,28 @@ struct omni_shadow_map_t
         }
     }
 
-    point_light_t* owning_light;
+    u32 owning_light_index = INDEX_NONE;
+    /** View projection of each cube face (+x -x +y -y +z -z), or only the spotlight's cone */
     std::vector<mat4> shadowTransforms;
+    /** Light position (xyz) and far plane (w) shadowTransforms were made for */
+    vec4 shadowTransformsLightSphere;
+    /** Spotlight direction (xyz) and cosine cutoff (w) shadowTransforms were made for, all 0 for a point light */
+    vec4 shadowTransformsSpotlight;
+    /** How big the light looks on screen (radius in pixels), 0 if it lights nothing in view */
+    float importance = 0.f;
+    /** Side of each of its tiles this frame, 0 if it got none */
+    i32 tile_size = 0;
+    /** Atlas texel corner of each view's tile */
+    vec2i tile_corners[SHADOW_ATLAS_VIEWS_PER_LIGHT];
+    /** Static atlas texel corner of each view's tile (tile_size too), if b_static_tiles */
+    bool b_static_tiles = false;
+    vec2i static_tile_corners[SHADOW_ATLAS_VIEWS_PER_LIGHT];
+    /** tile_size, tile_corners and static_tile_corners of the last frame, what the tiles were drawn (or kept) at */
+    i32 drawn_tile_size = 0;
+    vec2i drawn_tile_corners[SHADOW_ATLAS_VIEWS_PER_LIGHT];
+    bool b_drawn_static_tiles = false;
+    vec2i drawn_static_tile_corners[SHADOW_ATLAS_VIEWS_PER_LIGHT];
+    shadow_cache_t cache;
 };
 
 struct display_settings_t
@@ -73,20 +223,116 @@ struct deferred_renderer
 
     mat4 matrix_projection_ortho;
 
+    /** Skip submitting meshes outside the camera / shadow map frusta. Console: frustum_culling 0/1 */
+    bool b_frustum_culling = true;
+    /** Cull on the GPU in a compute pass instead of on the CPU with the scene BVH. Console: gpu_culling 0/1 */
+    bool b_gpu_culling = false;
+    /** With GPU culling, also cull the geometry pass against a Hi-Z pyramid in two phases. Console: occlusion_culling 0/1 */
+    bool b_occlusion_culling = true;
+    /** Without GPU culling, cull the geometry pass against occluders rasterized on the CPU. Console: software_occlusion 0/1 */
+    bool b_software_occlusion = false;
+    /** Threads rasterizing the software occlusion buffer. Console: software_occlusion_threads */
+    i32 software_occlusion_threads = 4;
+    /** Old G-buffer layout with an RGBA16F world position target, instead of reconstructing position from depth.
+        Console: gbuffer_position_target 0/1 */
+    bool b_gbuffer_position_target = false;
+    /** Octahedral encoded normal and shininess in an RGB10_A2 target instead of RGBA16F. Console: gbuffer_compact_normals 0/1 */
+    bool b_gbuffer_compact_normals = false;
+    /** Cull lights per 3D cluster in a separate compute pass instead of per LIGHT_TILE_SIZE screen tile. Console: clustered_shading 0/1 */
+    bool b_clustered_shading = false;
+    /** One of TILE_DEPTH_CULLING_*. Console: tile_depth_culling 0/1/2 */
+    i32 tile_depth_culling = TILE_DEPTH_CULLING_MIN_MAX;
+    /** Light indices per tile in shared memory, compiled into the lighting shader. Console: tile_light_capacity */
+    i32 tile_light_capacity = MAX_LIGHTS_PER_TILE;
+    /** How many of the stress lights move every frame. Console: stress_lights_animated */
+    i32 stress_lights_animated = 0;
+    /** Keep the depth of static casters in the shadow maps of static lights between frames (see shadow_cache_t).
+        Console: shadow_caching 0/1 */
+    bool b_shadow_caching = true;
+    /** View depth the directional light's shadow cascades reach. Console: shadow_distance */
+    float shadow_distance = 150.f;
+    /** Cascade splits from uniform (0) to logarithmic (1) in depth. Console: shadow_cascade_split */
+    float shadow_cascade_split = 0.8f;
+    /** Shadow atlas texels per pixel of a light's radius on screen, before rounding down to a power of two.
+        Console: shadow_resolution_scale */
+    float shadow_resolution_scale = 1.f;
+
 private:
 
     void render_pass_directional_shadow_map();
 
+    /** Draws the point light and spotlight shadows into their shadow atlas tiles */
     void render_pass_omnidirectional_shadow_map();
 
+    /** Sizes the shadow atlas tiles of the shadow casting lights by importance and packs them into the atlas */
+    void allocate_shadow_atlas_tiles();
+
+    /** Makes an omni_shadow_map_t for every shadow casting light and points the lights at them (shadow_index).
+        Call again when lights are added or removed, or start or stop casting shadows. */
+    void register_shadow_casting_lights();
+
+    /** Fits the directional light's cascades to the camera, remakes the transforms of the omni shadow maps
+        whose lights moved, and marks the caches of the shadow maps whose transforms changed stale */
+    void update_shadow_map_transforms();
+
     void render_pass_main();
 
     void deferred_render_to_quad_pass();
 
-    void render_scene(shader_t& shader) const;
+    /** Draws the scene objects (one of SCENE_OBJECTS_*), culled on the GPU if b_gpu_culling */
+    void render_scene(shader_t& shader, vec3 view_position, const cull_view_t* cull_view = nullptr,
+                      u32 objects = SCENE_OBJECTS_ALL);
+
+    /** Fills the shadow map drawn through map_FBO (texture map_texture) with the scene's depth as seen through
+        the bound shader and pass constants. With b_cached, the static casters come from cache, which is redrawn
+        only if it's stale; with b_prebaked as well, dynamic casters and static ones moving are ignored. */
+    void render_shadow_map(shadow_cache_t& cache, u32 map_FBO, u32 map_texture, GLenum target, i32 width, i32 height,
+                           shader_t& shader, vec3 view_position, const cull_view_t& cull_view, bool b_cached, bool b_prebaked);
+
+    /** GPU culled render_scene with two-phase occlusion culling: draws what was visible last frame, builds
+        the Hi-Z pyramid from the resulting depth, then draws what the Hi-Z shows is newly visible */
+    void render_scene_occlusion_culled(shader_t& shader, vec3 view_position, const cull_view_t* cull_view,
+                                       const mat4& view_projection);
+
+    /** Fills every level of hi_z_texture from g_depth_texture */
+    void build_hi_z();
+
+    void gl_create_hi_z_texture();
+
+    /** Adds or removes the G-buffer's position target and (re)creates its normal target in the format of the layout */
+    void gl_set_geometry_buffer_layout(bool b_position_target, bool b_compact_normals);
+
+    /** Prints the size and per frame bandwidth of every G-buffer layout at 1600x900, 4K and the current resolution */
+    void print_geometry_buffer_memory();
+
+    /** Runs the tiled lighting pass with each TILE_DEPTH_CULLING_* mode and prints how many tiles ended up with how many
+        lights. Called by render_pass_main after the geometry pass when the tile_light_histogram command asked for it, so
+        its stream buffer writes are fenced with the rest of the frame's. */
+    void print_tile_light_histogram();
+
+    /** Replaces the lights added by the last call with count random point lights within extent of the camera.
+        The first shadowed of them cast shadows, every other one of those a spotlight pointing down. */
+    void generate_stress_lights(i32 count, float extent, i32 shadowed = 0);
+
+    /** Moves the first stress_lights_animated stress lights in circles */
+    void animate_stress_lights();
+
+    void gl_load_tiled_lighting_shader();
+
+    /** Fills the cluster light grid and index list for the current camera */
+    void light_clustering_pass();
 
     void copy_depth_from_gbuffer_to_defaultbuffer() const;
 
+    /** Fills frame_constants for the current camera and lights, and uploads them */
+    void gl_upload_frame_constants();
+
+    /** Streams frame_constants and binds them to FRAME_CONSTANTS_UBO_BINDING */
+    void gl_bind_frame_constants();
+
+    /** Streams the constants of the pass about to run and binds them to PASS_CONSTANTS_UBO_BINDING */
+    void gl_upload_pass_constants(const pass_constants_t& constants);
+
     void temp_update_geometry_buffer_size();
 
     // Width and Height of writable buffer
@@ -95,6 +341,9 @@ private:
 
     shader_t    shader_deferred_geometry_pass;
     shader_t    shader_tiled_deferred_lighting;
+    shader_t    shader_gpu_instance_culling;
+    shader_t    shader_hi_z_downsample;
+    shader_t    shader_light_clustering;
     shader_t    shader_deferred_render_to_quad_pass;
     shader_t    shader_directional_shadow_map;
     shader_t    shader_omni_shadow_map;
@@ -105,15 +354,62 @@ private:
 
     skybox_renderer m_skybox_renderer;
 
+    /** Frame and pass constants, one region per frame in flight */
+    stream_buffer_t constants_stream;
+    frame_constants_t frame_constants;
+
+    software_occlusion_buffer_t software_occlusion;
+
     directional_shadow_map_t directional_shadow_map;
     std::vector<omni_shadow_map_t> omni_shadow_maps;
+    u32 shadow_atlas_texture = 0;
+    u32 shadow_atlas_FBO = 0;
+    /** Static casters' depth of the cached lights' static tiles (see shadow_cache_t), SHADOW_ATLAS_STATIC_SIZE
+        square, created on first use */
+    u32 shadow_atlas_static_texture = 0;
+    u32 shadow_atlas_static_FBO = 0;
+    /** shadow_atlas_tile_t of every shadow casting light, rewritten every frame */
+    stream_buffer_t shadow_atlas_tile_stream;
+    std::vector<shadow_atlas_tile_t> shadow_atlas_tiles;
+    /** Indices of the omni_shadow_maps that get tiles, sorted by importance then into packing order */
+    std::vector<u32> shadow_atlas_order;
+    /** Same for the cached lights that get static tiles */
+    std::vector<u32> shadow_atlas_static_order;
 
     u32 g_buffer_FBO = 0;
-    u32 g_position_texture = 0;
+    u32 g_position_texture = 0; // 0 unless b_gbuffer_position_target
     u32 g_normal_texture = 0;
+    u32 g_normal_format = 0; // GL_RGBA16F, or GL_RGB10_A2 if b_gbuffer_compact_normals
     u32 g_albedo_texture = 0;
-    u32 g_depth_RBO = 0;
+    u32 g_depth_texture = 0;
+    /** Max depth pyramid of g_depth_texture, same size at level 0 */
+    u32 hi_z_texture = 0;
+    i32 hi_z_level_count = 0;
+    /** Per scene mesh visibility kept between frames for occlusion culling, and the occluded count */
+    u32 occlusion_visibility_buffer = 0;
+    u32 occlusion_visibility_count = 0;
+    u32 occlusion_stats_buffer = 0;
     u32 deferred_composition_output_texture = 0;
+    /** Lights from stress_light_first_index on were made by generate_stress_lights */
+    u32 stress_light_first_index = STRESS_LIGHTS_NONE;
+    float stress_light_time = 0.f;
+    /** tile_light_capacity the lighting shader was compiled with */
+    i32 loaded_tile_light_capacity = 0;
+    /** Uniforms set every frame, looked up when their shader is loaded */
+    uniform_handle_t hi_z_b_copy_uniform;
+    uniform_handle_t hi_z_source_level_uniform;
+    gpu_cull_uniforms_t gpu_cull_uniforms;
+    /** Spill count and spilled tiles, then TILE_LIGHT_SPILL_CAPACITY light indices */
+    u32 tile_light_spill_buffer = 0;
+    /** Clustered shading buffers, sized for cluster_count clusters */
+    u32 cluster_light_grid_buffer = 0;
+    u32 cluster_light_index_buffer = 0;
+    i32 cluster_count = 0;
+    uniform_handle_t cluster_light_index_capacity_uniform;
+    /** TILE_LIGHT_HISTOGRAM_BUCKETS tile counts, then the sum of every tile's light count */
+    u32 tile_light_histogram_buffer = 0;
+    bool b_tile_light_histogram = false;
+    bool b_tile_light_histogram_requested = false;
     bool flag_g_buffer_created = false;
 
     void deferred_lighting_and_composition_pass();
@@ -0,0 +1,206 @@
+#include <cfloat>
+#include "frustum.h"
+
+aabb_t aabb_t::make_empty()
+{
+    aabb_t box;
+    box.min = make_vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+    box.max = make_vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    return box;
+}
+
+void aabb_t::grow(vec3 point)
+{
+    min.x = kc_min(min.x, point.x);
+    min.y = kc_min(min.y, point.y);
+    min.z = kc_min(min.z, point.z);
+    max.x = kc_max(max.x, point.x);
+    max.y = kc_max(max.y, point.y);
+    max.z = kc_max(max.z, point.z);
+}
+
+void aabb_t::grow(const aabb_t& other)
+{
+    if(!other.is_empty())
+    {
+        grow(other.min);
+        grow(other.max);
+    }
+}
+
+bool aabb_t::is_empty() const
+{
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+}
+
+vec3 aabb_t::get_center() const
+{
+    return (min + max) * 0.5f;
+}
+
+vec3 aabb_t::get_extents() const
+{
+    return (max - min) * 0.5f;
+}
+
+aabb_t transform_aabb(const aabb_t& box, const mat4& matrix)
+{
+    // Arvo - "Transforming Axis-Aligned Bounding Boxes", Graphics Gems 1990
+    aabb_t retval;
+    retval.min = make_vec3(matrix[3][0], matrix[3][1], matrix[3][2]);
+    retval.max = retval.min;
+    for(int col = 0; col < 3; ++col)
+    {
+        for(int row = 0; row < 3; ++row)
+        {
+            float a = matrix[col][row] * box.min[col];
+            float b = matrix[col][row] * box.max[col];
+            retval.min[row] += kc_min(a, b);
+            retval.max[row] += kc_max(a, b);
+        }
+    }
+    return retval;
+}
+
+frustum_t make_frustum(const mat4& view_projection)
+{
+    // Gribb & Hartmann - "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix"
+    const mat4& m = view_projection;
+    vec4 row0 = make_vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    vec4 row1 = make_vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    vec4 row2 = make_vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    vec4 row3 = make_vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    frustum_t frustum;
+    frustum.planes[0] = row3 + row0; // left
+    frustum.planes[1] = row3 - row0; // right
+    frustum.planes[2] = row3 + row1; // bottom
+    frustum.planes[3] = row3 - row1; // top
+    frustum.planes[4] = row3 + row2; // near
+    frustum.planes[5] = row3 - row2; // far
+    return frustum;
+}
+
+bool frustum_intersects_aabb(const frustum_t& frustum, const aabb_t& box)
+{
+    for(int i = 0; i < 6; ++i)
+    {
+        const vec4& plane = frustum.planes[i];
+        // Corner of the box furthest along the plane normal
+        float x = plane.x >= 0.f ? box.max.x : box.min.x;
+        float y = plane.y >= 0.f ? box.max.y : box.min.y;
+        float z = plane.z >= 0.f ? box.max.z : box.min.z;
+        if(plane.x * x + plane.y * y + plane.z * z + plane.w < 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool frustum_contains_aabb(const frustum_t& frustum, const aabb_t& box)
+{
+    for(int i = 0; i < 6; ++i)
+    {
+        const vec4& plane = frustum.planes[i];
+        // Corner of the box furthest against the plane normal
+        float x = plane.x >= 0.f ? box.min.x : box.max.x;
+        float y = plane.y >= 0.f ? box.min.y : box.max.y;
+        float z = plane.z >= 0.f ? box.min.z : box.max.z;
+        if(plane.x * x + plane.y * y + plane.z * z + plane.w < 0.f)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sphere_intersects_aabb(vec3 center, float radius, const aabb_t& box)
+{
+    float distance_squared = 0.f;
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        float closest = kc_clamp(center[axis], box.min[axis], box.max[axis]);
+        float delta = center[axis] - closest;
+        distance_squared += delta * delta;
+    }
+    return distance_squared <= radius * radius;
+}
+
+bool ray_intersects_aabb(vec3 origin, vec3 direction_inverse, float max_distance, const aabb_t& box, float* out_distance)
+{
+    // Slab test
+    float t_enter = 0.f;
+    float t_exit = max_distance;
+    for(int axis = 0; axis < 3; ++axis)
+    {
+        float t0 = (box.min[axis] - origin[axis]) * direction_inverse[axis];
+        float t1 = (box.max[axis] - origin[axis]) * direction_inverse[axis];
+        t_enter = kc_max(t_enter, kc_min(t0, t1));
+        t_exit = kc_min(t_exit, kc_max(t0, t1));
+    }
+    if(t_enter > t_exit)
+    {
+        return false;
+    }
+    *out_distance = t_enter;
+    return true;
+}
+
+void cull_view_t::add_frustum(const mat4& view_projection)
+{
+    if(frustum_count < MAX_FRUSTA)
+    {
+        frusta[frustum_count++] = make_frustum(view_projection);
+    }
+}
+
+void cull_view_t::set_sphere(vec3 center, float radius)
+{
+    b_sphere = true;
+    sphere_center = center;
+    sphere_radius = radius;
+}
+
+u32 cull_view_t::get_visibility_mask(const aabb_t& box) const
+{
+    if(b_sphere && !sphere_intersects_aabb(sphere_center, sphere_radius, box))
+    {
+        return 0;
+    }
+    u32 mask = 0;
+    for(i32 i = 0; i < frustum_count; ++i)
+    {
+        if(frustum_intersects_aabb(frusta[i], box))
+        {
+            mask |= 1 << i;
+        }
+    }
+    return mask;
+}
+
+bool cull_view_t::contains(const aabb_t& box) const
+{
+    if(b_sphere)
+    {
+        // Every corner has to be inside the sphere
+        float distance_squared = 0.f;
+        for(int axis = 0; axis < 3; ++axis)
+        {
+            float furthest = kc_max(kc_abs(box.min[axis] - sphere_center[axis]), kc_abs(box.max[axis] - sphere_center[axis]));
+            distance_squared += furthest * furthest;
+        }
+        if(distance_squared > sphere_radius * sphere_radius)
+        {
+            return false;
+        }
+    }
+    for(i32 i = 0; i < frustum_count; ++i)
+    {
+        if(frustum_contains_aabb(frusta[i], box))
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+
+/** Axis aligned bounding box */
+struct aabb_t
+{
+    vec3 min = { 0.f };
+    vec3 max = { 0.f };
+
+    /** Returns an empty box that any point will grow. */
+    static aabb_t make_empty();
+    void grow(vec3 point);
+    void grow(const aabb_t& other);
+    bool is_empty() const;
+    vec3 get_center() const;
+    vec3 get_extents() const;
+};
+
+/** Returns the world space AABB of the given local space AABB transformed by matrix */
+aabb_t transform_aabb(const aabb_t& box, const mat4& matrix);
+
+/** View volume as 6 planes (ax + by + cz + d >= 0 inside) facing inwards:
+    left, right, bottom, top, near, far */
+struct frustum_t
+{
+    vec4 planes[6];
+};
+
+/** Extracts the frustum planes from a projection * view matrix (perspective or orthographic).
+    The planes are in whatever space the matrix transforms from, e.g. world space for projection * view. */
+frustum_t make_frustum(const mat4& view_projection);
+
+/** Conservative: returns true if box is at least partially inside the frustum (and sometimes when it's
+    just outside near a frustum corner) */
+bool frustum_intersects_aabb(const frustum_t& frustum, const aabb_t& box);
+
+/** Returns true if box is completely inside the frustum */
+bool frustum_contains_aabb(const frustum_t& frustum, const aabb_t& box);
+
+/** Returns true if the sphere and box overlap */
+bool sphere_intersects_aabb(vec3 center, float radius, const aabb_t& box);
+
+/** Returns true if the ray enters box within max_distance. out_distance is set to the entry distance
+    (0 if origin is inside box). direction_inverse is 1 / direction per component. */
+bool ray_intersects_aabb(vec3 origin, vec3 direction_inverse, float max_distance, const aabb_t& box, float* out_distance);
+
+/** The frusta a render pass draws into, e.g. the camera frustum or the 6 faces of an omni shadow
+    cube map. Objects outside all of them don't get submitted. Optionally also bounded by a sphere
+    (e.g. a point light's volume), objects outside the sphere are outside every frustum. */
+struct cull_view_t
+{
+    static const i32 MAX_FRUSTA = 6;
+    frustum_t frusta[MAX_FRUSTA];
+    i32 frustum_count = 0;
+    bool b_sphere = false;
+    vec3 sphere_center = { 0.f };
+    float sphere_radius = 0.f;
+
+    void add_frustum(const mat4& view_projection);
+    void set_sphere(vec3 center, float radius);
+    /** Returns a bitmask of the frusta box is inside (bit i set if inside frusta[i]) */
+    u32 get_visibility_mask(const aabb_t& box) const;
+    /** Returns true if box is completely inside one of the frusta (and the sphere) */
+    bool contains(const aabb_t& box) const;
+};
@@ -0,0 +1,241 @@
+#include "gl_state.h"
+#include "../debugging/profiling/profiler.h"
+
+/** Id no object has, for state that isn't known */
+INTERNAL const GLuint GL_STATE_UNKNOWN = 0xffffffff;
+/** Tracked texture targets, see gl_state_texture_target_index */
+INTERNAL const u32 GL_STATE_TEXTURE_TARGETS = 3;
+/** Tracked capabilities, see gl_state_capability_index */
+INTERNAL const u32 GL_STATE_CAPABILITIES = 3;
+
+struct gl_state_t
+{
+    GLuint program;
+    GLuint vertex_array;
+    GLuint active_texture_unit;
+    GLuint textures[GL_STATE_TEXTURE_UNITS][GL_STATE_TEXTURE_TARGETS];
+    GLuint read_framebuffer;
+    GLuint draw_framebuffer;
+    i8     capabilities[GL_STATE_CAPABILITIES]; // 1 enabled, 0 disabled, -1 unknown
+    GLenum polygon_mode;
+};
+
+INTERNAL gl_state_t gl_state;
+INTERNAL bool gl_state_b_initialized = false;
+
+INTERNAL i32 gl_state_texture_target_index(GLenum target)
+{
+    switch(target)
+    {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_2D_ARRAY: return 1;
+        case GL_TEXTURE_CUBE_MAP: return 2;
+        default: return -1;
+    }
+}
+
+INTERNAL i32 gl_state_capability_index(GLenum capability)
+{
+    switch(capability)
+    {
+        case GL_BLEND: return 0;
+        case GL_DEPTH_TEST: return 1;
+        case GL_CULL_FACE: return 2;
+        default: return -1;
+    }
+}
+
+INTERNAL gl_state_t& get_gl_state()
+{
+    if(!gl_state_b_initialized)
+    {
+        gl_state_invalidate();
+    }
+    return gl_state;
+}
+
+/** Counts the call and returns b_issue */
+INTERNAL bool gl_state_count(bool b_issue)
+{
+    profiler_frame_stats_t& stats = profiler_get_frame_stats();
+    if(b_issue)
+    {
+        ++stats.gl_state_calls_issued;
+    }
+    else
+    {
+        ++stats.gl_state_calls_skipped;
+    }
+    return b_issue;
+}
+
+void gl_state_invalidate()
+{
+    gl_state.program = GL_STATE_UNKNOWN;
+    gl_state.vertex_array = GL_STATE_UNKNOWN;
+    gl_state.active_texture_unit = GL_STATE_UNKNOWN;
+    for(u32 unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit)
+    {
+        for(u32 target = 0; target < GL_STATE_TEXTURE_TARGETS; ++target)
+        {
+            gl_state.textures[unit][target] = GL_STATE_UNKNOWN;
+        }
+    }
+    gl_state.read_framebuffer = GL_STATE_UNKNOWN;
+    gl_state.draw_framebuffer = GL_STATE_UNKNOWN;
+    for(u32 capability = 0; capability < GL_STATE_CAPABILITIES; ++capability)
+    {
+        gl_state.capabilities[capability] = -1;
+    }
+    gl_state.polygon_mode = GL_STATE_UNKNOWN;
+    gl_state_b_initialized = true;
+}
+
+bool gl_state_use_program(GLuint program)
+{
+    gl_state_t& state = get_gl_state();
+    if(!gl_state_count(state.program != program))
+    {
+        return false;
+    }
+    glUseProgram(program);
+    state.program = program;
+    return true;
+}
+
+bool gl_state_bind_vertex_array(GLuint vao)
+{
+    gl_state_t& state = get_gl_state();
+    if(!gl_state_count(state.vertex_array != vao))
+    {
+        return false;
+    }
+    glBindVertexArray(vao);
+    state.vertex_array = vao;
+    return true;
+}
+
+bool gl_state_bind_texture(u32 unit, GLenum target, GLuint texture)
+{
+    gl_state_t& state = get_gl_state();
+    i32 target_index = gl_state_texture_target_index(target);
+    bool b_tracked = unit < GL_STATE_TEXTURE_UNITS && target_index >= 0;
+    if(!gl_state_count(!b_tracked || state.textures[unit][target_index] != texture))
+    {
+        return false;
+    }
+    if(gl_state_count(state.active_texture_unit != unit))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        state.active_texture_unit = unit;
+    }
+    glBindTexture(target, texture);
+    if(b_tracked)
+    {
+        state.textures[unit][target_index] = texture;
+    }
+    return true;
+}
+
+bool gl_state_bind_framebuffer(GLenum target, GLuint framebuffer)
+{
+    gl_state_t& state = get_gl_state();
+    bool b_read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    bool b_draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    bool b_changes = (b_read && state.read_framebuffer != framebuffer) || (b_draw && state.draw_framebuffer != framebuffer);
+    if(!gl_state_count(b_changes))
+    {
+        return false;
+    }
+    glBindFramebuffer(target, framebuffer);
+    if(b_read)
+    {
+        state.read_framebuffer = framebuffer;
+    }
+    if(b_draw)
+    {
+        state.draw_framebuffer = framebuffer;
+    }
+    return true;
+}
+
+bool gl_state_set_enabled(GLenum capability, bool b_enabled)
+{
+    gl_state_t& state = get_gl_state();
+    i32 capability_index = gl_state_capability_index(capability);
+    if(!gl_state_count(capability_index < 0 || state.capabilities[capability_index] != (i8) b_enabled))
+    {
+        return false;
+    }
+    if(b_enabled)
+    {
+        glEnable(capability);
+    }
+    else
+    {
+        glDisable(capability);
+    }
+    if(capability_index >= 0)
+    {
+        state.capabilities[capability_index] = (i8) b_enabled;
+    }
+    return true;
+}
+
+bool gl_state_polygon_mode(GLenum mode)
+{
+    gl_state_t& state = get_gl_state();
+    if(!gl_state_count(state.polygon_mode != mode))
+    {
+        return false;
+    }
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    state.polygon_mode = mode;
+    return true;
+}
+
+void gl_state_forget_program(GLuint program)
+{
+    gl_state_t& state = get_gl_state();
+    if(state.program == program)
+    {
+        state.program = 0;
+    }
+}
+
+void gl_state_forget_vertex_array(GLuint vao)
+{
+    gl_state_t& state = get_gl_state();
+    if(state.vertex_array == vao)
+    {
+        state.vertex_array = 0;
+    }
+}
+
+void gl_state_forget_texture(GLuint texture)
+{
+    gl_state_t& state = get_gl_state();
+    for(u32 unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit)
+    {
+        for(u32 target = 0; target < GL_STATE_TEXTURE_TARGETS; ++target)
+        {
+            if(state.textures[unit][target] == texture)
+            {
+                state.textures[unit][target] = 0;
+            }
+        }
+    }
+}
+
+void gl_state_forget_framebuffer(GLuint framebuffer)
+{
+    gl_state_t& state = get_gl_state();
+    if(state.read_framebuffer == framebuffer)
+    {
+        state.read_framebuffer = 0;
+    }
+    if(state.draw_framebuffer == framebuffer)
+    {
+        state.draw_framebuffer = 0;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "../game_defines.h"
+#include "GL/glew.h"
+
+/** Texture units whose bindings are tracked. Binds to higher units are always issued. */
+#define GL_STATE_TEXTURE_UNITS 32
+
+/** Thin layer over the GL calls that change the bound program, VAO, textures and framebuffers, the blend,
+    depth test and face culling switches, and the polygon mode. It remembers what is set and skips calls that
+    wouldn't change anything, e.g. binding the same program for every draw of a pass.
+
+    Everything that changes this state has to go through here or the cache goes stale. After code that
+    doesn't (a library, a new context), call gl_state_invalidate. Issued and skipped calls are counted in
+    profiler_frame_stats_t. The bind functions return true if they issued the call. */
+
+/** Forgets everything, so the next call of each kind is issued */
+void gl_state_invalidate();
+
+bool gl_state_use_program(GLuint program);
+bool gl_state_bind_vertex_array(GLuint vao);
+/** Binds texture to target on unit (0 is GL_TEXTURE0). Only makes unit the active texture unit if it has to bind.
+    GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY and GL_TEXTURE_CUBE_MAP bindings are tracked, other targets are always bound. */
+bool gl_state_bind_texture(u32 unit, GLenum target, GLuint texture);
+/** GL_FRAMEBUFFER binds both the read and the draw framebuffer */
+bool gl_state_bind_framebuffer(GLenum target, GLuint framebuffer);
+/** GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE are tracked, other capabilities are always enabled or disabled */
+bool gl_state_set_enabled(GLenum capability, bool b_enabled);
+/** Polygon mode of front and back faces */
+bool gl_state_polygon_mode(GLenum mode);
+
+/** Deleting a bound object binds 0 in its place. Call these before glDelete* so the cache does the same,
+    otherwise a new object that gets the same id would look bound. */
+void gl_state_forget_program(GLuint program);
+void gl_state_forget_vertex_array(GLuint vao);
+void gl_state_forget_texture(GLuint texture);
+void gl_state_forget_framebuffer(GLuint framebuffer);
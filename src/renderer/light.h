@@ -28,7 +28,7 @@ private:
     bool32      b_cast_shadow;
     bool32      b_prebaked_shadow; // only if b_static is true
     bool32      b_spotlight;
-    bool32      :32;
+    i32         shadow_index; // which of the shadow atlas' lights this is, see deferred_renderer::register_shadow_casting_lights
     vec3        direction = { -1.f, -1.f, 1.f };// { 0.f, -1.f, 0.f };
     float       cos_cutoff = 0.866f;
 
@@ -49,6 +49,7 @@ public:
         b_cast_shadow = false;
         b_prebaked_shadow = false;
         b_spotlight = false;
+        shadow_index = -1;
     }
 
     float get_radius() const;
@@ -79,6 +80,10 @@ public:
 
     void set_direction(const vec3& direction);
 
+    /** -1 if the light has no shadow in the shadow atlas */
+    i32 get_shadow_index() const { return shadow_index; }
+    void set_shadow_index(i32 shadow_index) { point_light_t::shadow_index = shadow_index; }
+
     void set_cutoff_in_degrees(float degrees);
     void set_cutoff_in_radians(float radians);
     float cosine_cutoff() const { return cos_cutoff; }
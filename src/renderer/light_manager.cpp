@@ -0,0 +1,101 @@
+#include "light_manager.h"
+
+#include <algorithm>
+#include <GL/glew.h>
+
+u32 light_manager_t::add(const point_light_t& light)
+{
+    u32 index = (u32) lights.size();
+    lights.push_back(light);
+    dirty_frames.push_back(0);
+    mark_dirty(index);
+    return index;
+}
+
+point_light_t& light_manager_t::edit(u32 index)
+{
+    mark_dirty(index);
+    return lights[index];
+}
+
+void light_manager_t::resize(u32 count)
+{
+    u32 old_count = (u32) lights.size();
+    lights.resize(count);
+    dirty_frames.resize(count, 0);
+    if(count < old_count)
+    {
+        // Lights past the end are never uploaded, so removed ones can stay dirty until the next upload drops them
+        return;
+    }
+    for(u32 index = old_count; index < count; ++index)
+    {
+        mark_dirty(index);
+    }
+}
+
+void light_manager_t::mark_dirty(u32 index)
+{
+    if(!dirty_frames[index])
+    {
+        dirty_indices.push_back(index);
+    }
+    dirty_frames[index] = STREAM_BUFFER_FRAMES;
+}
+
+void light_manager_t::gl_upload(u32 binding)
+{
+    uploaded_bytes = 0;
+    upload_calls = 0;
+
+    u32 count = (u32) lights.size();
+    if(count > buffer_capacity || buffer_capacity == 0)
+    {
+        buffer_capacity = kc_max(kc_max(buffer_capacity * 2, count), (u32) LIGHT_BUFFER_MIN_CAPACITY);
+        light_stream.gl_create(buffer_capacity * sizeof(point_light_t));
+        // None of the new buffer's copies has any light yet
+        for(u32 index = 0; index < count; ++index)
+        {
+            mark_dirty(index);
+        }
+    }
+
+    std::sort(dirty_indices.begin(), dirty_indices.end());
+    // A light removed by resize and added back before the upload is in the list twice
+    dirty_indices.erase(std::unique(dirty_indices.begin(), dirty_indices.end()), dirty_indices.end());
+    u32 region_offset = light_stream.get_region_offset();
+    size_t i = 0;
+    // Indices past count were removed by resize, and sort last
+    while(i < dirty_indices.size() && dirty_indices[i] < count)
+    {
+        u32 range_first = dirty_indices[i];
+        u32 range_end = range_first + 1;
+        for(++i; i < dirty_indices.size() && dirty_indices[i] < count
+                 && dirty_indices[i] <= range_end + LIGHT_DIRTY_RANGE_MERGE_GAP; ++i)
+        {
+            range_end = dirty_indices[i] + 1;
+        }
+        u32 range_bytes = (range_end - range_first) * sizeof(point_light_t);
+        light_stream.write(region_offset + range_first * sizeof(point_light_t), &lights[range_first], range_bytes);
+        uploaded_bytes += range_bytes;
+        ++upload_calls;
+    }
+
+    // Dirty lights have reached one more frame's copy, they're clean once they've reached every copy
+    size_t still_dirty = 0;
+    for(u32 index : dirty_indices)
+    {
+        if(index < count && --dirty_frames[index] > 0)
+        {
+            dirty_indices[still_dirty++] = index;
+        }
+    }
+    dirty_indices.resize(still_dirty);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, light_stream.get_id(), region_offset, buffer_capacity * sizeof(point_light_t));
+}
+
+void light_manager_t::gl_delete()
+{
+    light_stream.gl_delete();
+    buffer_capacity = 0; // the next gl_upload sends every light
+}
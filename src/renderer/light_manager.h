@@ -0,0 +1,61 @@
+#pragma once
+
+#include <vector>
+#include "../game_defines.h"
+#include "light.h"
+#include "stream_buffer.h"
+
+/** Lights further apart than this many lights are uploaded as separate copies; closer dirty ranges are
+    merged, since re-sending a few unchanged lights is cheaper than another copy (a glBufferSubData call
+    without persistent mapping) */
+#define LIGHT_DIRTY_RANGE_MERGE_GAP 4
+#define LIGHT_BUFFER_MIN_CAPACITY 64
+
+/** The scene's point lights, and their copy in a shader storage buffer (std430 array of point_light_t)
+
+    The buffer is a stream_buffer_t with a copy of every light per frame in flight. Changes go through add,
+    edit and resize, which mark the lights they touch dirty for STREAM_BUFFER_FRAMES frames. gl_upload
+    copies the dirty lights into the current frame's copy, as few ranges as possible, so a light that
+    changed once is sent once to each copy. The buffer grows geometrically, so adding lights one at a time
+    doesn't reallocate it every frame; growing re-sends every light.
+    Hand out indices rather than pointers: add and resize can move the lights. */
+struct light_manager_t
+{
+    /** Returns the index of the new light */
+    u32 add(const point_light_t& light);
+    /** Returns the light at index to change it, and marks it dirty */
+    point_light_t& edit(u32 index);
+    /** Removes the lights from count on, or adds default lights up to count */
+    void resize(u32 count);
+    void reserve(u32 count) { lights.reserve(count); }
+
+    const point_light_t& operator[](u32 index) const { return lights[index]; }
+    const point_light_t* data() const { return lights.data(); }
+    u32 size() const { return (u32) lights.size(); }
+    bool empty() const { return lights.empty(); }
+    std::vector<point_light_t>::const_iterator begin() const { return lights.begin(); }
+    std::vector<point_light_t>::const_iterator end() const { return lights.end(); }
+
+    /** Uploads the dirty lights and binds the current frame's copy to the shader storage binding.
+        Call once per frame, between stream_buffers_begin_frame and stream_buffers_end_frame. */
+    void gl_upload(u32 binding);
+    void gl_delete();
+
+    /** Bytes and copies (ranges of lights) the last gl_upload sent */
+    u32 get_uploaded_bytes() const { return uploaded_bytes; }
+    u32 get_upload_calls() const { return upload_calls; }
+
+private:
+    void mark_dirty(u32 index);
+
+    std::vector<point_light_t> lights;
+    /** Indices of the dirty lights in no particular order (see dirty_frames) */
+    std::vector<u32> dirty_indices;
+    /** Per light, how many more frames' copies it has to be sent to. Nonzero lights are in dirty_indices. */
+    std::vector<u8> dirty_frames;
+
+    stream_buffer_t light_stream;
+    u32 buffer_capacity = 0; // lights
+    u32 uploaded_bytes = 0;
+    u32 upload_calls = 0;
+};
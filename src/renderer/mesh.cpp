@@ -1,4 +1,8 @@
+#include <cstddef>
 #include "mesh.h"
+#include "mesh_arena.h"
+#include "stream_buffer.h"
+#include "gl_state.h"
 #include "../debugging/console.h"
 
 void mesh_t::gl_create_mesh(mesh_t& mesh,
@@ -25,7 +29,7 @@ void mesh_t::gl_create_mesh(mesh_t& mesh,
     mesh.indices_count = indices_array_count;
 
     glGenVertexArrays(1, &mesh.id_vao); // Defining some space in the GPU for a vertex array and giving you the vao ID
-    glBindVertexArray(mesh.id_vao); // Binding a VAO means we are currently operating on that VAO
+    gl_state_bind_vertex_array(mesh.id_vao); // Binding a VAO means we are currently operating on that VAO
     // Indentation is to indicate that we are now working within the bound VAO
     glGenBuffers(1, &mesh.id_vbo); // Creating a buffer object inside the bound VAO and returning the ID
     glBindBuffer(GL_ARRAY_BUFFER, mesh.id_vbo); // Bind VBO to operate on that VBO
@@ -61,11 +65,23 @@ void mesh_t::gl_create_mesh(mesh_t& mesh,
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.id_ibo);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, 4 /*bytes cuz uint32*/ * indices_array_count, indices, draw_usage);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0); // Unbind the VAO;
+    gl_state_bind_vertex_array(0); // Unbind the VAO;
 }
 
 void mesh_t::gl_delete_mesh(mesh_t& mesh)
 {
+    if (mesh.b_in_arena)
+    {
+        get_mesh_arena().gl_delete_mesh(mesh);
+        return;
+    }
+
+    if (mesh.streamed_vertex_stride != 0)
+    {
+        // The buffers belong to the stream buffer
+        mesh.id_vbo = 0;
+        mesh.id_ibo = 0;
+    }
     if (mesh.id_ibo != 0)
     {
         glDeleteBuffers(1, &mesh.id_ibo);
@@ -78,6 +94,7 @@ void mesh_t::gl_delete_mesh(mesh_t& mesh)
     }
     if (mesh.id_vao != 0)
     {
+        gl_state_forget_vertex_array(mesh.id_vao);
         glDeleteVertexArrays(1, &mesh.id_vao);
         mesh.id_vao = 0;
     }
@@ -93,31 +110,83 @@ void mesh_t::gl_render_mesh(GLenum render_mode) const
         return;
     }
 
-    // Bind VAO, bind VBO, draw elements(indexed draw)
-    glBindVertexArray(id_vao);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id_ibo);
-            glDrawElements(render_mode, indices_count, GL_UNSIGNED_INT, nullptr);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    // Bind VAO, draw elements(indexed draw). The VAO holds the index buffer, and stays bound for the next draw.
+    // Arena meshes share the arena VAO's index buffer and streamed meshes the stream buffer, first_index and
+    // base_vertex locate them in it
+    gl_state_bind_vertex_array(id_vao);
+        glDrawElementsBaseVertex(render_mode, indices_count, GL_UNSIGNED_INT, (void*)(sizeof(u32) * first_index), base_vertex);
+}
+
+void mesh_t::gl_create_streamed_mesh(mesh_t& mesh,
+                                     u8 vertex_attrib_size,
+                                     u8 texture_attrib_size,
+                                     u8 normal_attrib_size)
+{
+    mesh.streamed_vertex_stride = sizeof(float) * (vertex_attrib_size + texture_attrib_size + normal_attrib_size);
+    mesh.indices_count = 0;
+
+    // Separate attribute format and buffer binding (GL 4.3), so that streaming only has to move binding 0
+    glGenVertexArrays(1, &mesh.id_vao);
+    gl_state_bind_vertex_array(mesh.id_vao);
+        glVertexAttribFormat(0, vertex_attrib_size, GL_FLOAT, GL_FALSE, 0);
+        glVertexAttribBinding(0, 0);
+        glEnableVertexAttribArray(0);
+        if(texture_attrib_size > 0)
+        {
+            glVertexAttribFormat(1, texture_attrib_size, GL_FLOAT, GL_FALSE, sizeof(float) * vertex_attrib_size);
+            glVertexAttribBinding(1, 0);
+            glEnableVertexAttribArray(1);
+        }
+        if(normal_attrib_size > 0)
+        {
+            glVertexAttribFormat(2, normal_attrib_size, GL_FLOAT, GL_FALSE, sizeof(float) * (vertex_attrib_size + texture_attrib_size));
+            glVertexAttribBinding(2, 0);
+            glEnableVertexAttribArray(2);
+        }
+    gl_state_bind_vertex_array(0);
 }
 
-void mesh_t::gl_rebind_buffer_objects(float* vertices,
-                                      u32* indices,
+void mesh_t::gl_stream_buffer_objects(stream_buffer_t& stream,
+                                      const float* vertices,
+                                      const u32* indices,
                                       u32 vertices_array_count,
-                                      u32 indices_array_count,
-                                      GLenum draw_usage)
+                                      u32 indices_array_count)
 {
-    if(id_vbo == 0 || id_ibo == 0)
+    indices_count = indices_array_count;
+    if(streamed_vertex_stride == 0 || indices_array_count == 0)
     {
         return;
     }
 
-    indices_count = indices_array_count;
-    glBindVertexArray(id_vao);
-        glBindBuffer(GL_ARRAY_BUFFER, id_vbo);
-            glBufferData(GL_ARRAY_BUFFER, 4 * vertices_array_count, vertices, draw_usage);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id_ibo);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, 4 * indices_array_count, indices, draw_usage);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    stream.reserve(sizeof(float) * vertices_array_count + sizeof(u32) * indices_array_count + sizeof(u32));
+    u32 vertices_offset = stream.push(vertices, sizeof(float) * vertices_array_count);
+    u32 indices_offset = stream.push(indices, sizeof(u32) * indices_array_count);
+    first_index = indices_offset / sizeof(u32);
+    base_vertex = 0;
+
+    gl_state_bind_vertex_array(id_vao);
+        glBindVertexBuffer(0, stream.get_id(), vertices_offset, streamed_vertex_stride);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream.get_id());
+    id_vbo = stream.get_id();
+    id_ibo = stream.get_id();
+}
+
+void mesh_t::gl_set_instance_buffer(u32 id_instance_buffer, u32 offset)
+{
+    gl_state_bind_vertex_array(id_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, id_instance_buffer);
+    // A mat4 attribute is four vec4 attributes, one per column
+    for(u32 column = 0; column < 4; ++column)
+    {
+        u32 location = INSTANCE_MATRIX_ATTRIB_LOCATION + column;
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(instance_data_t),
+                              (void*)(offset + offsetof(instance_data_t, model_matrix) + sizeof(float) * 4 * column));
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+    }
+    glVertexAttribIPointer(INSTANCE_FACE_MASK_ATTRIB_LOCATION, 1, GL_UNSIGNED_INT, sizeof(instance_data_t),
+                           (void*)(offset + offsetof(instance_data_t, face_mask)));
+    glVertexAttribDivisor(INSTANCE_FACE_MASK_ATTRIB_LOCATION, 1);
+    glEnableVertexAttribArray(INSTANCE_FACE_MASK_ATTRIB_LOCATION);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
\ No newline at end of file
@@ -1,8 +1,25 @@
 #pragma once
 
 #include "../game_defines.h"
+#include "../core/kc_math.h"
 #include "GL/glew.h"
 
+struct stream_buffer_t;
+
+/** Vertex attribute locations of the per-instance data rendered by render queues:
+    the model matrix takes four locations (one per column), then the face mask */
+#define INSTANCE_MATRIX_ATTRIB_LOCATION 3
+#define INSTANCE_FACE_MASK_ATTRIB_LOCATION 7
+
+/** Per-instance vertex data of an instanced draw. Padded to its std430 size so that compute shaders
+    can read and write it too (see gpu_instance_culling.comp) */
+struct instance_data_t
+{
+    mat4 model_matrix;
+    u32  face_mask; // see omni_shadow_map.geom
+    u32  padding[3];
+};
+
 /** Stores mesh { VAO, VBO, IBO } info. Handle for VAO on GPU memory
  *  Holds the ID for the VAO, VBO, IBO in the GPU memory
 */
@@ -12,6 +29,14 @@ struct mesh_t
     u32  id_vbo          = 0;
     u32  id_ibo          = 0;
     u32  indices_count   = 0;
+    /** Where the mesh lives in its buffers: nonzero for meshes in the mesh arena (see mesh_arena_t), which
+        don't own their VAO or buffers */
+    u32  first_index     = 0;
+    i32  base_vertex     = 0;
+    u32  vertices_count  = 0;
+    bool b_in_arena      = false;
+    /** Bytes per vertex of streamed meshes, which read from a stream_buffer_t instead of buffers of their own */
+    u32  streamed_vertex_stride = 0;
 
     /** Create a mesh_t with the given vertices and indices.
     vertex_attrib_size: vertex coords size (e.g. 3 if x y z)
@@ -29,17 +54,28 @@ struct mesh_t
                                GLenum draw_usage = GL_STATIC_DRAW);
 
     /** Clearing GPU memory: glDeleteBuffers and glDeleteVertexArrays deletes the buffer
-        object and vertex array object off the GPU memory. */
+        object and vertex array object off the GPU memory. Arena meshes give their space back to the arena. */
     static void gl_delete_mesh(mesh_t& mesh);
 
-    /** Binds VAO and draws elements. Bind a shader program and texture
+    /** Binds VAO (unless it already is, see gl_state) and draws elements. Bind a shader program and texture
         before calling gl_render_mesh */
     void gl_render_mesh(GLenum render_mode = GL_TRIANGLES) const;
 
-    /** Overwrite existing buffer data */
-    void gl_rebind_buffer_objects(float* vertices,
-                                  u32* indices,
+    /** Points the VAO's per-instance attributes (see INSTANCE_MATRIX_ATTRIB_LOCATION) at the instance_data_t
+        starting at offset in the given buffer, advancing once per instance. Leaves the VAO bound. */
+    void gl_set_instance_buffer(u32 id_instance_buffer, u32 offset = 0);
+
+    /** Create a mesh_t without buffers, whose vertices and indices are streamed every frame with gl_stream_buffer_objects */
+    static void gl_create_streamed_mesh(mesh_t& mesh,
+                                        u8 vertex_attrib_size = 2,
+                                        u8 texture_attrib_size = 2,
+                                        u8 normal_attrib_size = 0);
+
+    /** Copies the vertices and indices into stream and points the streamed mesh at them. They only last
+        until the stream's region comes around again, so stream them every frame the mesh is drawn. */
+    void gl_stream_buffer_objects(stream_buffer_t& stream,
+                                  const float* vertices,
+                                  const u32* indices,
                                   u32 vertices_array_count,
-                                  u32 indices_array_count,
-                                  GLenum draw_usage = GL_DYNAMIC_DRAW);
+                                  u32 indices_array_count);
 };
@@ -0,0 +1,179 @@
+#include "mesh_arena.h"
+#include "../debugging/console.h"
+#include "gl_state.h"
+
+INTERNAL const u32 MESH_ARENA_INITIAL_VERTEX_CAPACITY = 1 << 16;
+INTERNAL const u32 MESH_ARENA_INITIAL_INDEX_CAPACITY = 1 << 18;
+
+mesh_arena_t& get_mesh_arena()
+{
+    local_persist mesh_arena_t arena;
+    return arena;
+}
+
+void mesh_arena_t::gl_create_mesh(mesh_t& mesh, const float* vertices, const u32* indices, u32 vertices_array_count, u32 indices_array_count)
+{
+    u32 vertex_count = vertices_array_count / MESH_ARENA_VERTEX_FLOATS;
+    u32 base_vertex = allocate_range(free_vertex_ranges, vertex_end, vertex_count);
+    u32 first_index = allocate_range(free_index_ranges, index_end, indices_array_count);
+    gl_reserve(vertex_end, index_end);
+
+    // Upload through the copy targets so that whatever VAO is bound doesn't get its element buffer changed
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id_vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(float) * MESH_ARENA_VERTEX_FLOATS * base_vertex,
+                    sizeof(float) * vertices_array_count, vertices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id_ibo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(u32) * first_index, sizeof(u32) * indices_array_count, indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    mesh.id_vao = id_vao;
+    mesh.id_vbo = 0;
+    mesh.id_ibo = 0;
+    mesh.indices_count = indices_array_count;
+    mesh.first_index = first_index;
+    mesh.base_vertex = (i32) base_vertex;
+    mesh.vertices_count = vertex_count;
+    mesh.b_in_arena = true;
+}
+
+void mesh_arena_t::gl_delete_mesh(mesh_t& mesh)
+{
+    if(!mesh.b_in_arena)
+    {
+        return;
+    }
+
+    free_range(free_vertex_ranges, vertex_end, { (u32) mesh.base_vertex, mesh.vertices_count });
+    free_range(free_index_ranges, index_end, { mesh.first_index, mesh.indices_count });
+    mesh = mesh_t();
+}
+
+u32 mesh_arena_t::allocate_range(std::vector<arena_range_t>& free_ranges, u32& end, u32 count)
+{
+    for(size_t i = 0; i < free_ranges.size(); ++i)
+    {
+        arena_range_t& range = free_ranges[i];
+        if(range.count >= count)
+        {
+            u32 begin = range.begin;
+            range.begin += count;
+            range.count -= count;
+            if(range.count == 0)
+            {
+                free_ranges.erase(free_ranges.begin() + i);
+            }
+            return begin;
+        }
+    }
+
+    u32 begin = end;
+    end += count;
+    return begin;
+}
+
+void mesh_arena_t::free_range(std::vector<arena_range_t>& free_ranges, u32& end, arena_range_t range)
+{
+    if(range.count == 0)
+    {
+        return;
+    }
+
+    size_t insert_at = 0;
+    while(insert_at < free_ranges.size() && free_ranges[insert_at].begin < range.begin)
+    {
+        ++insert_at;
+    }
+    free_ranges.insert(free_ranges.begin() + insert_at, range);
+
+    // Merge with the next range, then the previous one
+    if(insert_at + 1 < free_ranges.size() && range.begin + range.count == free_ranges[insert_at + 1].begin)
+    {
+        free_ranges[insert_at].count += free_ranges[insert_at + 1].count;
+        free_ranges.erase(free_ranges.begin() + insert_at + 1);
+    }
+    if(insert_at > 0 && free_ranges[insert_at - 1].begin + free_ranges[insert_at - 1].count == free_ranges[insert_at].begin)
+    {
+        free_ranges[insert_at - 1].count += free_ranges[insert_at].count;
+        free_ranges.erase(free_ranges.begin() + insert_at);
+    }
+
+    // A free range touching the end just moves the end back
+    if(!free_ranges.empty() && free_ranges.back().begin + free_ranges.back().count == end)
+    {
+        end = free_ranges.back().begin;
+        free_ranges.pop_back();
+    }
+}
+
+void mesh_arena_t::gl_reserve(u32 min_vertex_capacity, u32 min_index_capacity)
+{
+    if(id_vao != 0 && min_vertex_capacity <= vertex_capacity && min_index_capacity <= index_capacity)
+    {
+        return;
+    }
+
+    u32 new_vertex_capacity = kc_max(vertex_capacity, MESH_ARENA_INITIAL_VERTEX_CAPACITY);
+    while(new_vertex_capacity < min_vertex_capacity)
+    {
+        new_vertex_capacity *= 2;
+    }
+    u32 new_index_capacity = kc_max(index_capacity, MESH_ARENA_INITIAL_INDEX_CAPACITY);
+    while(new_index_capacity < min_index_capacity)
+    {
+        new_index_capacity *= 2;
+    }
+
+    if(new_vertex_capacity != vertex_capacity || id_vbo == 0)
+    {
+        u32 new_vbo;
+        glGenBuffers(1, &new_vbo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, new_vbo);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(float) * MESH_ARENA_VERTEX_FLOATS * new_vertex_capacity, nullptr, GL_STATIC_DRAW);
+        if(id_vbo != 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, id_vbo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(float) * MESH_ARENA_VERTEX_FLOATS * vertex_capacity);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &id_vbo);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        id_vbo = new_vbo;
+        vertex_capacity = new_vertex_capacity;
+    }
+    if(new_index_capacity != index_capacity || id_ibo == 0)
+    {
+        u32 new_ibo;
+        glGenBuffers(1, &new_ibo);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, new_ibo);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(u32) * new_index_capacity, nullptr, GL_STATIC_DRAW);
+        if(id_ibo != 0)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, id_ibo);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(u32) * index_capacity);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &id_ibo);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        id_ibo = new_ibo;
+        index_capacity = new_index_capacity;
+    }
+    console_printf("Mesh arena resized to %u vertices, %u indices\n", vertex_capacity, index_capacity);
+
+    // Point the VAO at the new buffers. The per-instance attributes live in another buffer and are left alone.
+    if(id_vao == 0)
+    {
+        glGenVertexArrays(1, &id_vao);
+    }
+    gl_state_bind_vertex_array(id_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, id_vbo);
+    GLsizei stride = sizeof(float) * MESH_ARENA_VERTEX_FLOATS;
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, 0); // vertex pointer
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 3)); // uv coord pointer
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, stride, (void*)(sizeof(float) * 5)); // normal pointer
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, id_ibo);
+    gl_state_bind_vertex_array(0);
+}
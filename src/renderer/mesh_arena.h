@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include "../game_defines.h"
+#include "mesh.h"
+
+/** Number of floats per vertex in the arena: x y z, u v, nx ny nz */
+#define MESH_ARENA_VERTEX_FLOATS 8
+
+/** Shared vertex and index buffers for static meshes, with a single VAO.
+    Meshes created through the arena don't own any GL objects: their id_vao is the arena's VAO,
+    and first_index / base_vertex locate them inside the shared buffers. Because every arena mesh
+    uses the same VAO, a whole pass can be drawn with glMultiDrawElementsIndirect (see render_queue_t).
+    The buffers grow geometrically; freed ranges are reused by later meshes that fit in them. */
+struct mesh_arena_t
+{
+    /** Copies vertices (MESH_ARENA_VERTEX_FLOATS floats each) and indices into the arena and points mesh at them */
+    void gl_create_mesh(mesh_t& mesh, const float* vertices, const u32* indices, u32 vertices_array_count, u32 indices_array_count);
+
+    /** Returns the mesh's ranges to the arena and resets the mesh */
+    void gl_delete_mesh(mesh_t& mesh);
+
+    u32 get_vao() const { return id_vao; }
+    u32 get_vertex_capacity() const { return vertex_capacity; }
+    u32 get_index_capacity() const { return index_capacity; }
+
+private:
+    struct arena_range_t
+    {
+        u32 begin;
+        u32 count;
+    };
+
+    /** Finds count free elements in free_ranges, or past end (growing end). Returns the first element. */
+    static u32 allocate_range(std::vector<arena_range_t>& free_ranges, u32& end, u32 count);
+    /** Puts a range back into free_ranges, merging it with its neighbours */
+    static void free_range(std::vector<arena_range_t>& free_ranges, u32& end, arena_range_t range);
+
+    /** Grows the buffers to hold at least the given number of vertices and indices, keeping their contents */
+    void gl_reserve(u32 min_vertex_capacity, u32 min_index_capacity);
+
+    u32 id_vao = 0;
+    u32 id_vbo = 0;
+    u32 id_ibo = 0;
+    u32 vertex_capacity = 0;
+    u32 index_capacity = 0;
+    // Everything at or past end is unused
+    u32 vertex_end = 0;
+    u32 index_end = 0;
+    // Unused ranges before end, sorted by begin
+    std::vector<arena_range_t> free_vertex_ranges;
+    std::vector<arena_range_t> free_index_ranges;
+};
+
+mesh_arena_t& get_mesh_arena();
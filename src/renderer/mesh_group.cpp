@@ -1,5 +1,6 @@
 #include "mesh_group.h"
 #include "texture.h"
+#include "mesh_arena.h"
 #include "../core/kc_math.h"
 #include "../core/timer.h"
 #include "../debugging/console.h"
@@ -7,18 +8,26 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+/** Meshes at least this big in two dimensions, relative to the group's largest dimension, become occluders */
+INTERNAL const float OCCLUDER_MIN_EXTENT_FRACTION = 0.1f;
+
 void mesh_group_t::render()
 {
     for(size_t i = 0; i < meshes.size(); ++i)
     {
-        u16 mat_index = mesh_to_texture[i];
-        if(mat_index < textures.size() && textures[mat_index].texture_id != 0)
-        {
-            textures[mat_index].gl_use_texture();
-        }
+        render_mesh(i);
+    }
+}
 
-        meshes[i].gl_render_mesh();
+void mesh_group_t::render_mesh(size_t mesh_index)
+{
+    u16 mat_index = mesh_to_texture[mesh_index];
+    if(mat_index < textures.size() && textures[mat_index].texture_id != 0)
+    {
+        textures[mat_index].gl_use_texture();
     }
+
+    meshes[mesh_index].gl_render_mesh();
 }
 
 void mesh_group_t::clear()
@@ -77,6 +86,9 @@ mesh_group_t mesh_group_t::assimp_load(const char* file_name)
     retval.meshes = std::vector<mesh_t>(scene->mNumMeshes);
     retval.textures = std::vector<texture_t>(scene->mNumMaterials);
     retval.mesh_to_texture = std::vector<u16>(scene->mNumMeshes);
+    retval.mesh_bounds = std::vector<aabb_t>(scene->mNumMeshes);
+    retval.mesh_occluders = std::vector<occluder_geometry_t>(scene->mNumMeshes);
+    retval.bounds = aabb_t::make_empty();
 
     console_printf("took %f seconds to set sizes of 3 vectors\n", timer::timestamp());
 
@@ -84,11 +96,43 @@ mesh_group_t mesh_group_t::assimp_load(const char* file_name)
     for(size_t i = 0; i < scene->mNumMeshes; ++i)
     {
         aiMesh* mesh_node = scene->mMeshes[i];
-        retval.meshes[i] = assimp_load_mesh_helper(mesh_node);
+        retval.meshes[i] = assimp_load_mesh_helper(mesh_node, &retval.mesh_bounds[i]);
         retval.mesh_to_texture[i] = mesh_node->mMaterialIndex;
+        retval.bounds.grow(retval.mesh_bounds[i]);
     }
 
-    console_printf("took %f seconds to unpack all the meshes\n", timer::timestamp());
+    // Keep the triangles of the big meshes (walls, floors...) around for software occlusion culling
+    vec3 group_extents = retval.bounds.get_extents();
+    float min_occluder_extent = OCCLUDER_MIN_EXTENT_FRACTION * kc_max(group_extents.x, kc_max(group_extents.y, group_extents.z));
+    u32 occluder_count = 0;
+    for(size_t i = 0; i < scene->mNumMeshes; ++i)
+    {
+        vec3 extents = retval.mesh_bounds[i].get_extents();
+        i32 big_dimensions = (extents.x >= min_occluder_extent) + (extents.y >= min_occluder_extent) + (extents.z >= min_occluder_extent);
+        if(big_dimensions < 2)
+        {
+            continue;
+        }
+
+        aiMesh* mesh_node = scene->mMeshes[i];
+        occluder_geometry_t& occluder = retval.mesh_occluders[i];
+        occluder.positions.resize(mesh_node->mNumVertices);
+        for(size_t j = 0; j < mesh_node->mNumVertices; ++j)
+        {
+            occluder.positions[j] = make_vec3(mesh_node->mVertices[j].x, mesh_node->mVertices[j].y, mesh_node->mVertices[j].z);
+        }
+        for(size_t j = 0; j < mesh_node->mNumFaces; ++j)
+        {
+            const aiFace& face = mesh_node->mFaces[j];
+            if(face.mNumIndices == 3)
+            {
+                occluder.indices.insert(occluder.indices.end(), face.mIndices, face.mIndices + 3);
+            }
+        }
+        ++occluder_count;
+    }
+
+    console_printf("took %f seconds to unpack all the meshes (%u occluders)\n", timer::timestamp(), occluder_count);
 
     // Load diffuse textures
     for(size_t i = 0; i < scene->mNumMaterials; ++i)
@@ -116,7 +160,56 @@ mesh_group_t mesh_group_t::assimp_load(const char* file_name)
     return retval;
 }
 
-mesh_t mesh_group_t::assimp_load_mesh_helper(aiMesh* mesh_node)
+mesh_group_t mesh_group_t::make_cube()
+{
+    // Each face is spanned by axes u and v with u x v = normal, so its corners go counter clockwise seen from outside
+    const vec3 face_normals[6] = {
+        make_vec3(1.f, 0.f, 0.f), make_vec3(-1.f, 0.f, 0.f),
+        make_vec3(0.f, 1.f, 0.f), make_vec3(0.f, -1.f, 0.f),
+        make_vec3(0.f, 0.f, 1.f), make_vec3(0.f, 0.f, -1.f)
+    };
+    const float corner_signs[4][2] = { { -1.f, -1.f }, { 1.f, -1.f }, { 1.f, 1.f }, { -1.f, 1.f } };
+    std::vector<float> vb;
+    std::vector<u32> ib;
+    occluder_geometry_t occluder;
+    for(const vec3& normal : face_normals)
+    {
+        vec3 u = fabsf(normal.y) > 0.5f ? make_vec3(1.f, 0.f, 0.f) : make_vec3(0.f, 1.f, 0.f);
+        vec3 v = cross(normal, u);
+        u32 first_vertex = (u32) occluder.positions.size();
+        for(const auto& signs : corner_signs)
+        {
+            vec3 position = (normal + u * signs[0] + v * signs[1]) * 0.5f;
+            float vertex[8] = { position.x, position.y, position.z,
+                                0.5f + 0.5f * signs[0], 0.5f + 0.5f * signs[1],
+                                normal.x, normal.y, normal.z };
+            vb.insert(vb.end(), vertex, vertex + 8);
+            occluder.positions.push_back(position);
+        }
+        u32 face_indices[6] = { 0, 1, 2, 0, 2, 3 };
+        for(u32 index : face_indices)
+        {
+            ib.push_back(first_vertex + index);
+        }
+    }
+    occluder.indices = ib;
+
+    mesh_group_t retval;
+    retval.meshes.resize(1);
+    get_mesh_arena().gl_create_mesh(retval.meshes[0], vb.data(), ib.data(), (u32) vb.size(), (u32) ib.size());
+    retval.textures.resize(1);
+    unsigned char white[4] = { 255, 255, 255, 255 };
+    texture_t::gl_create_from_bitmap(retval.textures[0], white, 1, 1, GL_RGBA, GL_RGBA);
+    retval.mesh_to_texture.push_back(0);
+    retval.bounds = aabb_t::make_empty();
+    retval.bounds.grow(make_vec3(-0.5f, -0.5f, -0.5f));
+    retval.bounds.grow(make_vec3(0.5f, 0.5f, 0.5f));
+    retval.mesh_bounds.push_back(retval.bounds);
+    retval.mesh_occluders.push_back(occluder);
+    return retval;
+}
+
+mesh_t mesh_group_t::assimp_load_mesh_helper(aiMesh* mesh_node, aabb_t* out_bounds)
 {
     const u8 vb_entries_per_vertex = 8;
     std::vector<float> vb(mesh_node->mNumVertices * vb_entries_per_vertex);
@@ -153,6 +246,12 @@ mesh_t mesh_group_t::assimp_load_mesh_helper(aiMesh* mesh_node)
         }
     }
 
+    *out_bounds = aabb_t::make_empty();
+    for(size_t i = 0; i < mesh_node->mNumVertices; ++i)
+    {
+        out_bounds->grow(make_vec3(mesh_node->mVertices[i].x, mesh_node->mVertices[i].y, mesh_node->mVertices[i].z));
+    }
+
     for(size_t i = 0; i < mesh_node->mNumFaces; ++i)
     {
         aiFace face = mesh_node->mFaces[i];
@@ -163,6 +262,6 @@ mesh_t mesh_group_t::assimp_load_mesh_helper(aiMesh* mesh_node)
     }
 
     mesh_t mesh;
-    mesh_t::gl_create_mesh(mesh, &vb[0], &ib[0], (u32)vb.size(), (u32)ib.size());
+    get_mesh_arena().gl_create_mesh(mesh, &vb[0], &ib[0], (u32)vb.size(), (u32)ib.size());
     return mesh;
 }
\ No newline at end of file
@@ -5,22 +5,41 @@
 #include "../game_defines.h"
 #include "mesh.h"
 #include "texture.h"
+#include "frustum.h"
 
 class aiMesh;
 
+/** CPU copy of a mesh's triangles, for rasterizing it into a software_occlusion_buffer_t */
+struct occluder_geometry_t
+{
+    std::vector<vec3>   positions;
+    std::vector<u32>    indices;
+};
+
 struct mesh_group_t
 {
     std::vector<mesh_t>     meshes;
     std::vector<texture_t>  textures;
     std::vector<u16>        mesh_to_texture;
+    /** Model space bounds of each mesh, and of the whole group. Calculated at load time. */
+    std::vector<aabb_t>     mesh_bounds;
+    aabb_t                  bounds;
+    /** Occluder geometry of each mesh, empty for meshes too small to hide much behind them */
+    std::vector<occluder_geometry_t> mesh_occluders;
 
     void render();
 
+    /** Renders a single mesh with its texture */
+    void render_mesh(size_t mesh_index);
+
     void clear();
 
     static mesh_group_t assimp_load(const char* file_name);
 
+    /** A unit cube (-0.5 to 0.5) with a plain white texture, scale it with the object's transform */
+    static mesh_group_t make_cube();
+
 private:
-    static mesh_t assimp_load_mesh_helper(aiMesh* mesh_node);
+    static mesh_t assimp_load_mesh_helper(aiMesh* mesh_node, aabb_t* out_bounds);
 
 };
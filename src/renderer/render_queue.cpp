@@ -0,0 +1,367 @@
+#include <cstring>
+#include "render_queue.h"
+#include "shader.h"
+#include "mesh.h"
+#include "texture.h"
+#include "frustum.h"
+#include "../debugging/profiling/profiler.h"
+#include "gl_state.h"
+
+u64 make_draw_sort_key(u32 shader_program, u32 texture_id, u32 mesh_id, float view_depth)
+{
+    // Bit pattern of a non-negative float increases with its value, so its top bits make a depth key
+    float depth = kc_max(view_depth, 0.f);
+    u32 depth_bits;
+    memcpy(&depth_bits, &depth, sizeof(depth_bits));
+
+    return ((u64) (shader_program & 0xff) << 56)
+         | ((u64) (texture_id & 0xffff) << 40)
+         | ((u64) (mesh_id & 0xffffff) << 16)
+         | (u64) (depth_bits >> 16);
+}
+
+void radix_sort_keys(const u64* keys, u32 count, std::vector<u32>& order, std::vector<u32>& scratch)
+{
+    order.resize(count);
+    scratch.resize(count);
+    for(u32 i = 0; i < count; ++i)
+    {
+        order[i] = i;
+    }
+
+    // All 8 histograms in one read of the keys
+    u32 histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for(u32 i = 0; i < count; ++i)
+    {
+        u64 key = keys[i];
+        for(int pass = 0; pass < 8; ++pass)
+        {
+            ++histograms[pass][(key >> (pass * 8)) & 0xff];
+        }
+    }
+
+    u32* source = order.data();
+    u32* destination = scratch.data();
+    for(int pass = 0; pass < 8; ++pass)
+    {
+        u32* histogram = histograms[pass];
+        if(count == 0 || histogram[(keys[0] >> (pass * 8)) & 0xff] == count)
+        {
+            continue; // every key has the same byte here
+        }
+
+        u32 offset = 0;
+        for(int bucket = 0; bucket < 256; ++bucket)
+        {
+            u32 bucket_count = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucket_count;
+        }
+        for(u32 i = 0; i < count; ++i)
+        {
+            u32 index = source[i];
+            destination[histogram[(keys[index] >> (pass * 8)) & 0xff]++] = index;
+        }
+        u32* temp = source;
+        source = destination;
+        destination = temp;
+    }
+
+    if(source != order.data())
+    {
+        memcpy(order.data(), source, count * sizeof(u32));
+    }
+}
+
+void render_queue_t::clear()
+{
+    items.clear();
+    keys.clear();
+}
+
+void render_queue_t::push(const draw_item_t& item)
+{
+    items.push_back(item);
+    keys.push_back(item.sort_key);
+}
+
+void render_queue_t::sort_and_submit(const gpu_cull_params_t* gpu_cull)
+{
+    build_draw_commands(gpu_cull != nullptr);
+    submit(gpu_cull);
+}
+
+void render_queue_t::build_draw_commands(bool b_gpu_cull)
+{
+    profiler_frame_stats_t& stats = profiler_get_frame_stats();
+    commands.clear();
+    draw_texture_slots.clear();
+    batches.clear();
+    instances.clear();
+    first_arena_mesh = nullptr;
+    gpu_cull_inputs_buffer = 0;
+    u32 count = (u32) keys.size();
+    if(count == 0)
+    {
+        return;
+    }
+    radix_sort_keys(keys.data(), count, order, scratch);
+
+    // Instance i is the i-th item in sorted order, so a run of items drawn together is a range of instances
+    instances.resize(count);
+    for(u32 i = 0; i < count; ++i)
+    {
+        const draw_item_t& item = items[order[i]];
+        instances[i].model_matrix = *item.model_matrix;
+        instances[i].face_mask = item.face_mask;
+    }
+    if(b_gpu_cull)
+    {
+        gpu_cull_instances.resize(count);
+        for(u32 i = 0; i < count; ++i)
+        {
+            const draw_item_t& item = items[order[i]];
+            gpu_cull_instances[i].local_min = item.local_bounds->min;
+            gpu_cull_instances[i].local_max = item.local_bounds->max;
+            gpu_cull_instances[i].command_index = INDEX_NONE;
+            gpu_cull_instances[i].visibility_index = item.visibility_index;
+        }
+    }
+
+    // One draw command per run of items with the same shader, mesh and texture
+    u32 run_end;
+    for(u32 run_begin = 0; run_begin < count; run_begin = run_end)
+    {
+        const draw_item_t& item = items[order[run_begin]];
+        for(run_end = run_begin + 1; run_end < count; ++run_end)
+        {
+            const draw_item_t& next = items[order[run_end]];
+            if(next.shader != item.shader || next.mesh != item.mesh || next.texture != item.texture)
+            {
+                break;
+            }
+        }
+        if(!item.mesh->b_in_arena || item.mesh->indices_count == 0)
+        {
+            continue;
+        }
+        first_arena_mesh = first_arena_mesh ? first_arena_mesh : item.mesh;
+
+        multi_draw_batch_t* batch = batches.empty() ? nullptr : &batches.back();
+        bool b_samples_textures = item.shader->texture_samplers_uniform.is_valid();
+        u32 texture_slot = 0;
+        if(batch && batch->shader == item.shader && b_samples_textures)
+        {
+            while(texture_slot < batch->texture_count && batch->textures[texture_slot] != item.texture)
+            {
+                ++texture_slot;
+            }
+            if(texture_slot == MAX_DRAW_TEXTURES)
+            {
+                batch = nullptr; // out of texture units
+            }
+        }
+        if(!batch || batch->shader != item.shader)
+        {
+            multi_draw_batch_t new_batch;
+            new_batch.shader = item.shader;
+            new_batch.first_command = (u32) commands.size();
+            new_batch.command_count = 0;
+            new_batch.texture_count = 0;
+            batches.push_back(new_batch);
+            batch = &batches.back();
+            texture_slot = 0;
+        }
+        if(b_samples_textures && texture_slot == batch->texture_count)
+        {
+            batch->textures[batch->texture_count++] = item.texture;
+        }
+
+        draw_elements_indirect_command_t command;
+        command.count = item.mesh->indices_count;
+        command.instance_count = b_gpu_cull ? 0 : run_end - run_begin; // the GPU counts the visible ones
+        command.first_index = item.mesh->first_index;
+        command.base_vertex = item.mesh->base_vertex;
+        command.base_instance = run_begin;
+        if(b_gpu_cull)
+        {
+            for(u32 i = run_begin; i < run_end; ++i)
+            {
+                gpu_cull_instances[i].command_index = (u32) commands.size();
+            }
+        }
+        commands.push_back(command);
+        draw_texture_slots.push_back(texture_slot);
+        ++batch->command_count;
+        stats.instances_submitted += run_end - run_begin;
+    }
+}
+
+void render_queue_t::submit(const gpu_cull_params_t* gpu_cull)
+{
+    profiler_frame_stats_t& stats = profiler_get_frame_stats();
+    if(batches.empty())
+    {
+        return;
+    }
+    u32 count = (u32) instances.size();
+
+    // Everything is streamed with the per-draw data. GPU culling streams its inputs instead of the instances,
+    // and writes the visible instances and the commands' instance counts itself.
+    u32 instances_size = sizeof(instance_data_t) * count;
+    u32 gpu_cull_inputs_size = (sizeof(gpu_cull_instance_t) + sizeof(instance_data_t)) * count;
+    u32 commands_size = sizeof(draw_elements_indirect_command_t) * (u32) commands.size();
+    u32 draw_data_size = sizeof(u32) * (u32) draw_texture_slots.size();
+    u32 storage_alignment = gl_get_storage_buffer_offset_alignment();
+    draw_stream.reserve((gpu_cull ? gpu_cull_inputs_size : instances_size) + commands_size + draw_data_size + 4 * storage_alignment);
+    u32 id_instances;
+    u32 instances_offset;
+    uintptr_t commands_offset;
+    if(gpu_cull)
+    {
+        // The culling shader binds the commands as storage, so they need its alignment
+        commands_offset = draw_stream.push(commands.data(), commands_size, storage_alignment);
+        gl_dispatch_gpu_cull(*gpu_cull, (u32) commands_offset, commands_size);
+        shader_t::gl_use_shader(*batches[0].shader);
+        stats.program_binds += 2;
+        id_instances = id_instance_buffer;
+        instances_offset = 0;
+    }
+    else
+    {
+        instances_offset = draw_stream.push(instances.data(), instances_size);
+        commands_offset = draw_stream.push(commands.data(), commands_size);
+        id_instances = draw_stream.get_id();
+    }
+    u32 draw_data_offset = draw_stream.push(draw_texture_slots.data(), draw_data_size, storage_alignment);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, DRAW_DATA_SSBO_BINDING, draw_stream.get_id(), draw_data_offset, draw_data_size);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, draw_stream.get_id());
+
+    // Every arena mesh shares one VAO. Other queues may have pointed its instance attributes at their own buffer.
+    first_arena_mesh->gl_set_instance_buffer(id_instances, instances_offset);
+    ++stats.vao_binds;
+
+    shader_t* bound_shader = batches[0].shader; // bound by the pass
+    for(const multi_draw_batch_t& batch : batches)
+    {
+        if(batch.shader != bound_shader)
+        {
+            shader_t::gl_use_shader(*batch.shader);
+            bound_shader = batch.shader;
+            ++stats.program_binds;
+        }
+        for(u32 slot = 0; slot < batch.texture_count; ++slot)
+        {
+            if(gl_state_bind_texture(slot, GL_TEXTURE_2D, batch.textures[slot] ? batch.textures[slot]->texture_id : 0))
+            {
+                ++stats.texture_binds;
+            }
+            else
+            {
+                ++stats.redundant_binds_skipped;
+            }
+        }
+        if(batch.shader->draw_data_offset_uniform.is_valid())
+        {
+            batch.shader->gl_bind_1ui(batch.shader->draw_data_offset_uniform, batch.first_command);
+            ++stats.uniform_updates;
+        }
+
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                                    (void*) (commands_offset + sizeof(draw_elements_indirect_command_t) * batch.first_command),
+                                    batch.command_count, 0);
+        ++stats.draw_calls;
+        stats.draws_submitted += batch.command_count;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+gpu_cull_uniforms_t gl_get_gpu_cull_uniforms(shader_t& cull_shader)
+{
+    shader_t::gl_use_shader(cull_shader);
+    cull_shader.gl_bind_1i("hi_z", 0);
+
+    gpu_cull_uniforms_t uniforms;
+    uniforms.instance_count = cull_shader.get_uniform_handle("instance_count");
+    uniforms.frustum_count = cull_shader.get_uniform_handle("frustum_count");
+    uniforms.frustum_planes = cull_shader.get_uniform_handle("frustum_planes[0]");
+    uniforms.cull_sphere = cull_shader.get_uniform_handle("cull_sphere");
+    uniforms.occlusion_phase = cull_shader.get_uniform_handle("occlusion_phase");
+    uniforms.hi_z_level_count = cull_shader.get_uniform_handle("hi_z_level_count");
+    uniforms.occlusion_view_projection = cull_shader.get_uniform_handle("occlusion_view_projection");
+    return uniforms;
+}
+
+void render_queue_t::gl_dispatch_gpu_cull(const gpu_cull_params_t& gpu_cull, u32 commands_offset, u32 commands_size)
+{
+    u32 count = (u32) instances.size();
+    u32 cull_instances_size = sizeof(gpu_cull_instance_t) * count;
+    u32 source_instances_size = sizeof(instance_data_t) * count;
+    u32 storage_alignment = gl_get_storage_buffer_offset_alignment();
+    // Inputs stay the same when the commands are submitted again, unless a new frame began or the stream grew since
+    if(gpu_cull_inputs_buffer != draw_stream.get_id() || gpu_cull_inputs_frame != stream_buffers_get_frame_number())
+    {
+        gpu_cull_instances_offset = draw_stream.push(gpu_cull_instances.data(), cull_instances_size, storage_alignment);
+        gpu_cull_source_offset = draw_stream.push(instances.data(), source_instances_size, storage_alignment);
+        gpu_cull_inputs_buffer = draw_stream.get_id();
+        gpu_cull_inputs_frame = stream_buffers_get_frame_number();
+    }
+    if(source_instances_size > instance_buffer_capacity)
+    {
+        if(id_instance_buffer == 0)
+        {
+            glGenBuffers(1, &id_instance_buffer);
+        }
+        instance_buffer_capacity = kc_max(source_instances_size, instance_buffer_capacity * 2);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, id_instance_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, instance_buffer_capacity, nullptr, GL_DYNAMIC_COPY);
+    }
+    u32 id_stream = draw_stream.get_id();
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, GPU_CULL_INSTANCES_SSBO_BINDING, id_stream, gpu_cull_instances_offset, cull_instances_size);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, GPU_CULL_SOURCE_INSTANCES_SSBO_BINDING, id_stream, gpu_cull_source_offset, source_instances_size);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, GPU_CULL_VISIBLE_INSTANCES_SSBO_BINDING, id_instance_buffer, 0, source_instances_size);
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, GPU_CULL_COMMANDS_SSBO_BINDING, id_stream, commands_offset, commands_size);
+
+    shader_t& cull_shader = *gpu_cull.cull_shader;
+    const gpu_cull_uniforms_t& uniforms = *gpu_cull.cull_uniforms;
+    shader_t::gl_use_shader(cull_shader);
+    cull_shader.gl_bind_1ui(uniforms.instance_count, count);
+    const cull_view_t* cull_view = gpu_cull.cull_view;
+    cull_shader.gl_bind_1i(uniforms.frustum_count, cull_view ? cull_view->frustum_count : 0);
+    if(cull_view && cull_view->frustum_count > 0)
+    {
+        cull_shader.gl_bind_4fv(uniforms.frustum_planes, cull_view->frustum_count * 6, (const float*) cull_view->frusta);
+        if(cull_view->b_sphere)
+        {
+            cull_shader.gl_bind_4f(uniforms.cull_sphere, cull_view->sphere_center.x, cull_view->sphere_center.y,
+                                   cull_view->sphere_center.z, cull_view->sphere_radius);
+        }
+        else
+        {
+            cull_shader.gl_bind_4f(uniforms.cull_sphere, 0.f, 0.f, 0.f, -1.f);
+        }
+    }
+
+    cull_shader.gl_bind_1i(uniforms.occlusion_phase, gpu_cull.occlusion_phase);
+    if(gpu_cull.occlusion_phase != OCCLUSION_PHASE_NONE)
+    {
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_VISIBILITY_SSBO_BINDING, gpu_cull.occlusion_visibility_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, GPU_CULL_OCCLUSION_STATS_SSBO_BINDING, gpu_cull.occlusion_stats_buffer);
+    }
+    if(gpu_cull.occlusion_phase == OCCLUSION_PHASE_NEWLY_VISIBLE)
+    {
+        gl_state_bind_texture(0, GL_TEXTURE_2D, gpu_cull.hi_z_texture);
+        cull_shader.gl_bind_1i(uniforms.hi_z_level_count, gpu_cull.hi_z_level_count);
+        cull_shader.gl_bind_matrix4fv(uniforms.occlusion_view_projection, 1, gpu_cull.occlusion_view_projection.ptr());
+    }
+
+    const u32 GPU_CULL_GROUP_SIZE = 64;
+    glDispatchCompute((count + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+    // The draws read the commands, and the instances as vertex attributes. The next cull reads the visibility.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+
+    profiler_get_frame_stats().instances_gpu_tested += count;
+}
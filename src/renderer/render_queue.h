@@ -0,0 +1,173 @@
+#pragma once
+
+#include <vector>
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+#include "mesh.h"
+#include "shader.h"
+#include "stream_buffer.h"
+
+struct texture_t;
+struct aabb_t;
+struct cull_view_t;
+
+/** One draw call: a mesh, the state it needs, and the key it gets sorted by */
+struct draw_item_t
+{
+    u64                 sort_key = 0;
+    shader_t*           shader = nullptr;
+    mesh_t*             mesh = nullptr;
+    const texture_t*    texture = nullptr;   // nullptr: no texture
+    const mat4*         model_matrix = nullptr;
+    u32                 face_mask = 0x3f;    // see omni_shadow_map.geom
+    const aabb_t*       local_bounds = nullptr; // model space bounds of mesh, needed for GPU culling
+    u32                 visibility_index = INDEX_NONE; // slot in the occlusion visibility buffer, see gpu_cull_params_t
+};
+
+/** Makes a sort key that groups draws by shader, then texture, then mesh, then front to back.
+    Bits 63-56: shader program, 55-40: texture, 39-16: mesh, 15-0: view depth.
+    mesh_id only has to tell meshes apart (e.g. mesh_t::first_index for arena meshes). */
+u64 make_draw_sort_key(u32 shader_program, u32 texture_id, u32 mesh_id, float view_depth);
+
+/** Sorts keys with an LSD radix sort, 8 bits per pass. order receives the indices of keys in sorted
+    order. Passes where every key has the same byte are skipped. */
+void radix_sort_keys(const u64* keys, u32 count, std::vector<u32>& order, std::vector<u32>& scratch);
+
+/** Layout of the commands read by glMultiDrawElementsIndirect */
+struct draw_elements_indirect_command_t
+{
+    u32 count;
+    u32 instance_count;
+    u32 first_index;
+    i32 base_vertex;
+    u32 base_instance;
+};
+
+/** Shader storage binding of the per-draw data (one u32 texture slot per draw), indexed with
+    draw_data_offset + gl_DrawIDARB. See deferred_geometry_pass.vert */
+#define DRAW_DATA_SSBO_BINDING 5
+/** Textures one multi-draw can use. Bound to texture units 0 to MAX_DRAW_TEXTURES - 1, read through
+    the shader's texture_samplers array. */
+#define MAX_DRAW_TEXTURES 16
+
+/** Shader storage bindings used by gpu_instance_culling.comp */
+#define GPU_CULL_INSTANCES_SSBO_BINDING 6
+#define GPU_CULL_SOURCE_INSTANCES_SSBO_BINDING 7
+#define GPU_CULL_VISIBLE_INSTANCES_SSBO_BINDING 8
+#define GPU_CULL_COMMANDS_SSBO_BINDING 9
+#define GPU_CULL_VISIBILITY_SSBO_BINDING 10
+#define GPU_CULL_OCCLUSION_STATS_SSBO_BINDING 11
+
+/** Two-phase occlusion culling (see gpu_cull_params_t::occlusion_phase) */
+#define OCCLUSION_PHASE_NONE 0
+#define OCCLUSION_PHASE_PREVIOUSLY_VISIBLE 1   // draw what was visible last frame and is in the frustum
+#define OCCLUSION_PHASE_NEWLY_VISIBLE 2        // test everything in the frustum against the Hi-Z, draw what wasn't drawn in phase 1
+
+/** Per-instance input of gpu_instance_culling.comp (std430 layout) */
+struct gpu_cull_instance_t
+{
+    vec3    local_min;
+    u32     command_index; // INDEX_NONE if the instance isn't drawn
+    vec3    local_max;
+    u32     visibility_index; // INDEX_NONE if the instance doesn't take part in occlusion culling
+};
+
+/** Uniforms of gpu_instance_culling.comp set on every dispatch */
+struct gpu_cull_uniforms_t
+{
+    uniform_handle_t    instance_count;
+    uniform_handle_t    frustum_count;
+    uniform_handle_t    frustum_planes;
+    uniform_handle_t    cull_sphere;
+    uniform_handle_t    occlusion_phase;
+    uniform_handle_t    hi_z_level_count;
+    uniform_handle_t    occlusion_view_projection;
+};
+
+/** Looks up the handles and points the hi_z sampler at texture unit 0. Call once after loading the cull shader. */
+gpu_cull_uniforms_t gl_get_gpu_cull_uniforms(shader_t& cull_shader);
+
+/** Culling a render queue on the GPU instead of on the CPU: a compute pass tests every queued instance's
+    bounds against cull_view and compacts the visible ones into each draw command's instance range.
+
+    Occlusion culling takes two submissions of the same queue: sort_and_submit with OCCLUSION_PHASE_PREVIOUSLY_VISIBLE,
+    then (after building a Hi-Z pyramid from the depth that drew) submit with OCCLUSION_PHASE_NEWLY_VISIBLE.
+    The visibility buffer holds one u32 per visibility_index, 1 if it was visible when last tested; phase 2
+    rewrites it for the next frame. The stats buffer's first u32 gets the number of instances phase 2 found occluded. */
+struct gpu_cull_params_t
+{
+    shader_t*           cull_shader = nullptr; // gpu_instance_culling.comp
+    const gpu_cull_uniforms_t* cull_uniforms = nullptr; // from gl_get_gpu_cull_uniforms(*cull_shader)
+    const cull_view_t*  cull_view = nullptr;   // nullptr: don't cull, but still go through the compute pass
+
+    i32                 occlusion_phase = OCCLUSION_PHASE_NONE;
+    u32                 occlusion_visibility_buffer = 0;
+    u32                 occlusion_stats_buffer = 0;
+    /** Phase 2 only: max depth pyramid of the phase 1 depth buffer (R32F, hi_z_level_count mips),
+        and the view projection it was drawn with */
+    u32                 hi_z_texture = 0;
+    i32                 hi_z_level_count = 0;
+    mat4                occlusion_view_projection;
+};
+
+/** Per-pass render queue: collect draw items, then sort them by key and submit them in one go.
+    Every mesh must live in the mesh arena (see mesh_arena_t): the whole queue is drawn from the arena's
+    VAO with as few glMultiDrawElementsIndirect calls as possible, usually one.
+    Items that end up next to each other with the same shader, mesh and texture (e.g. objects sharing a
+    mesh_group_t) become one instanced draw command. Their model matrices and face masks are streamed
+    into an instance buffer as instance_data_t, so shaders read them as vertex attributes
+    (see INSTANCE_MATRIX_ATTRIB_LOCATION). If the shader has a texture_samplers array, each draw's
+    texture slot goes into a per-draw storage buffer, and a new multi-draw starts whenever the textures
+    don't fit in MAX_DRAW_TEXTURES units. State changes and calls made are counted in profiler_get_frame_stats.
+    With gpu_cull, the queue is expected to hold every instance (with local_bounds set), and the draw
+    commands' instance counts are filled in by a compute pass before drawing. */
+struct render_queue_t
+{
+    void clear();
+    void push(const draw_item_t& item);
+    void sort_and_submit(const gpu_cull_params_t* gpu_cull = nullptr);
+    /** Draws the commands built by the last sort_and_submit again, culled with gpu_cull if the last
+        sort_and_submit was GPU culled too, e.g. for the second phase of occlusion culling */
+    void submit(const gpu_cull_params_t* gpu_cull = nullptr);
+
+    u32 size() const { return (u32) items.size(); }
+
+private:
+    /** Draw commands submitted with one glMultiDrawElementsIndirect */
+    struct multi_draw_batch_t
+    {
+        shader_t*           shader;
+        u32                 first_command;
+        u32                 command_count;
+        u32                 texture_count;
+        const texture_t*    textures[MAX_DRAW_TEXTURES];
+    };
+
+    std::vector<draw_item_t>    items;
+    std::vector<u64>            keys;
+    std::vector<u32>            order;
+    std::vector<u32>            scratch;
+    std::vector<instance_data_t> instances;
+    std::vector<draw_elements_indirect_command_t> commands;
+    std::vector<u32>            draw_texture_slots;
+    std::vector<multi_draw_batch_t> batches;
+    std::vector<gpu_cull_instance_t> gpu_cull_instances;
+    /** Instances (the GPU culling inputs if GPU culled), draw commands and the per-draw data, rewritten every submit */
+    stream_buffer_t             draw_stream;
+    /** Visible instances written by GPU culling. Only the GPU writes it, so it's kept between submits and only grows. */
+    u32                         id_instance_buffer = 0;
+    u32                         instance_buffer_capacity = 0; // bytes
+    /** Where the GPU culling inputs of the last build are in draw_stream: buffer id (0 if not pushed yet), frame and offsets */
+    u32                         gpu_cull_inputs_buffer = 0;
+    u64                         gpu_cull_inputs_frame = 0;
+    u32                         gpu_cull_instances_offset = 0;
+    u32                         gpu_cull_source_offset = 0;
+    mesh_t*                     first_arena_mesh = nullptr;
+
+    /** Sorts the items and builds instances, draw commands and batches from them */
+    void build_draw_commands(bool b_gpu_cull);
+
+    /** Fills the instance counts of the draw commands streamed at commands_offset and the instance buffer with
+        the visible instances */
+    void gl_dispatch_gpu_cull(const gpu_cull_params_t& gpu_cull, u32 commands_offset, u32 commands_size);
+};
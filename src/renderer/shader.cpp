@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <cstring>
 #include "shader.h"
 #include "../debugging/console.h"
 #include "../core/file_system.h"
+#include "../debugging/profiling/profiler.h"
+#include "gl_state.h"
 
 /** Telling opengl to start using this shader program */
 void shader_t::gl_use_shader(shader_t& shader)
@@ -10,7 +14,7 @@ void shader_t::gl_use_shader(shader_t& shader)
         console_printf("WARNING: Passed an unloaded shader program to gl_use_shader! Aborting.\n");
         return;
     }
-    glUseProgram(shader.id_shader_program);
+    gl_state_use_program(shader.id_shader_program);
 }
 
 /** Delete the shader program off GPU memory */
@@ -21,6 +25,7 @@ void shader_t::gl_delete_shader(shader_t& shader)
         console_printf("WARNING: Passed an unloaded shader program to gl_delete_shader! Aborting.\n");
         return;
     }
+    gl_state_forget_program(shader.id_shader_program);
     glDeleteProgram(shader.id_shader_program);
 }
 
@@ -132,9 +137,14 @@ void shader_t::gl_load_shader_program_from_file(shader_t& shader, const char* ve
     gl_create_shader_program(shader, v.c_str(), g.c_str(), f.c_str());
 }
 
-void shader_t::gl_load_compute_shader_program_from_file(shader_t& shader, const char* compute_path)
+void shader_t::gl_load_compute_shader_program_from_file(shader_t& shader, const char* compute_path, const char* defines)
 {
     std::string c = read_file_string(compute_path);
+    if(defines)
+    {
+        size_t version_line_end = c.find('\n', c.find("#version"));
+        c.insert(version_line_end == std::string::npos ? c.size() : version_line_end + 1, defines);
+    }
     gl_create_compute_shader_program(shader, c.c_str());
 }
 
@@ -159,9 +169,25 @@ void shader_t::cache_uniform_locations(shader_t &shader)
     */
     for (GLint i = 0; i < number_of_uniforms; ++i)
     {
+        // Members of uniform blocks have no location, they're set through the block's buffer
+        GLuint uniform_index = (GLuint) i;
+        GLint block_index;
+        glGetActiveUniformsiv(shader.id_shader_program, 1, &uniform_index, GL_UNIFORM_BLOCK_INDEX, &block_index);
+        if (block_index != -1)
+        {
+            continue;
+        }
         glGetActiveUniform(shader.id_shader_program, i, longest_uniform_name_length, &readlength, &size, &type, uniform_name);
         cache_uniform_location(shader, uniform_name);
     }
+
+    std::sort(shader.uniform_locations.begin(), shader.uniform_locations.end(),
+              [](const cached_uniform_location_t& a, const cached_uniform_location_t& b) { return a.name_hash < b.name_hash; });
+
+    shader.draw_data_offset_uniform = shader.get_uniform_handle("draw_data_offset");
+    shader.texture_samplers_uniform = shader.get_uniform_handle("texture_samplers[0]");
+    shader.material_specular_intensity_uniform = shader.get_uniform_handle("material.specular_intensity");
+    shader.material_shininess_uniform = shader.get_uniform_handle("material.shininess");
 }
 
 void shader_t::cache_uniform_location(shader_t& shader, const char *uniform_name)
@@ -169,7 +195,8 @@ void shader_t::cache_uniform_location(shader_t& shader, const char *uniform_name
     i32 location = glGetUniformLocation(shader.id_shader_program, uniform_name);
     if (location != 0xffffffff)
     {
-        shader.uniform_locations[std::string(uniform_name)] = location;
+        cached_uniform_location_t cached = { hash_uniform_name(uniform_name), location, uniform_name };
+        shader.uniform_locations.push_back(cached);
     }
     else
     {
@@ -202,6 +229,7 @@ void shader_t::gl_bind_1i(const char* uniform_name, GLint v0) const
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform1i(location, v0);
     }
     else
@@ -215,6 +243,7 @@ void shader_t::gl_bind_2i(const char* uniform_name, GLint v0, GLint v1) const
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform2i(location, v0, v1);
     }
     else
@@ -228,6 +257,7 @@ void shader_t::gl_bind_3i(const char* uniform_name, GLint v0, GLint v1, GLint v2
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform3i(location, v0, v1, v2);
     }
     else
@@ -241,6 +271,7 @@ void shader_t::gl_bind_4i(const char* uniform_name, GLint v0, GLint v1, GLint v2
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform4i(location, v0, v1, v2, v3);
     }
     else
@@ -254,6 +285,7 @@ void shader_t::gl_bind_1f(const char* uniform_name, GLfloat v0) const
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform1f(location, v0);
     }
     else
@@ -267,6 +299,7 @@ void shader_t::gl_bind_2f(const char* uniform_name, GLfloat v0, GLfloat v1) cons
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform2f(location, v0, v1);
     }
     else
@@ -280,6 +313,7 @@ void shader_t::gl_bind_3f(const char* uniform_name, GLfloat v0, GLfloat v1, GLfl
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform3f(location, v0, v1, v2);
     }
     else
@@ -293,6 +327,7 @@ void shader_t::gl_bind_4f(const char* uniform_name, GLfloat v0, GLfloat v1, GLfl
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniform4f(location, v0, v1, v2, v3);
     }
     else
@@ -306,6 +341,7 @@ void shader_t::gl_bind_matrix3fv(const char* uniform_name, const GLsizei count,
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniformMatrix3fv(location, count, GL_FALSE, value);
     }
     else
@@ -319,6 +355,7 @@ void shader_t::gl_bind_matrix4fv(const char* uniform_name, const GLsizei count,
     i32 location = get_cached_uniform_location(uniform_name);
     if(location >= 0)
     {
+        ++profiler_get_frame_stats().uniform_calls;
         glUniformMatrix4fv(location, count, GL_FALSE, value);
     }
     else
@@ -327,16 +364,112 @@ void shader_t::gl_bind_matrix4fv(const char* uniform_name, const GLsizei count,
     }
 }
 
+void shader_t::gl_bind_1i(uniform_handle_t uniform, GLint v0) const
+{
+    if(uniform.is_valid())
+    {
+        ++profiler_get_frame_stats().uniform_calls;
+        glUniform1i(uniform.location, v0);
+    }
+}
+
+void shader_t::gl_bind_1ui(uniform_handle_t uniform, GLuint v0) const
+{
+    if(uniform.is_valid())
+    {
+        ++profiler_get_frame_stats().uniform_calls;
+        glUniform1ui(uniform.location, v0);
+    }
+}
+
+void shader_t::gl_bind_1f(uniform_handle_t uniform, GLfloat v0) const
+{
+    if(uniform.is_valid())
+    {
+        ++profiler_get_frame_stats().uniform_calls;
+        glUniform1f(uniform.location, v0);
+    }
+}
+
+void shader_t::gl_bind_4f(uniform_handle_t uniform, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) const
+{
+    if(uniform.is_valid())
+    {
+        ++profiler_get_frame_stats().uniform_calls;
+        glUniform4f(uniform.location, v0, v1, v2, v3);
+    }
+}
+
+void shader_t::gl_bind_1iv(uniform_handle_t uniform, GLsizei count, const GLint* value) const
+{
+    if(uniform.is_valid())
+    {
+        ++profiler_get_frame_stats().uniform_calls;
+        glUniform1iv(uniform.location, count, value);
+    }
+}
+
+void shader_t::gl_bind_4fv(uniform_handle_t uniform, GLsizei count, const GLfloat* value) const
+{
+    if(uniform.is_valid())
+    {
+        ++profiler_get_frame_stats().uniform_calls;
+        glUniform4fv(uniform.location, count, value);
+    }
+}
+
+void shader_t::gl_bind_matrix4fv(uniform_handle_t uniform, GLsizei count, const GLfloat* value) const
+{
+    if(uniform.is_valid())
+    {
+        ++profiler_get_frame_stats().uniform_calls;
+        glUniformMatrix4fv(uniform.location, count, GL_FALSE, value);
+    }
+}
+
+/** FNV-1a */
+u32 shader_t::hash_uniform_name(const char* uniform_name)
+{
+    u32 hash = 2166136261u;
+    for(const char* c = uniform_name; *c; ++c)
+    {
+        hash ^= (u8) *c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uniform_handle_t shader_t::get_uniform_handle(const char* uniform_name) const
+{
+    uniform_handle_t uniform;
+    uniform.location = get_cached_uniform_location(uniform_name);
+    return uniform;
+}
+
 i32 shader_t::get_cached_uniform_location(const char* uniform_name) const
 {
-    auto location_iter = uniform_locations.find(uniform_name);
-    if(location_iter != uniform_locations.end())
+    u32 name_hash = hash_uniform_name(uniform_name);
+    auto location_iter = std::lower_bound(uniform_locations.begin(), uniform_locations.end(), name_hash,
+                                          [](const cached_uniform_location_t& cached, u32 hash) { return cached.name_hash < hash; });
+    for(; location_iter != uniform_locations.end() && location_iter->name_hash == name_hash; ++location_iter)
     {
-        return location_iter->second;
+        if(strcmp(location_iter->name.c_str(), uniform_name) == 0)
+        {
+            return location_iter->location;
+        }
     }
     return -1;
 }
 
+void shader_t::gl_bind_uniform_block(const char* block_name, GLuint binding) const
+{
+    GLuint block_index = glGetUniformBlockIndex(id_shader_program, block_name);
+    if(block_index != GL_INVALID_INDEX)
+    {
+        glUniformBlockBinding(id_shader_program, block_index, binding);
+    }
+}
+
 void shader_t::warning_uniform_not_found(const char* uniform_name) const
 {
     console_printf("Warning: Uniform '%s' doesn't exist or isn't active on shader %d.\n", uniform_name, id_shader_program);
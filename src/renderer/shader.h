@@ -1,9 +1,19 @@
 #pragma once
 
 #include "../game_defines.h"
-#include <unordered_map>
+#include <string>
+#include <vector>
 #include <GL/glew.h>
 
+/** Location of a uniform in one shader program, looked up once with shader_t::get_uniform_handle (e.g. after
+    loading the program) so that binding it later skips the name lookup. Invalid if the uniform isn't active. */
+struct uniform_handle_t
+{
+    i32 location = -1;
+
+    bool is_valid() const { return location >= 0; }
+};
+
 /** Handle for Shader Program stored in GPU memory */
 struct shader_t
 {
@@ -19,7 +29,8 @@ struct shader_t
 
     static void gl_create_shader_program(shader_t& shader, const char* vertex_shader_str, const char* geometry_shader_str, const char* fragment_shader_str);
 
-    static void gl_load_compute_shader_program_from_file(shader_t& shader, const char* compute_path);
+    /** defines (e.g. "#define MAX_LIGHTS 256\n") are inserted after the shader's #version line */
+    static void gl_load_compute_shader_program_from_file(shader_t& shader, const char* compute_path, const char* defines = nullptr);
 
     static void gl_create_compute_shader_program(shader_t& shader, const char* compute_shader_str);
 
@@ -34,11 +45,46 @@ struct shader_t
     void gl_bind_matrix3fv(const char* uniform_name, GLsizei count, const GLfloat* value) const;
     void gl_bind_matrix4fv(const char* uniform_name, GLsizei count, const GLfloat* value) const;
 
+    /** Same as above without the name lookup. Invalid handles are skipped without a warning, the uniform
+        may have been optimized out. */
+    void gl_bind_1i(uniform_handle_t uniform, GLint v0) const;
+    void gl_bind_1ui(uniform_handle_t uniform, GLuint v0) const;
+    void gl_bind_1f(uniform_handle_t uniform, GLfloat v0) const;
+    void gl_bind_4f(uniform_handle_t uniform, GLfloat v0, GLfloat v1, GLfloat v2, GLfloat v3) const;
+    void gl_bind_1iv(uniform_handle_t uniform, GLsizei count, const GLint* value) const;
+    void gl_bind_4fv(uniform_handle_t uniform, GLsizei count, const GLfloat* value) const;
+    void gl_bind_matrix4fv(uniform_handle_t uniform, GLsizei count, const GLfloat* value) const;
+
+    /** Doesn't allocate: names are hashed and looked up in the locations cached when the program was linked, then
+        compared in full, so names with the same hash don't mix up. Arrays are found by the name of their first
+        element, e.g. "texture_samplers[0]". */
+    uniform_handle_t get_uniform_handle(const char* uniform_name) const;
     i32 get_cached_uniform_location(const char* uniform_name) const;
+
+    /** Points the program's uniform block at a uniform buffer binding. Does nothing if the program has no such block. */
+    void gl_bind_uniform_block(const char* block_name, GLuint binding) const;
+
+    GLuint get_program_id() const { return id_shader_program; }
+
+    /** Uniforms set on every scene draw with this shader (by render_queue_t and game_state::render_scene),
+        looked up when the program is linked */
+    uniform_handle_t draw_data_offset_uniform;
+    uniform_handle_t texture_samplers_uniform;
+    uniform_handle_t material_specular_intensity_uniform;
+    uniform_handle_t material_shininess_uniform;
 private:
     GLuint id_shader_program = 0; // id of this shader program in GPU memory
 
-    std::unordered_map<std::string, i32> uniform_locations;
+    struct cached_uniform_location_t
+    {
+        u32 name_hash;
+        i32 location;
+        std::string name;
+    };
+    /** Sorted by name_hash */
+    std::vector<cached_uniform_location_t> uniform_locations;
+
+    static u32 hash_uniform_name(const char* uniform_name);
 
     static void cache_uniform_locations(shader_t& shader);
 
@@ -1,4 +1,6 @@
 #include "skybox_renderer.h"
+#include "deferred_renderer.h"
+#include "gl_state.h"
 #include "../core/kc_math.h"
 
 INTERNAL u32 skybox_indices[] = {
@@ -41,24 +43,18 @@ void skybox_renderer::init()
     load_shader();
 }
 
-void skybox_renderer::render(const camera_t& camera)
+void skybox_renderer::render()
 {
     shader_t::gl_use_shader(skybox_shader);
 
-    mat4 skybox_view_matrix = make_mat4(make_mat3(camera.matrix_view));
-    skybox_shader.gl_bind_matrix4fv("matrix_view", 1, skybox_view_matrix.ptr());
-    skybox_shader.gl_bind_matrix4fv("matrix_proj_perspective", 1, camera.matrix_perspective.ptr());
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_cubemap.texture_id);
+    gl_state_bind_texture(0, GL_TEXTURE_CUBE_MAP, skybox_cubemap.texture_id);
 
     skybox_mesh.gl_render_mesh();
-
-    glUseProgram(0);
 }
 
 void skybox_renderer::load_shader()
 {
     shader_t::gl_load_shader_program_from_file(skybox_shader, "shaders/skybox.vert", "shaders/skybox.frag");
+    skybox_shader.gl_bind_uniform_block("frame_constants", FRAME_CONSTANTS_UBO_BINDING);
 }
 
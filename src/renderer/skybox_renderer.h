@@ -9,7 +9,8 @@ struct skybox_renderer
 {
     void init();
 
-    void render(const camera_t& camera);
+    /** Reads the camera from the frame constants, see deferred_renderer::gl_upload_frame_constants */
+    void render();
 
     cubemap_t   skybox_cubemap;
 
@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <cfloat>
+#include "software_occlusion.h"
+
+/** Outcode bits of a clip space position: outside which clip planes it is */
+#define CLIP_LEFT   0x01
+#define CLIP_RIGHT  0x02
+#define CLIP_BOTTOM 0x04
+#define CLIP_TOP    0x08
+#define CLIP_NEAR   0x10
+#define CLIP_FAR    0x20
+
+INTERNAL u32 get_outcode(vec4 clip)
+{
+    u32 code = 0;
+    code |= clip.x < -clip.w ? CLIP_LEFT : 0;
+    code |= clip.x > clip.w ? CLIP_RIGHT : 0;
+    code |= clip.y < -clip.w ? CLIP_BOTTOM : 0;
+    code |= clip.y > clip.w ? CLIP_TOP : 0;
+    code |= clip.z < -clip.w ? CLIP_NEAR : 0;
+    code |= clip.z > clip.w ? CLIP_FAR : 0;
+    return code;
+}
+
+INTERNAL vec4 lerp_clip(vec4 a, vec4 b, float t)
+{
+    return make_vec4(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+}
+
+software_occlusion_buffer_t::software_occlusion_buffer_t()
+    : next_tile(0)
+{
+    set_resolution(SOFTWARE_OCCLUSION_WIDTH, SOFTWARE_OCCLUSION_HEIGHT);
+}
+
+software_occlusion_buffer_t::~software_occlusion_buffer_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        b_stop_workers = true;
+    }
+    pool_wake.notify_all();
+    for(std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void software_occlusion_buffer_t::set_resolution(i32 new_width, i32 new_height)
+{
+    width = (kc_max(new_width, 4) + 3) & ~3;
+    height = kc_max(new_height, 1);
+    tiles_x = (width + SOFTWARE_OCCLUSION_TILE_WIDTH - 1) / SOFTWARE_OCCLUSION_TILE_WIDTH;
+    tiles_y = (height + SOFTWARE_OCCLUSION_TILE_HEIGHT - 1) / SOFTWARE_OCCLUSION_TILE_HEIGHT;
+    depth.assign((size_t) width * height, 1.f);
+    tile_bins.assign(tiles_x * tiles_y, std::vector<u32>());
+    triangles.clear();
+}
+
+void software_occlusion_buffer_t::begin(const mat4& in_view_projection)
+{
+    view_projection = in_view_projection;
+    triangles.clear();
+    for(std::vector<u32>& bin : tile_bins)
+    {
+        bin.clear();
+    }
+}
+
+void software_occlusion_buffer_t::add_occluder(const vec3* positions, u32 vertex_count, const u32* indices, u32 index_count,
+                                               const mat4& model_matrix)
+{
+    mat4 model_view_projection = view_projection * model_matrix;
+    clip_positions.resize(vertex_count);
+    for(u32 i = 0; i < vertex_count; ++i)
+    {
+        clip_positions[i] = model_view_projection * make_vec4(positions[i].x, positions[i].y, positions[i].z, 1.f);
+    }
+
+    auto to_window = [this](vec4 clip) -> vec3 {
+        float inverse_w = 1.f / clip.w;
+        return make_vec3((clip.x * inverse_w * 0.5f + 0.5f) * (float) width,
+                         (clip.y * inverse_w * 0.5f + 0.5f) * (float) height,
+                         clip.z * inverse_w * 0.5f + 0.5f);
+    };
+
+    for(u32 i = 0; i + 2 < index_count; i += 3)
+    {
+        vec4 v[3] = { clip_positions[indices[i]], clip_positions[indices[i + 1]], clip_positions[indices[i + 2]] };
+        u32 codes[3] = { get_outcode(v[0]), get_outcode(v[1]), get_outcode(v[2]) };
+        if(codes[0] & codes[1] & codes[2])
+        {
+            continue; // all three outside the same plane
+        }
+        if(!((codes[0] | codes[1] | codes[2]) & CLIP_NEAR))
+        {
+            add_screen_triangle(to_window(v[0]), to_window(v[1]), to_window(v[2]));
+            continue;
+        }
+
+        // Clip against the near plane (z + w >= 0), which leaves up to a quad. The other planes only
+        // limit the screen bounds, which binning takes care of.
+        vec4 polygon[4];
+        i32 polygon_count = 0;
+        for(i32 j = 0; j < 3; ++j)
+        {
+            vec4 a = v[j];
+            vec4 b = v[(j + 1) % 3];
+            float distance_a = a.z + a.w;
+            float distance_b = b.z + b.w;
+            if(distance_a >= 0.f)
+            {
+                polygon[polygon_count++] = a;
+            }
+            if((distance_a >= 0.f) != (distance_b >= 0.f))
+            {
+                polygon[polygon_count++] = lerp_clip(a, b, distance_a / (distance_a - distance_b));
+            }
+        }
+        for(i32 j = 2; j < polygon_count; ++j)
+        {
+            add_screen_triangle(to_window(polygon[0]), to_window(polygon[j - 1]), to_window(polygon[j]));
+        }
+    }
+}
+
+void software_occlusion_buffer_t::add_screen_triangle(vec3 p0, vec3 p1, vec3 p2)
+{
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+    if(kc_abs(area) < 1e-6f)
+    {
+        return;
+    }
+    if(area < 0.f)
+    {
+        std::swap(p1, p2);
+        area = -area;
+    }
+
+    // Pixels whose centers are inside the triangle's bounds
+    occluder_triangle_t triangle;
+    triangle.min_x = kc_max((i32) ceilf(kc_min(p0.x, kc_min(p1.x, p2.x)) - 0.5f), 0);
+    triangle.min_y = kc_max((i32) ceilf(kc_min(p0.y, kc_min(p1.y, p2.y)) - 0.5f), 0);
+    triangle.max_x = kc_min((i32) floorf(kc_max(p0.x, kc_max(p1.x, p2.x)) - 0.5f), width - 1);
+    triangle.max_y = kc_min((i32) floorf(kc_max(p0.y, kc_max(p1.y, p2.y)) - 0.5f), height - 1);
+    if(triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y)
+    {
+        return;
+    }
+
+    // Edge i is opposite vertex i
+    const vec3* edge_starts[3] = { &p1, &p2, &p0 };
+    const vec3* edge_ends[3] = { &p2, &p0, &p1 };
+    for(i32 i = 0; i < 3; ++i)
+    {
+        const vec3& a = *edge_starts[i];
+        const vec3& b = *edge_ends[i];
+        triangle.edge_a[i] = a.y - b.y;
+        triangle.edge_b[i] = b.x - a.x;
+        triangle.edge_c[i] = a.x * b.y - a.y * b.x;
+    }
+    triangle.depth_a = ((p1.z - p0.z) * (p2.y - p0.y) - (p2.z - p0.z) * (p1.y - p0.y)) / area;
+    triangle.depth_b = ((p2.z - p0.z) * (p1.x - p0.x) - (p1.z - p0.z) * (p2.x - p0.x)) / area;
+    triangle.depth_c = p0.z - triangle.depth_a * p0.x - triangle.depth_b * p0.y;
+
+    u32 triangle_index = (u32) triangles.size();
+    triangles.push_back(triangle);
+    for(i32 tile_y = triangle.min_y / SOFTWARE_OCCLUSION_TILE_HEIGHT; tile_y <= triangle.max_y / SOFTWARE_OCCLUSION_TILE_HEIGHT; ++tile_y)
+    {
+        for(i32 tile_x = triangle.min_x / SOFTWARE_OCCLUSION_TILE_WIDTH; tile_x <= triangle.max_x / SOFTWARE_OCCLUSION_TILE_WIDTH; ++tile_x)
+        {
+            tile_bins[tile_y * tiles_x + tile_x].push_back(triangle_index);
+        }
+    }
+}
+
+void software_occlusion_buffer_t::rasterize()
+{
+    i32 tile_count = tiles_x * tiles_y;
+    i32 job_thread_count = (u32) triangles.size() < min_threaded_triangles ? 1 : kc_min(thread_count, tile_count);
+    next_tile = 0;
+    if(job_thread_count > 1)
+    {
+        // job_generation only changes on this thread, so new workers can start from the current one
+        while((i32) workers.size() < job_thread_count - 1)
+        {
+            workers.emplace_back(&software_occlusion_buffer_t::worker_loop, this, (i32) workers.size(), job_generation);
+        }
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            job_worker_count = job_thread_count - 1;
+            workers_running = job_worker_count;
+            ++job_generation;
+        }
+        pool_wake.notify_all();
+    }
+
+    rasterize_tiles();
+
+    if(job_thread_count > 1)
+    {
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        pool_done.wait(lock, [this]() { return workers_running == 0; });
+    }
+}
+
+void software_occlusion_buffer_t::rasterize_tiles()
+{
+    i32 tile_count = tiles_x * tiles_y;
+    for(i32 tile = next_tile++; tile < tile_count; tile = next_tile++)
+    {
+        rasterize_tile(tile);
+    }
+}
+
+void software_occlusion_buffer_t::worker_loop(i32 worker_index, u32 job_generation_seen)
+{
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            pool_wake.wait(lock, [this, job_generation_seen]() { return b_stop_workers || job_generation != job_generation_seen; });
+            if(b_stop_workers)
+            {
+                return;
+            }
+            job_generation_seen = job_generation;
+            if(worker_index >= job_worker_count)
+            {
+                continue; // fewer threads than workers this time
+            }
+        }
+
+        rasterize_tiles();
+
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            --workers_running;
+        }
+        pool_done.notify_one();
+    }
+}
+
+void software_occlusion_buffer_t::rasterize_tile(i32 tile)
+{
+    i32 tile_min_x = (tile % tiles_x) * SOFTWARE_OCCLUSION_TILE_WIDTH;
+    i32 tile_min_y = (tile / tiles_x) * SOFTWARE_OCCLUSION_TILE_HEIGHT;
+    i32 tile_max_x = kc_min(tile_min_x + SOFTWARE_OCCLUSION_TILE_WIDTH, width) - 1;
+    i32 tile_max_y = kc_min(tile_min_y + SOFTWARE_OCCLUSION_TILE_HEIGHT, height) - 1;
+    for(i32 y = tile_min_y; y <= tile_max_y; ++y)
+    {
+        std::fill(depth.begin() + y * width + tile_min_x, depth.begin() + y * width + tile_max_x + 1, 1.f);
+    }
+
+    for(u32 triangle_index : tile_bins[tile])
+    {
+        const occluder_triangle_t& triangle = triangles[triangle_index];
+        // Tiles and rows are a multiple of 4 pixels wide, so starting on a multiple of 4 keeps every group of 4 in the tile
+        i32 min_x = kc_max(triangle.min_x, tile_min_x) & ~3;
+        i32 max_x = kc_min(triangle.max_x, tile_max_x);
+        i32 min_y = kc_max(triangle.min_y, tile_min_y);
+        i32 max_y = kc_min(triangle.max_y, tile_max_y);
+
+#if KC_MATH_SSE
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 lane_centers = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        const __m128 edge_a0 = _mm_set1_ps(triangle.edge_a[0]);
+        const __m128 edge_a1 = _mm_set1_ps(triangle.edge_a[1]);
+        const __m128 edge_a2 = _mm_set1_ps(triangle.edge_a[2]);
+        const __m128 depth_a = _mm_set1_ps(triangle.depth_a);
+        for(i32 y = min_y; y <= max_y; ++y)
+        {
+            float center_y = (float) y + 0.5f;
+            __m128 row_edge0 = _mm_set1_ps(triangle.edge_b[0] * center_y + triangle.edge_c[0]);
+            __m128 row_edge1 = _mm_set1_ps(triangle.edge_b[1] * center_y + triangle.edge_c[1]);
+            __m128 row_edge2 = _mm_set1_ps(triangle.edge_b[2] * center_y + triangle.edge_c[2]);
+            __m128 row_depth = _mm_set1_ps(triangle.depth_b * center_y + triangle.depth_c);
+            float* row = depth.data() + y * width;
+            for(i32 x = min_x; x <= max_x; x += 4)
+            {
+                __m128 center_x = _mm_add_ps(_mm_set1_ps((float) x), lane_centers);
+                __m128 edge0 = _mm_add_ps(_mm_mul_ps(edge_a0, center_x), row_edge0);
+                __m128 edge1 = _mm_add_ps(_mm_mul_ps(edge_a1, center_x), row_edge1);
+                __m128 edge2 = _mm_add_ps(_mm_mul_ps(edge_a2, center_x), row_edge2);
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(edge0, zero), _mm_and_ps(_mm_cmpge_ps(edge1, zero), _mm_cmpge_ps(edge2, zero)));
+                if(!_mm_movemask_ps(inside))
+                {
+                    continue;
+                }
+                __m128 old_depth = _mm_loadu_ps(row + x);
+                __m128 new_depth = _mm_min_ps(old_depth, _mm_add_ps(_mm_mul_ps(depth_a, center_x), row_depth));
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_depth), _mm_andnot_ps(inside, old_depth)));
+            }
+        }
+#else
+        for(i32 y = min_y; y <= max_y; ++y)
+        {
+            float center_y = (float) y + 0.5f;
+            float* row = depth.data() + y * width;
+            for(i32 x = min_x; x <= max_x; ++x)
+            {
+                float center_x = (float) x + 0.5f;
+                if(triangle.edge_a[0] * center_x + (triangle.edge_b[0] * center_y + triangle.edge_c[0]) >= 0.f
+                   && triangle.edge_a[1] * center_x + (triangle.edge_b[1] * center_y + triangle.edge_c[1]) >= 0.f
+                   && triangle.edge_a[2] * center_x + (triangle.edge_b[2] * center_y + triangle.edge_c[2]) >= 0.f)
+                {
+                    float z = triangle.depth_a * center_x + (triangle.depth_b * center_y + triangle.depth_c);
+                    row[x] = kc_min(row[x], z);
+                }
+            }
+        }
+#endif
+    }
+}
+
+bool software_occlusion_buffer_t::is_visible(const aabb_t& box) const
+{
+    float min_x = FLT_MAX;
+    float min_y = FLT_MAX;
+    float max_x = -FLT_MAX;
+    float max_y = -FLT_MAX;
+    float min_z = FLT_MAX;
+    // Corners are the min corner plus any of the box's edges along x, y and z, so four transforms make all eight
+    vec3 size = box.max - box.min;
+    vec4 min_corner = view_projection * make_vec4(box.min.x, box.min.y, box.min.z, 1.f);
+    vec4 edge_x = view_projection[0] * size.x;
+    vec4 edge_y = view_projection[1] * size.y;
+    vec4 edge_z = view_projection[2] * size.z;
+    for(i32 corner = 0; corner < 8; ++corner)
+    {
+        vec4 clip = min_corner;
+        clip = corner & 1 ? clip + edge_x : clip;
+        clip = corner & 2 ? clip + edge_y : clip;
+        clip = corner & 4 ? clip + edge_z : clip;
+        if(clip.z < -clip.w || clip.w <= 0.f)
+        {
+            return true;
+        }
+        float inverse_w = 1.f / clip.w;
+        float x = (clip.x * inverse_w * 0.5f + 0.5f) * (float) width;
+        float y = (clip.y * inverse_w * 0.5f + 0.5f) * (float) height;
+        min_x = kc_min(min_x, x);
+        min_y = kc_min(min_y, y);
+        max_x = kc_max(max_x, x);
+        max_y = kc_max(max_y, y);
+        min_z = kc_min(min_z, clip.z * inverse_w * 0.5f + 0.5f);
+    }
+    if(max_x < 0.f || max_y < 0.f || min_x > (float) width || min_y > (float) height || min_z > 1.f)
+    {
+        return false;
+    }
+
+    // Visible if any pixel the box's screen rectangle touches has its nearest point in front of the occluders
+    i32 pixel_min_x = kc_max((i32) floorf(min_x), 0);
+    i32 pixel_min_y = kc_max((i32) floorf(min_y), 0);
+    i32 pixel_max_x = kc_min((i32) floorf(max_x), width - 1);
+    i32 pixel_max_y = kc_min((i32) floorf(max_y), height - 1);
+#if KC_MATH_SSE
+    __m128 box_depth = _mm_set1_ps(min_z);
+    for(i32 y = pixel_min_y; y <= pixel_max_y; ++y)
+    {
+        const float* row = depth.data() + y * width;
+        for(i32 x = pixel_min_x & ~3; x <= pixel_max_x; x += 4)
+        {
+            i32 lanes = 0xf;
+            if(x < pixel_min_x)
+            {
+                lanes &= 0xf << (pixel_min_x - x);
+            }
+            if(x + 3 > pixel_max_x)
+            {
+                lanes &= 0xf >> (x + 3 - pixel_max_x);
+            }
+            if(_mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(row + x), box_depth)) & lanes)
+            {
+                return true;
+            }
+        }
+    }
+#else
+    for(i32 y = pixel_min_y; y <= pixel_max_y; ++y)
+    {
+        const float* row = depth.data() + y * width;
+        for(i32 x = pixel_min_x; x <= pixel_max_x; ++x)
+        {
+            if(row[x] > min_z)
+            {
+                return true;
+            }
+        }
+    }
+#endif
+    return false;
+}
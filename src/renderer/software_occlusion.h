@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../game_defines.h"
+#include "../core/kc_math.h"
+#include "frustum.h"
+
+/** Default resolution of a software occlusion buffer. Width is always rounded up to a multiple of 4 (one SIMD register). */
+#define SOFTWARE_OCCLUSION_WIDTH 256
+#define SOFTWARE_OCCLUSION_HEIGHT 128
+/** Size of the screen tiles the buffer is rasterized in. Each tile is rasterized by one thread. */
+#define SOFTWARE_OCCLUSION_TILE_WIDTH 64
+#define SOFTWARE_OCCLUSION_TILE_HEIGHT 32
+/** Below this many triangles, waking the worker threads costs more than it saves: rasterize on the calling thread */
+#define SOFTWARE_OCCLUSION_MIN_THREADED_TRIANGLES 128
+
+/** Low resolution depth buffer rasterized on the CPU, for occlusion culling without reading anything back from GL
+
+    Every frame: begin with the view projection, add the occluder meshes (large, simple meshes such as walls
+    and floors), rasterize, then test the bounds of everything else with is_visible before submitting it.
+    Triangles are clipped against the near plane and binned into screen tiles as they're added; rasterize
+    then fills the tiles in parallel, 4 pixels at a time with SSE (when kc_math has SIMD enabled). The worker
+    threads are started the first time they're needed and sleep between rasterize calls.
+    There's no backface culling, so occluders don't need to be closed or consistently wound.
+
+    Depth is window space [0, 1] like the GL depth buffer, 1 being the far plane. Coverage is sampled at
+    pixel centers, so an occluder's silhouette can hide things up to half a pixel beyond it. */
+struct software_occlusion_buffer_t
+{
+    software_occlusion_buffer_t();
+    /** Stops and joins the worker threads */
+    ~software_occlusion_buffer_t();
+    software_occlusion_buffer_t(const software_occlusion_buffer_t&) = delete;
+    software_occlusion_buffer_t& operator=(const software_occlusion_buffer_t&) = delete;
+
+    void set_resolution(i32 width, i32 height);
+    /** Threads rasterize uses, including the calling thread */
+    void set_thread_count(i32 count) { thread_count = kc_max(count, 1); }
+    /** Fewer triangles than this are rasterized on the calling thread only. 0 always uses every thread. */
+    void set_min_threaded_triangles(u32 count) { min_threaded_triangles = count; }
+
+    /** Clears the occluders and sets the view projection they and the tested bounds are transformed by */
+    void begin(const mat4& view_projection);
+    /** Clips, projects and bins the triangles of an occluder mesh (three indices per triangle) */
+    void add_occluder(const vec3* positions, u32 vertex_count, const u32* indices, u32 index_count, const mat4& model_matrix);
+    /** Clears the depth buffer and rasterizes every triangle added since begin */
+    void rasterize();
+
+    /** Returns false if box (world space) is hidden behind the rasterized occluders or is off screen.
+        Boxes that cross the near plane are always visible. */
+    bool is_visible(const aabb_t& box) const;
+
+    i32 get_width() const { return width; }
+    i32 get_height() const { return height; }
+    /** Rows from the bottom of the screen up, get_width() floats each */
+    const float* get_depth() const { return depth.data(); }
+    /** Triangles added since begin, after near plane clipping and off screen rejection */
+    u32 get_triangle_count() const { return (u32) triangles.size(); }
+
+private:
+    /** Screen space triangle with edge functions (e(x, y) = a x + b y + c, >= 0 inside) and depth plane */
+    struct occluder_triangle_t
+    {
+        float edge_a[3];
+        float edge_b[3];
+        float edge_c[3];
+        float depth_a;
+        float depth_b;
+        float depth_c;
+        i32 min_x;
+        i32 min_y;
+        i32 max_x;
+        i32 max_y;
+    };
+
+    /** Sets up and bins the triangle between three window space points (x, y in pixels, z depth) */
+    void add_screen_triangle(vec3 p0, vec3 p1, vec3 p2);
+    /** Takes the next tile until there are none left. Tiles don't share pixels, so any thread can take any tile. */
+    void rasterize_tiles();
+    void rasterize_tile(i32 tile);
+    /** Sleeps until rasterize starts a job this worker takes part in, until the buffer is destroyed */
+    void worker_loop(i32 worker_index, u32 job_generation_seen);
+
+    i32 width = 0;
+    i32 height = 0;
+    i32 tiles_x = 0;
+    i32 tiles_y = 0;
+    i32 thread_count = 1;
+    mat4 view_projection;
+    std::vector<float> depth;
+    std::vector<occluder_triangle_t> triangles;
+    /** Indices into triangles of every triangle overlapping each tile */
+    std::vector<std::vector<u32>> tile_bins;
+    /** Scratch for add_occluder */
+    std::vector<vec4> clip_positions;
+
+    u32 min_threaded_triangles = SOFTWARE_OCCLUSION_MIN_THREADED_TRIANGLES;
+    std::vector<std::thread> workers;
+    std::atomic<i32> next_tile;
+    /** Guards the members below. rasterize bumps job_generation to wake the workers, the first
+        job_worker_count of them help and decrement workers_running when they're out of tiles. */
+    std::mutex pool_mutex;
+    std::condition_variable pool_wake;
+    std::condition_variable pool_done;
+    u32 job_generation = 0;
+    i32 job_worker_count = 0;
+    i32 workers_running = 0;
+    bool b_stop_workers = false;
+};
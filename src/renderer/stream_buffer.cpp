@@ -0,0 +1,171 @@
+#include <cstring>
+#include "stream_buffer.h"
+#include "../core/kc_math.h"
+#include "../core/timer.h"
+#include "../debugging/profiling/profiler.h"
+
+INTERNAL GLsync stream_frame_fences[STREAM_BUFFER_FRAMES] = {};
+INTERNAL u32    stream_frame_region = 0;
+INTERNAL u64    stream_frame_number = 0;
+
+/** How long one glClientWaitSync call waits before trying again, in nanoseconds */
+INTERNAL const GLuint64 STREAM_FENCE_WAIT_TIMEOUT = 1000000;
+
+void stream_buffers_begin_frame()
+{
+    ++stream_frame_number;
+    stream_frame_region = (u32) (stream_frame_number % STREAM_BUFFER_FRAMES);
+
+    GLsync& fence = stream_frame_fences[stream_frame_region];
+    if(fence)
+    {
+        i64 wait_start = timer::get_ticks();
+        // The first wait flushes, otherwise the fence might never reach the GPU
+        GLbitfield wait_flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        GLenum result;
+        do
+        {
+            result = glClientWaitSync(fence, wait_flags, STREAM_FENCE_WAIT_TIMEOUT);
+            wait_flags = 0;
+        } while(result == GL_TIMEOUT_EXPIRED);
+        glDeleteSync(fence);
+        fence = nullptr;
+        profiler_get_frame_stats().stream_fence_wait_ms += profiler_ms_since(wait_start);
+    }
+}
+
+void stream_buffers_end_frame()
+{
+    GLsync& fence = stream_frame_fences[stream_frame_region];
+    if(fence)
+    {
+        glDeleteSync(fence);
+    }
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+u32 stream_buffers_get_frame_region()
+{
+    return stream_frame_region;
+}
+
+u64 stream_buffers_get_frame_number()
+{
+    return stream_frame_number;
+}
+
+u32 gl_get_storage_buffer_offset_alignment()
+{
+    local_persist GLint alignment = 0;
+    if(alignment == 0)
+    {
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        alignment = kc_max(alignment, 4);
+    }
+    return (u32) alignment;
+}
+
+u32 gl_get_uniform_buffer_offset_alignment()
+{
+    local_persist GLint alignment = 0;
+    if(alignment == 0)
+    {
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        alignment = kc_max(alignment, 4);
+    }
+    return (u32) alignment;
+}
+
+INTERNAL u32 align_up(u32 value, u32 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void stream_buffer_t::gl_create(u32 bytes_per_frame)
+{
+    gl_delete();
+    region_size = align_up(kc_max(bytes_per_frame, 1u), STREAM_BUFFER_REGION_ALIGNMENT);
+    head = 0;
+    head_frame = stream_frame_number;
+
+    u32 buffer_size = region_size * STREAM_BUFFER_FRAMES;
+    glGenBuffers(1, &id_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id_buffer);
+    if(GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage)
+    {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, buffer_size, nullptr, flags);
+        mapped = (u8*) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, buffer_size, flags);
+    }
+    else
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, buffer_size, nullptr, GL_DYNAMIC_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void stream_buffer_t::gl_delete()
+{
+    if(id_buffer)
+    {
+        // Deleting a buffer unmaps it. Commands already submitted keep the storage alive until they're done with it.
+        glDeleteBuffers(1, &id_buffer);
+        id_buffer = 0;
+    }
+    mapped = nullptr;
+    region_size = 0;
+}
+
+void stream_buffer_t::begin_region()
+{
+    if(head_frame != stream_frame_number)
+    {
+        head = 0;
+        head_frame = stream_frame_number;
+    }
+}
+
+void stream_buffer_t::reserve(u32 size)
+{
+    begin_region();
+    if(id_buffer == 0 || head + size > region_size)
+    {
+        // What was pushed earlier this frame stays in the old buffer, which the commands already submitted read from
+        gl_create(kc_max(region_size * 2, size));
+    }
+}
+
+u32 stream_buffer_t::push(const void* data, u32 size, u32 alignment)
+{
+    begin_region();
+    u32 region_offset = align_up(head, alignment);
+    if(id_buffer == 0 || region_offset + size > region_size)
+    {
+        reserve(size + alignment);
+        region_offset = 0;
+    }
+
+    u32 offset = get_region_offset() + region_offset;
+    write(offset, data, size);
+    head = region_offset + size;
+    return offset;
+}
+
+void stream_buffer_t::write(u32 offset, const void* data, u32 size)
+{
+    if(size == 0)
+    {
+        return;
+    }
+    if(mapped)
+    {
+        memcpy(mapped + offset, data, size);
+    }
+    else
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, id_buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    profiler_get_frame_stats().stream_bytes_written += size;
+}
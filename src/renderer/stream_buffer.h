@@ -0,0 +1,65 @@
+#pragma once
+
+#include "../game_defines.h"
+#include "GL/glew.h"
+
+/** Frames the CPU can get ahead of the GPU. Every stream buffer is split into one region per frame in flight. */
+#define STREAM_BUFFER_FRAMES 3
+/** Regions start at multiples of this, so any of them can be bound as a uniform or shader storage range */
+#define STREAM_BUFFER_REGION_ALIGNMENT 256
+
+/** Starts a frame of streaming: waits until the GPU is done with the frame that last wrote to this frame's
+    region (STREAM_BUFFER_FRAMES frames ago). Call once per frame before anything is streamed. */
+void stream_buffers_begin_frame();
+/** Fences the commands of this frame, call once everything that reads this frame's regions is submitted */
+void stream_buffers_end_frame();
+/** Region the current frame writes to, 0 to STREAM_BUFFER_FRAMES - 1 */
+u32 stream_buffers_get_frame_region();
+/** Counts the frames started, so buffers can tell when a new one begins */
+u64 stream_buffers_get_frame_number();
+/** GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT and GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, for offsets given to glBindBufferRange */
+u32 gl_get_storage_buffer_offset_alignment();
+u32 gl_get_uniform_buffer_offset_alignment();
+
+/** Buffer for data the CPU rewrites every frame (text vertices, draw commands, lights...)
+
+    Instead of re-specifying a buffer with glBufferData every time (which makes the driver allocate a new
+    store, or stall if it can't), the buffer is created once with glBufferStorage and mapped persistently.
+    It holds STREAM_BUFFER_FRAMES regions; each frame writes to its own region, which the fence in
+    stream_buffers_begin_frame guarantees the GPU is done reading. Without GL 4.4 / ARB_buffer_storage the
+    regions are written with glBufferSubData instead, which still never touches data the GPU may be reading.
+
+    push appends to the current region and returns where the data went; the region starts over every frame.
+    A frame that pushes more than the region holds grows the buffer (as a new GL buffer, see get_id). */
+struct stream_buffer_t
+{
+    /** bytes_per_frame is rounded up to STREAM_BUFFER_REGION_ALIGNMENT */
+    void gl_create(u32 bytes_per_frame);
+    void gl_delete();
+
+    /** Copies size bytes into the current frame's region and returns their offset in the buffer,
+        a multiple of alignment. Creates the buffer if it doesn't exist yet. */
+    u32 push(const void* data, u32 size, u32 alignment = 4);
+    /** Makes sure pushes of up to size bytes in total (alignment padding included) fit in the current region,
+        so that they all land in the same GL buffer */
+    void reserve(u32 size);
+    /** Copies size bytes to offset (in the buffer, not the region). Doesn't grow the buffer. */
+    void write(u32 offset, const void* data, u32 size);
+
+    /** Changes when the buffer grows: VAOs and bindings that use it must be pointed at the new one */
+    u32 get_id() const { return id_buffer; }
+    u32 get_region_size() const { return region_size; }
+    /** Offset of the current frame's region in the buffer */
+    u32 get_region_offset() const { return stream_buffers_get_frame_region() * region_size; }
+    bool is_persistently_mapped() const { return mapped != nullptr; }
+
+private:
+    u32 id_buffer = 0;
+    u32 region_size = 0;
+    u32 head = 0; // bytes pushed to the current region
+    u64 head_frame = 0;
+    u8* mapped = nullptr;
+
+    /** Starts over at the beginning of the region if a new frame began since the last push */
+    void begin_region();
+};
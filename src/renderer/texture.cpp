@@ -3,6 +3,7 @@
 #include "../game/memory_handle.h"
 #include "../core/file_system.h"
 #include "../debugging/console.h"
+#include "gl_state.h"
 
 INTERNAL std::unordered_map<std::string, texture_t> gpu_loaded_textures;
 
@@ -24,7 +25,7 @@ void texture_t::gl_create_from_bitmap(texture_t&        texture,
     texture.format = source_format;
 
     glGenTextures(1, &texture.texture_id);                                  // generate texture and grab texture id
-    glBindTexture(GL_TEXTURE_2D, texture.texture_id);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, texture.texture_id);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);       // wrapping
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);   // filtering (e.g. GL_NEAREST)
@@ -40,7 +41,7 @@ void texture_t::gl_create_from_bitmap(texture_t&        texture,
             GL_UNSIGNED_BYTE,                                               // data type of the texture data
             bitmap);                                                        // data
     glGenerateMipmap(GL_TEXTURE_2D);                                    // generate mip maps automatically
-    glBindTexture(GL_TEXTURE_2D, 0);
+    gl_state_bind_texture(0, GL_TEXTURE_2D, 0);
 }
 
 void texture_t::gl_create_from_file(texture_t&    texture,
@@ -69,6 +70,7 @@ void texture_t::gl_delete(texture_t& texture)
         console_printf("WARNING: Attempting to clear a texture with id: 0. This means this texture hasn't been loaded!\n");
         return;
     }
+    gl_state_forget_texture(texture.texture_id);
     glDeleteTextures(1, &texture.texture_id);
 
     // TODO find texture from loaded textures and delete
@@ -79,10 +81,9 @@ void texture_t::gl_delete(texture_t& texture)
     texture.format = GL_NONE;
 }
 
-void texture_t::gl_use_texture() const
+void texture_t::gl_use_texture(u32 unit) const
 {
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
+    gl_state_bind_texture(unit, GL_TEXTURE_2D, texture_id);
 }
 
 
@@ -90,7 +91,7 @@ void texture_t::gl_use_texture() const
 void cubemap_t::gl_create_from_files(cubemap_t& cubemap, const std::vector<std::string>& faces_paths)
 {
     glGenTextures(1, &cubemap.texture_id);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap.texture_id);
+    gl_state_bind_texture(0, GL_TEXTURE_CUBE_MAP, cubemap.texture_id);
 
     for(size_t i = 0; i < 6; ++i)
     {
@@ -107,5 +108,5 @@ void cubemap_t::gl_create_from_files(cubemap_t& cubemap, const std::vector<std::
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    gl_state_bind_texture(0, GL_TEXTURE_CUBE_MAP, 0);
 }
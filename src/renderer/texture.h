@@ -32,13 +32,12 @@ struct texture_t
     /** Deletes texture object from GPU memory; resets texture_id, width, height, bit_depth to 0. */
     static void gl_delete(texture_t& texture);
 
-    // Binds this texture to texture_t Unit 1
-    // When we are drawing and try to access texture_t Unit 0, we will be accessing this texture now
+    // Binds this texture to the given texture unit (1 unless told otherwise)
     // Anything drawn after this point will use these textures
     /** If we have multiple texture samplers or multiple texture_t Units, ensure sampler2D uniforms
         know which texture_t Unit to access via:
             glUnifrom1i(<texture_sampler_uniform_id>, <texture_unit_number>); */
-    void gl_use_texture() const;
+    void gl_use_texture(u32 unit = 1) const;
 };
 
 /** Handle for cubemap stored in GPU memory */